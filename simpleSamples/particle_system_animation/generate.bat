@@ -1,9 +1,8 @@
 @echo off
-setlocal enableDelayedExpansion
 
 set INPUTDIR=input
 set OUTPUTDIR=output
-FOR %%i in (%INPUTDIR%\*.ray) do (
-    set OUTPUTFILE=%OUTPUTDIR%\%%~ni.bmp
-    ray -w 512 "%%i" "!OUTPUTFILE!"
-)
+
+rem The input files differ only in numFrame, so one of them is loaded and
+rem frames 1 to 30 are rendered from it in a single run.
+ray -w 512 -f 1-30 "%INPUTDIR%\(1) - Copy.ray" "%OUTPUTDIR%\(%%d) - Copy.bmp"
@@ -1,5 +1,7 @@
 // The main ray tracer.
 
+#include <algorithm>
+
 #include <Fl/fl_ask.h>
 
 #include "RayTracer.h"
@@ -7,10 +9,12 @@
 #include "scene/material.h"
 #include "scene/ray.h"
 #include "fileio/read.h"
+#include "fileio/compiledscene.h"
 #include "fileio/parse.h"
 #include "fileio/HeightField.h"
 #include "ui/TraceUI.h"
-#include "fileio/bitmap.h"
+#include "fileio/mappedbitmap.h"
+#include "fileio/imagewriter.h"
 
 extern TraceUI* traceUI;
 
@@ -18,174 +22,240 @@ extern TraceUI* traceUI;
 // through the projection plane, and out into the scene.  All we do is
 // enter the main ray-tracing method, getting things started by plugging
 // in an initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
-vec3f RayTracer::trace( Scene *scene, double x, double y )
+vec3f RayTracer::trace( Scene *scene, double x, double y, const Geometry** hitObject )
 {
     ray r( vec3f(0,0,0), vec3f(0,0,0) );
     scene->getCamera()->rayThrough( x,y,r );
 	
 	mediaHistory.clear();
-	return traceRay( scene, r, vec3f(1.0,1.0,1.0), 0 ).clamp();
+	return traceRay( scene, r, vec3f(1.0,1.0,1.0), 0, hitObject );
+}
+
+// trace() through the corner of pixel (i,j), from the hit cache when it
+// holds the pixel's first hit, and filling it in when it doesn't.
+vec3f RayTracer::tracePrimary( int i, int j, const Geometry** hitObject )
+{
+	double x = double(i)/double(buffer_width);
+	double y = double(j)/double(buffer_height);
+	// hits from before the scene last changed are never shaded
+	if( !m_bHitCache || m_hits.empty() || m_hitVersion != m_sceneVersion )
+		return trace( scene, x, y, hitObject );
+
+	PrimaryHit& h = m_hits[ i + j * buffer_width ];
+	if( h.state == HIT_UNCACHED )
+		return trace( scene, x, y, hitObject );
+
+	ray r( vec3f(0,0,0), vec3f(0,0,0) );
+	scene->getCamera()->rayThrough( x,y,r );
+	mediaHistory.clear();
+
+	isect is;
+	if( h.state == HIT_UNKNOWN ) {
+		const Geometry* top;
+		if( !scene->intersect( r, is, top ) ) {
+			h.state = HIT_NOTHING;
+		} else if( is.material ) {
+			// a material made up for this hit, which isn't kept
+			h.state = HIT_UNCACHED;
+		} else {
+			h.obj = is.obj;
+			h.top = top;
+			h.t = is.t;
+			h.N = is.N;
+			h.state = HIT_OBJECT;
+		}
+	} else if( h.state == HIT_OBJECT ) {
+		is.obj = h.obj;
+		is.t = h.t;
+		is.N = h.N;
+	}
+
+	if( hitObject )
+		*hitObject = (h.state == HIT_NOTHING) ? NULL : h.top;
+	if( h.state == HIT_NOTHING )
+		return missColor( scene, r );
+	return shadeHit( scene, r, is, vec3f(1.0,1.0,1.0), 0 );
+}
+
+void RayTracer::setHitCache( bool enable )
+{
+	// filled in by the next traceSetup
+	m_bHitCache = enable;
+	m_hits.clear();
+}
+
+// The geometry may have changed, so no cached first hit holds; renders
+// trace without the cache until traceSetup makes a new one.
+void RayTracer::sceneChanged()
+{
+	++m_sceneVersion;
+	m_hits.clear();
 }
 
 // Do recursive ray tracing!  You'll want to insert a lot of code here
 // (or places called from here) to handle reflection, refraction, etc etc.
 vec3f RayTracer::traceRay( Scene *scene, const ray& r, 
-	const vec3f& thresh, int depth )
+	const vec3f& thresh, int depth, const Geometry** hitObject )
 {
 	isect i;
+	const Geometry* top;
 
-	if( scene->intersect( r, i ) ) {
-		vec3f shade;
+	bool hit = scene->intersect( r, i, top );
+	if( hitObject )
+		*hitObject = hit ? top : NULL;
 
-		if (m_bCaustic) {
-			//photon mapping mode
-			//shade += m_photon_map.shadeCaustic(r.at(i.t));
-			shade += m_photon_map.shade(r.at(i.t));
-		}
+	if( hit )
+		return shadeHit( scene, r, i, thresh, depth );
+	else
+		return missColor( scene, r );
+}
 
-		if (m_bTrace) {
+// The colour seen along r, which hits i.
+vec3f RayTracer::shadeHit( Scene *scene, const ray& r, isect& i,
+	const vec3f& thresh, int depth )
+{
+	vec3f shade;
 
-			const Material& m = i.getMaterial();
-			shade += m.shade(scene, r, i);
-			if (depth >= traceUI->getDepth()) 
-				return shade;
+	if (m_bCaustic) {
+		//photon mapping mode
+		//shade += m_photon_map.shadeCaustic(r.at(i.t));
+		shade += m_photon_map.shade(r.at(i.t));
+	}
 
-			vec3f conPoint = r.at(i.t); 
-			vec3f normal;
-			vec3f Rdir = 2 * (i.N*-r.getDirection()) * i.N - (-r.getDirection());
-			ray R = ray(conPoint, Rdir);
-		
+	if (m_bTrace) {
 
-			const double fresnel_coeff = getFresnelCoeff(i, r);
-			// cout << fresnel_coeff << endl;
-			// Reflection part
-			if (!i.getMaterial().kr.iszero()) 
-			{
-				shade += (fresnel_coeff*prod(i.getMaterial().kr, traceRay(scene, R, thresh, depth + 1)));
-			}
+		const Material& m = i.getMaterial();
+		shade += m.shade(scene, r, i);
+		if (depth >= traceUI->getDepth()) 
+			return shade;
+
+		vec3f conPoint = r.at(i.t); 
+		vec3f normal;
+		vec3f Rdir = 2 * (i.N*-r.getDirection()) * i.N - (-r.getDirection());
+		ray R = ray(conPoint, Rdir);
 	
-			// Refraction part
-			// We maintain a map, this map has order so it can be simulated as a extended stack		  
-			if (!i.getMaterial().kt.iszero())
-			{
-				// take account total refraction effect
-				bool TotalRefraction = false; 
-				// opposite ray
-				ray oppR(conPoint, r.getDirection()); //without refraction
-			
-				// marker to simulate a stack
-				bool toAdd = false, toErase = false;
-
-				// For now, the interior is just hardcoded
-				// That is, we judge it according to cap and whether it is box
-				if (i.obj->hasInterior())
-				{
-					// refractive index
-					double indexA, indexB;
-
-					// For ray go out of an object
-					if (i.N*r.getDirection() > RAY_EPSILON)
-					{
-						if (mediaHistory.empty())
-						{
-							indexA = 1.0;
-						}
-						else
-						{
-							// return the refractive index of last object
-							indexA = mediaHistory.rbegin()->second.index;
-						}
-
-						mediaHistory.erase(i.obj->getOrder());
-						toAdd = true;
-						if (mediaHistory.empty())
-						{
-							indexB = 1.0;
-						}
-						else
-						{
-							indexB = mediaHistory.rbegin()->second.index;
-						}
-						normal = -i.N;
-					}
-					// For ray get in the object
-					else
-					{
-						if (mediaHistory.empty())
-						{
-							indexA = 1.0;
-						}
-						else
-						{
-							indexA = mediaHistory.rbegin()->second.index;
-						}
-						mediaHistory.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
-						toErase = true;
-						indexB = mediaHistory.rbegin()->second.index;
-						normal = i.N;
-					}
-
-					double indexRatio = indexA / indexB;
-					double cos_i = max(min(normal*((-r.getDirection()).normalize()), 1.0), -1.0); //SYSNOTE: min(x, 1.0) to prevent cos_i becomes bigger than 1
-					double sin_i = sqrt(1 - cos_i*cos_i);
-					double sin_t = sin_i * indexRatio;
-
-					if (sin_t > 1.0)
-					{
-						TotalRefraction = true;
-					}
-					else
-					{
-						TotalRefraction = false;
-						double cos_t = sqrt(1 - sin_t*sin_t);
-						vec3f Tdir = (indexRatio*cos_i - cos_t)*normal - indexRatio*-r.getDirection();
-						oppR = ray(conPoint, Tdir);
-						if (!traceUI->IsEnableFresnel()) {
-							shade += prod(i.getMaterial().kt, traceRay(scene, oppR, thresh, depth + 1));
-						}
-						else
-						{
-							shade += ((1 - fresnel_coeff)*prod(i.getMaterial().kt, traceRay(scene, oppR, thresh, depth + 1)));
-						}
-					}
-				}
 
-				if (toAdd)
-				{
-					mediaHistory.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
+		const double fresnel_coeff = getFresnelCoeff(i, r);
+		// cout << fresnel_coeff << endl;
+		// Reflection part
+		if (!i.getMaterial().kr.iszero()) 
+		{
+			shade += (fresnel_coeff*prod(i.getMaterial().kr, traceRay(scene, R, thresh, depth + 1)));
+		}
+
+		// Refraction part
+		// We maintain a map, this map has order so it can be simulated as a extended stack		  
+		// For now, the interior is just hardcoded
+		// That is, we judge it according to cap and whether it is box
+		if (!i.getMaterial().kt.iszero() && i.obj->hasInterior())
+		{
+			bool entering;
+			vec3f Tdir;
+			if (refract(r, i, mediaHistory, Tdir, entering))
+			{
+				ray oppR(conPoint, Tdir);
+				if (!traceUI->IsEnableFresnel()) {
+					shade += prod(i.getMaterial().kt, traceRay(scene, oppR, thresh, depth + 1));
 				}
-				if (toErase)
+				else
 				{
-					mediaHistory.erase(i.obj->getOrder());
+					shade += ((1 - fresnel_coeff)*prod(i.getMaterial().kt, traceRay(scene, oppR, thresh, depth + 1)));
 				}
 			}
+
+			// back to the media this ray is in
+			if (entering)
+			{
+				mediaHistory.erase(i.obj->getOrder());
+			}
+			else
+			{
+				mediaHistory.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
+			}
 		}
-		
+	}
+
+	// what a bounce passes back up is clamped, but the colour of the
+	// first hit is kept as it is for the float framebuffer
+	if (depth > 0)
 		shade = shade.clamp();
-		return shade;
+	return shade;
+}
+
+// When the light go to infinity
+// If already set a background image, return the image pixel
+// otherwise just black
+vec3f RayTracer::missColor(Scene *scene, const ray& r)
+{
+	// every ray is filtered as widely as a primary ray; bounces off
+	// curved surfaces would spread wider
+	return m_background.lookup( r.getDirection(), m_pixelSpread );
+}
+
+// Crossing the surface of i.obj takes the ray into or out of its medium.
+// media is updated to the media on the far side, and dir gets the
+// refracted direction; returns false on total internal reflection.
+bool RayTracer::refract(const ray& r, const isect& i, std::map<int, Material>& media, vec3f& dir, bool& entering)
+{
+	// refractive index
+	double indexA, indexB;
+	vec3f normal;
+
+	if (media.empty())
+	{
+		indexA = 1.0;
 	}
-	else {
-		// when the light go to infinity
-		// If already set a background image, return the image pixel
-		// otherwise just black
-		if (useBackground)
-		{
-			vec3f x = scene->getCamera()->getU();
-			vec3f y = scene->getCamera()->getV();
-			vec3f z = scene->getCamera()->getLook();
-			double dis_x = r.getDirection() * x;
-			double dis_y = r.getDirection() * y;
-			double dis_z = r.getDirection() * z;
-			return getBackgroundImage(dis_x / dis_z + 0.5, dis_y / dis_z + 0.5);
-		}
-		else
-		{
-			return vec3f(0.0, 0.0, 0.0);
-		}
+	else
+	{
+		// return the refractive index of last object
+		indexA = media.rbegin()->second.index;
+	}
+
+	// For ray go out of an object
+	entering = !(i.N*r.getDirection() > RAY_EPSILON);
+	if (!entering)
+	{
+		media.erase(i.obj->getOrder());
+		normal = -i.N;
+	}
+	// For ray get in the object
+	else
+	{
+		media.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
+		normal = i.N;
+	}
+
+	if (media.empty())
+	{
+		indexB = 1.0;
 	}
+	else
+	{
+		indexB = media.rbegin()->second.index;
+	}
+
+	double indexRatio = indexA / indexB;
+	double cos_i = max(min(normal*((-r.getDirection()).normalize()), 1.0), -1.0); //SYSNOTE: min(x, 1.0) to prevent cos_i becomes bigger than 1
+	double sin_i = sqrt(1 - cos_i*cos_i);
+	double sin_t = sin_i * indexRatio;
+
+	// take account total refraction effect
+	if (sin_t > 1.0)
+	{
+		return false;
+	}
+
+	double cos_t = sqrt(1 - sin_t*sin_t);
+	dir = (indexRatio*cos_i - cos_t)*normal - indexRatio*-r.getDirection();
+	return true;
 }
 
 double RayTracer::getFresnelCoeff(isect& i, const ray& r)
+{
+	return getFresnelCoeff(i, r, mediaHistory);
+}
+
+double RayTracer::getFresnelCoeff(isect& i, const ray& r, std::map<int, Material>& media)
 {
 	if (!traceUI->IsEnableFresnel())
 	{
@@ -197,41 +267,41 @@ double RayTracer::getFresnelCoeff(isect& i, const ray& r)
 		double indexA, indexB;
 		if (i.N*r.getDirection() > RAY_EPSILON)
 		{
-			if (mediaHistory.empty())
+			if (media.empty())
 			{
 				indexA = 1.0;
 			}
 			else
 			{
-				indexA = mediaHistory.rbegin()->second.index;
+				indexA = media.rbegin()->second.index;
 			}
-			mediaHistory.erase(i.obj->getOrder());
-			if (mediaHistory.empty())
+			media.erase(i.obj->getOrder());
+			if (media.empty())
 			{
 				indexB = 1.0;
 			}
 			else
 			{
-				indexB = mediaHistory.rbegin()->second.index;
+				indexB = media.rbegin()->second.index;
 			}
 			normal = -i.N;
-			mediaHistory.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
+			media.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
 		}
 		// For ray get in the object
 		else
 		{
-			if (mediaHistory.empty())
+			if (media.empty())
 			{
 				indexA = 1.0;
 			}
 			else
 			{
-				indexA = mediaHistory.rbegin()->second.index;
+				indexA = media.rbegin()->second.index;
 			}
 			normal = i.N;
-			mediaHistory.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
-			indexB = mediaHistory.rbegin()->second.index;
-			mediaHistory.erase(i.obj->getOrder());
+			media.insert(make_pair(i.obj->getOrder(), i.getMaterial()));
+			indexB = media.rbegin()->second.index;
+			media.erase(i.obj->getOrder());
 		}
 
 		double r0 = (indexA - indexB) / (indexA + indexB);
@@ -266,19 +336,19 @@ double RayTracer::getFresnelCoeff(isect& i, const ray& r)
 
 void RayTracer::loadBackground(char* fn)
 {
-	unsigned char* data = NULL;
-	data = readBMP(fn, background_width, background_height);
-	if (data){
-		if (backgroundImage) delete[] backgroundImage;
-		useBackground = true;
-		backgroundImage = data;
+	// the pixels go straight from the mapped file into the map's floats
+	MappedBitmap bmp;
+	if (bmp.open(fn)) {
+		m_background.load(bmp);
+		m_backgroundFile = fn;
 	}
 }
 
 RayTracer::RayTracer() : 
-mediaHistory(), m_bCaustic(false), m_bTrace(false), backgroundImage(NULL), useBackground(false)
+m_pixelSpread(0.0), mediaHistory(), m_bCaustic(false), m_bTrace(false), m_bWavefront(false), m_aaDepth(0), m_aaThreshold(0.1), m_aaSamples(0), m_aaPixels(0), m_bandStart(0), m_bandRows(0), m_dirtyColumns(0), m_dirtyRows(0), m_anyDirty(false), m_bHitCache(false), m_sceneVersion(0), m_hitVersion(-1), m_bTrackTiles(false)
 {
 	buffer = NULL;
+	bufferSize = 0;
 	buffer_width = buffer_height = 256;
 	scene = NULL;
 
@@ -286,39 +356,164 @@ mediaHistory(), m_bCaustic(false), m_bTrace(false), backgroundImage(NULL), useBa
 }
 
 void RayTracer::clearBackground(){
-	if (backgroundImage) delete[] backgroundImage;
-	backgroundImage = NULL;
-	useBackground = false;
-	background_height = background_width = 0;
+	m_background.clear();
+	m_backgroundFile.clear();
 }
 
-vec3f RayTracer::getBackgroundImage(double x, double y){
-	if (!useBackground) return vec3f(0, 0, 0);
-	int xGrid = int(x*background_width);
-	int yGrid = int(y*background_height);
-	if (xGrid < 0 || xGrid >= background_width || yGrid < 0 || yGrid >= background_height) 
-	{
-		return vec3f(0, 0, 0);
-	}
-	double val1 = backgroundImage[(yGrid*background_width + xGrid) * 3] / 255.0;
-	double val2 = backgroundImage[(yGrid*background_width + xGrid) * 3 + 1] / 255.0;
-	double val3 = backgroundImage[(yGrid*background_width + xGrid) * 3 + 2] / 255.0;
-	return vec3f(val1, val2, val3);
+void RayTracer::getSourceFiles( vector<string>& files ) const
+{
+	files.clear();
+	if( scene )
+		files = scene->getSourceFiles();
+	if( !m_backgroundFile.empty() )
+		files.push_back( m_backgroundFile );
 }
 
-
 RayTracer::~RayTracer()
 {
-	if (backgroundImage) delete[] backgroundImage;
 	delete [] buffer;
 	delete scene;
 }
 
+// The framebuffer holds linear colour, which may be brighter than white;
+// it is only clamped to 8 bits on the way out, by toByte.
 void RayTracer::getBuffer( unsigned char *&buf, int &w, int &h )
 {
+	int rows = bandRows();
+	if( !buffer || bufferSize != buffer_width * rows * 3 ) {
+		delete [] buffer;
+		bufferSize = buffer_width * rows * 3;
+		buffer = new unsigned char[ bufferSize ];
+	}
+
+	for( int j = 0; j < rows; ++j ) {
+		for( int i = 0; i < buffer_width; ++i ) {
+			vec3f col = getPixel( i, m_bandStart + j );
+			unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+			pixel[0] = toByte( (float)col[0] );
+			pixel[1] = toByte( (float)col[1] );
+			pixel[2] = toByte( (float)col[2] );
+		}
+	}
+
 	buf = buffer;
 	w = buffer_width;
-	h = buffer_height;
+	h = rows;
+}
+
+// display tiles are uploaded whole, so are kept small enough that a
+// few new pixels cost little to show
+static const int s_displayTile = 32;
+
+int RayTracer::displayTileSize()
+{
+	return s_displayTile;
+}
+
+void RayTracer::getBufferSize( int &w, int &h ) const
+{
+	// nothing until traceSetup
+	w = m_sampleCount.empty() ? 0 : buffer_width;
+	h = m_sampleCount.empty() ? 0 : bandRows();
+}
+
+void RayTracer::getRegion( const Region& r, unsigned char *out ) const
+{
+	for( int j = r.y; j < r.y + r.h; ++j ) {
+		for( int i = r.x; i < r.x + r.w; ++i, out += 3 ) {
+			vec3f col = getPixel( i, m_bandStart + j );
+			out[0] = toByte( (float)col[0] );
+			out[1] = toByte( (float)col[1] );
+			out[2] = toByte( (float)col[2] );
+		}
+	}
+}
+
+// A tracing thread marks a tile after every pixel it writes there, with a
+// release store even when the mark is already set, and the display clears
+// the mark with an acquire exchange before reading the tile.  So every
+// pixel written before the display takes the mark is seen, and one written
+// later marks the tile again and is shown next time.  getRegion may still
+// read a pixel that is being written, half old and half new; that only
+// shows for one frame, and the display allows it.
+void RayTracer::markDirty( int i, int j )
+{
+	m_dirty[ ((j - m_bandStart) / s_displayTile) * m_dirtyColumns + i / s_displayTile ].store( true, std::memory_order_release );
+	m_anyDirty.store( true, std::memory_order_release );
+}
+
+void RayTracer::markAllDirty()
+{
+	for( int t = 0; t < m_dirtyColumns * m_dirtyRows; ++t )
+		m_dirty[t].store( true, std::memory_order_release );
+	m_anyDirty.store( true, std::memory_order_release );
+}
+
+void RayTracer::takeDirtyRegions( std::vector<Region>& regions )
+{
+	regions.clear();
+	m_anyDirty.store( false, std::memory_order_release );
+
+	int rows = bandRows();
+	for( int ty = 0; ty < m_dirtyRows; ++ty ) {
+		for( int tx = 0; tx < m_dirtyColumns; ) {
+			if( !m_dirty[ ty * m_dirtyColumns + tx ].exchange( false, std::memory_order_acq_rel ) ) {
+				++tx;
+				continue;
+			}
+			int end = tx + 1;
+			while( end < m_dirtyColumns && m_dirty[ ty * m_dirtyColumns + end ].exchange( false, std::memory_order_acq_rel ) )
+				++end;
+
+			Region r;
+			r.x = tx * s_displayTile;
+			r.y = ty * s_displayTile;
+			r.w = min( end * s_displayTile, buffer_width ) - r.x;
+			r.h = min( r.y + s_displayTile, rows ) - r.y;
+			regions.push_back( r );
+			tx = end;
+		}
+	}
+}
+
+int RayTracer::bandRows() const
+{
+	return m_bandRows > 0 ? min( m_bandRows, buffer_height - m_bandStart ) : buffer_height;
+}
+
+void RayTracer::setBand( int start, int rows )
+{
+	m_bandStart = start;
+	m_bandRows = rows;
+	clearBand();
+}
+
+bool RayTracer::saveBand( FILE *fp ) const
+{
+	return fwrite( &m_accum[0], sizeof( float ), m_accum.size(), fp ) == m_accum.size()
+		&& fwrite( &m_sampleCount[0], sizeof( int ), m_sampleCount.size(), fp ) == m_sampleCount.size();
+}
+
+bool RayTracer::loadBand( FILE *fp )
+{
+	markAllDirty();
+	return fread( &m_accum[0], sizeof( float ), m_accum.size(), fp ) == m_accum.size()
+		&& fread( &m_sampleCount[0], sizeof( int ), m_sampleCount.size(), fp ) == m_sampleCount.size();
+}
+
+void RayTracer::clearBand()
+{
+	m_accum.assign( buffer_width * bandRows() * 3, 0.0f );
+	m_sampleCount.assign( buffer_width * bandRows(), 0 );
+
+	int columns = (buffer_width + s_displayTile - 1) / s_displayTile;
+	int rows = (bandRows() + s_displayTile - 1) / s_displayTile;
+	if( columns != m_dirtyColumns || rows != m_dirtyRows ) {
+		m_dirtyColumns = columns;
+		m_dirtyRows = rows;
+		m_dirty.reset( new std::atomic<bool>[ columns * rows ] );
+	}
+	markAllDirty();
 }
 
 double RayTracer::aspectRatio()
@@ -331,15 +526,27 @@ bool RayTracer::sceneLoaded()
 	return m_bSceneLoaded;
 }
 
+void RayTracer::setFrame( int frame )
+{
+	if( scene )
+		scene->setFrame( frame );
+	sceneChanged();
+	if( m_bTrackTiles && scene )
+		markChangedTiles();
+}
+
 bool RayTracer::loadScene( char* fn )
 {
 	try
 	{
-		scene = readScene( fn );
+		if( isCompiledScene( fn ) )
+			scene = readCompiledScene( fn );
+		else
+			scene = readScene( fn );
 	}
 	catch( ParseError pe )
 	{
-		fl_alert( "ParseError: %s\n", pe );
+		fl_alert( "ParseError: %s\n", pe.getMsg().c_str() );
 		return false;
 	}
 
@@ -349,8 +556,7 @@ bool RayTracer::loadScene( char* fn )
 	buffer_width = 256;
 	buffer_height = (int)(buffer_width / scene->getCamera()->getAspectRatio() + 0.5);
 
-	bufferSize = buffer_width * buffer_height * 3;
-	buffer = new unsigned char[ bufferSize ];
+	clearBand();
 	
 	// separate objects into bounded and unbounded
 	scene->initScene();
@@ -358,6 +564,7 @@ bool RayTracer::loadScene( char* fn )
 	// Add any specialized scene loading code here
 	
 	m_bSceneLoaded = true;
+	sceneChanged();
 
 	return true;
 }
@@ -380,8 +587,7 @@ bool RayTracer::loadHeightMap(char* fn)
 	buffer_width = 256;
 	buffer_height = (int)(buffer_width / scene->getCamera()->getAspectRatio() + 0.5);
 
-	bufferSize = buffer_width * buffer_height * 3;
-	buffer = new unsigned char[bufferSize];
+	clearBand();
 
 	// separate objects into bounded and unbounded
 	scene->initScene();
@@ -389,22 +595,32 @@ bool RayTracer::loadHeightMap(char* fn)
 	// Add any specialized scene loading code here
 
 	m_bSceneLoaded = true;
+	sceneChanged();
 
 	return true;
 }
 
 void RayTracer::traceSetup(int w, int h, bool trace, bool caustic, int photonNum, int queryNum, double coneAtten, double amplify)
 {
-	if( buffer_width != w || buffer_height != h )
-	{
-		buffer_width = w;
-		buffer_height = h;
+	// the cached hits last while the scene and image size do
+	if( m_bHitCache && (m_hitVersion != m_sceneVersion || buffer_width != w || buffer_height != h || m_hits.empty()) ) {
+		PrimaryHit unknown;
+		unknown.state = HIT_UNKNOWN;
+		m_hits.assign( w * h, unknown );
+		m_hitVersion = m_sceneVersion;
+	}
 
-		bufferSize = buffer_width * buffer_height * 3;
-		delete [] buffer;
-		buffer = new unsigned char[ bufferSize ];
+	buffer_width = w;
+	buffer_height = h;
+	clearBand();
+	// the shadow caches' counts are this render's
+	Light::resetShadowCaches();
+	m_footprints.clear();
+	if( scene ) {
+		Camera *camera = scene->getCamera();
+		m_background.setFrame( camera->getU(), camera->getV(), camera->getLook() );
+		m_pixelSpread = camera->getNormalizedHeight() / h;
 	}
-	memset( buffer, 0, w*h*3 );
 	m_bTrace = trace;
 	m_bCaustic = caustic;
 	if (caustic) {
@@ -413,6 +629,97 @@ void RayTracer::traceSetup(int w, int h, bool trace, bool caustic, int photonNum
 	}
 }
 
+// traceLines works through the image in squares this wide in wavefront mode
+static const int s_tileSize = 32;
+
+// tile tracking's tiles are smaller, so that a change re-traces less
+static const int s_trackedTileSize = 16;
+
+void RayTracer::setTileTracking( bool enable )
+{
+	m_bTrackTiles = enable;
+	m_footprints.clear();
+}
+
+int RayTracer::tileCount() const
+{
+	int s = s_trackedTileSize;
+	return ( (buffer_width + s - 1) / s ) * ( (buffer_height + s - 1) / s );
+}
+
+// Flag the tiles whose rays went through something the frame change
+// touched, or all of them if it reached beyond the footprints' grid.
+void RayTracer::markChangedTiles()
+{
+	if( m_footprints.empty() )
+		return;
+
+	Footprint changed;
+	changed.reset( &m_footprintGrid );
+	const vector<BoundingBox>& boxes = scene->getChangedBounds();
+	for( size_t k = 0; k < boxes.size(); ++k ) {
+		if( !changed.addBox( boxes[k] ) ) {
+			m_footprints.clear();
+			return;
+		}
+	}
+
+	for( size_t t = 0; t < m_footprints.size(); ++t ) {
+		if( m_footprints[t].overlaps( changed ) )
+			m_tileChanged[t] = true;
+	}
+}
+
+int RayTracer::traceChangedTiles()
+{
+	if( !scene )
+		return 0;
+
+	int s = s_trackedTileSize;
+	int across = (buffer_width + s - 1) / s;
+	if( m_footprints.empty() ) {
+		// Everything, with footprints on a grid around what the last frame
+		// change touched, and room for it to move; only rays that pass
+		// through the grid can see later changes.  Without a change to go
+		// by, the grid covers the scene.
+		const BoundingBox& scene_bounds = scene->getSceneBounds();
+		vec3f size = scene_bounds.max - scene_bounds.min;
+		const vector<BoundingBox>& boxes = scene->getChangedBounds();
+		m_footprintGrid = boxes.empty() ? scene_bounds : boxes[0];
+		for( size_t k = 1; k < boxes.size(); ++k )
+			m_footprintGrid = m_footprintGrid.plus( boxes[k] );
+		vec3f pad = (m_footprintGrid.max - m_footprintGrid.min) + size * 0.05
+			+ vec3f( RAY_EPSILON, RAY_EPSILON, RAY_EPSILON );
+		m_footprintGrid.min -= pad;
+		m_footprintGrid.max += pad;
+		m_footprints.assign( tileCount(), Footprint() );
+		m_tileChanged.assign( tileCount(), true );
+	}
+
+	int traced = 0;
+	for( int t = 0; t < (int)m_footprints.size(); ++t ) {
+		if( !m_tileChanged[t] )
+			continue;
+
+		int x0 = (t % across) * s, y0 = (t / across) * s;
+		int x1 = min( x0 + s, buffer_width ), y1 = min( y0 + s, buffer_height );
+		m_footprints[t].reset( &m_footprintGrid );
+		Footprint::setCurrent( &m_footprints[t] );
+		if( m_bWavefront ) {
+			traceTile( x0, y0, x1, y1 );
+		} else {
+			for( int j = y0; j < y1; ++j )
+				for( int i = x0; i < x1; ++i )
+					tracePixel( i, j );
+		}
+		Footprint::setCurrent( NULL );
+
+		m_tileChanged[t] = false;
+		++traced;
+	}
+	return traced;
+}
+
 void RayTracer::traceLines( int start, int stop )
 {
 	vec3f col;
@@ -422,6 +729,33 @@ void RayTracer::traceLines( int start, int stop )
 	if( stop > buffer_height )
 		stop = buffer_height;
 
+	if( m_bWavefront ) {
+		for( int j = start; j < stop; j += s_tileSize )
+			for( int i = 0; i < buffer_width; i += s_tileSize )
+				traceTile( i, j, i + s_tileSize, min( j + s_tileSize, stop ) );
+		return;
+	}
+
+	if( m_aaDepth > 0 ) {
+		// each row of pixel corners is traced once, for the rows of
+		// pixels above and below it
+		vector<Sample> above( buffer_width + 1 ), below( buffer_width + 1 );
+		for( int i = 0; i <= buffer_width; ++i )
+			above[i] = sampleCorner( i, start );
+		for( int j = start; j < stop; ++j ) {
+			for( int i = 0; i <= buffer_width; ++i )
+				below[i] = sampleCorner( i, j + 1 );
+			for( int i = 0; i < buffer_width; ++i ) {
+				Sample corners[4] = { above[i], above[i + 1], below[i], below[i + 1] };
+				setPixel( i, j, refine( double(i)/double(buffer_width), double(j)/double(buffer_height),
+					1.0/double(buffer_width), 1.0/double(buffer_height), corners, 0 ) );
+			}
+			m_aaPixels += buffer_width;
+			above.swap( below );
+		}
+		return;
+	}
+
 	for( int j = start; j < stop; ++j )
 		for( int i = 0; i < buffer_width; ++i )
 			tracePixel(i,j);
@@ -437,11 +771,331 @@ void RayTracer::tracePixel( int i, int j )
 	double x = double(i)/double(buffer_width);
 	double y = double(j)/double(buffer_height);
 
-	col = trace( scene,x,y );
+	if( m_aaDepth > 0 ) {
+		double w = 1.0/double(buffer_width), h = 1.0/double(buffer_height);
+		// only the pixel's own corner goes through the hit cache: the
+		// others are other pixels' entries, which another thread may be
+		// writing
+		double x1 = double(i + 1)/double(buffer_width), y1 = double(j + 1)/double(buffer_height);
+		Sample corners[4] = { sampleCorner( i, j ), sample( x1, y ), sample( x, y1 ), sample( x1, y1 ) };
+		setPixel( i, j, refine( x, y, w, h, corners, 0 ) );
+		++m_aaPixels;
+		return;
+	}
+
+	col = tracePrimary( i, j );
+
+	setPixel( i, j, col );
+}
+
+void RayTracer::setSupersampling( int maxDepth, double threshold )
+{
+	m_aaDepth = maxDepth;
+	m_aaThreshold = threshold;
+}
 
-	unsigned char *pixel = buffer + ( i + j * buffer_width ) * 3;
+double RayTracer::samplesPerPixel() const
+{
+	return m_aaPixels > 0 ? double( m_aaSamples ) / double( m_aaPixels ) : 1.0;
+}
 
-	pixel[0] = (int)( 255.0 * col[0]);
-	pixel[1] = (int)( 255.0 * col[1]);
-	pixel[2] = (int)( 255.0 * col[2]);
-}
\ No newline at end of file
+RayTracer::Sample RayTracer::sample( double x, double y )
+{
+	Sample s;
+	s.color = trace( scene, x, y, &s.object );
+	++m_aaSamples;
+	return s;
+}
+
+// the sample at the corner of pixel (i,j), which may be past the image
+RayTracer::Sample RayTracer::sampleCorner( int i, int j )
+{
+	if( i >= buffer_width || j >= buffer_height )
+		return sample( double(i)/double(buffer_width), double(j)/double(buffer_height) );
+
+	Sample s;
+	s.color = tracePrimary( i, j, &s.object );
+	++m_aaSamples;
+	return s;
+}
+
+// The colour of the rectangle at (x,y), w by h, given samples at its
+// corners (top left, top right, bottom left, bottom right): their mean,
+// unless they differ by more than the threshold in some channel or see
+// different objects, in which case the rectangle is split into four.
+vec3f RayTracer::refine( double x, double y, double w, double h, const Sample *corners, int depth )
+{
+	bool split = false;
+	if( depth < m_aaDepth ) {
+		for( int k = 1; k < 4 && !split; ++k ) {
+			if( corners[k].object != corners[0].object )
+				split = true;
+			for( int c = 0; c < 3; ++c ) {
+				if( fabs( corners[k].color[c] - corners[0].color[c] ) > m_aaThreshold )
+					split = true;
+			}
+		}
+	}
+
+	if( !split )
+		return (corners[0].color + corners[1].color + corners[2].color + corners[3].color) * 0.25;
+
+	double hw = w * 0.5, hh = h * 0.5;
+	Sample top = sample( x + hw, y );
+	Sample left = sample( x, y + hh );
+	Sample centre = sample( x + hw, y + hh );
+	Sample right = sample( x + w, y + hh );
+	Sample bottom = sample( x + hw, y + h );
+
+	Sample q0[4] = { corners[0], top, left, centre };
+	Sample q1[4] = { top, corners[1], centre, right };
+	Sample q2[4] = { left, centre, corners[2], bottom };
+	Sample q3[4] = { centre, right, bottom, corners[3] };
+	return (refine( x, y, hw, hh, q0, depth + 1 ) + refine( x + hw, y, hw, hh, q1, depth + 1 )
+		+ refine( x, y + hh, hw, hh, q2, depth + 1 ) + refine( x + hw, y + hh, hw, hh, q3, depth + 1 )) * 0.25;
+}
+
+// The first progressive pass traces one pixel in each block this wide.
+static const int s_firstBlock = 16;
+
+int RayTracer::coarsePasses()
+{
+	int passes = 1;
+	for( int s = s_firstBlock; s > 1; s /= 2 )
+		++passes;
+	return passes;
+}
+
+// the radical inverse of k in the given base, for spreading samples out
+static double halton( int k, int base )
+{
+	double f = 1.0, r = 0.0;
+	for( ; k > 0; k /= base ) {
+		f /= base;
+		r += f * (k % base);
+	}
+	return r;
+}
+
+void RayTracer::tracePass( int pass, int start, int stop )
+{
+	if( !scene )
+		return;
+
+	if( stop > buffer_height )
+		stop = buffer_height;
+
+	if( pass < coarsePasses() ) {
+		// the pixels at multiples of the block size, less those that
+		// were at multiples of the last pass's.  A block the band starts
+		// part way into has its corner traced again to fill the band's
+		// share of it; that corner's row is another band's, so it is
+		// left out of the hit cache.
+		int s = s_firstBlock >> pass;
+		for( int j = start / s * s; j < stop; j += s ) {
+			int y0 = max( j, start ), y1 = min( j + s, stop );
+			for( int i = 0; i < buffer_width; i += s ) {
+				if( pass > 0 && i % (2 * s) == 0 && j % (2 * s) == 0 )
+					continue;
+				vec3f col = (j >= start) ? tracePrimary( i, j )
+					: trace( scene, double(i)/double(buffer_width), double(j)/double(buffer_height) );
+				for( int y = y0; y < y1; ++y )
+					for( int x = i; x < min( i + s, buffer_width ); ++x )
+						setPixel( x, y, col );
+			}
+		}
+		return;
+	}
+
+	// pass k after the coarse ones samples every pixel at the k'th point
+	// of a Halton sequence; the 0th is the corner they already sampled
+	int k = pass - coarsePasses() + 1;
+	double dx = halton( k, 2 ), dy = halton( k, 3 );
+	for( int j = start; j < stop; ++j ) {
+		for( int i = 0; i < buffer_width; ++i ) {
+			addSample( i, j, trace( scene, (i + dx)/double(buffer_width), (j + dy)/double(buffer_height) ) );
+		}
+	}
+}
+
+void RayTracer::addSample( int i, int j, const vec3f& col )
+{
+	float *sum = &m_accum[ (i + (j - m_bandStart) * buffer_width) * 3 ];
+	sum[0] += (float)col[0];
+	sum[1] += (float)col[1];
+	sum[2] += (float)col[2];
+	++m_sampleCount[ i + (j - m_bandStart) * buffer_width ];
+	markDirty( i, j );
+}
+
+void RayTracer::setPixel( int i, int j, const vec3f& col )
+{
+	float *sum = &m_accum[ (i + (j - m_bandStart) * buffer_width) * 3 ];
+	sum[0] = (float)col[0];
+	sum[1] = (float)col[1];
+	sum[2] = (float)col[2];
+	m_sampleCount[ i + (j - m_bandStart) * buffer_width ] = 1;
+	markDirty( i, j );
+}
+
+vec3f RayTracer::getPixel( int i, int j ) const
+{
+	int k = i + (j - m_bandStart) * buffer_width;
+	int n = m_sampleCount[k];
+	if( n == 0 )
+		return vec3f( 0, 0, 0 );
+	const float *sum = &m_accum[ k * 3 ];
+	return vec3f( sum[0] / n, sum[1] / n, sum[2] / n );
+}
+
+// One ray of a tile's wavefront.  Rays are numbered in the order they are
+// spawned, so a ray's children always come after it, and once they are
+// all traced the colours can be gathered from the last ray back.
+struct WaveRay
+{
+	ray r;
+	int depth;
+	std::map<int, Material> media;	// the media the ray starts out in
+
+	vec3f color;		// its own shading, and then its children's
+	bool clampColor;	// whether traceRay would clamp the colour it returns
+	int child[2];		// the reflected and refracted rays, -1 for none
+	double coeff[2];	// each child's colour comes back as coeff * prod( k, colour )
+	vec3f k[2];
+
+	WaveRay( const ray& from, int d, const std::map<int, Material>& m )
+		: r( from ), depth( d ), media( m ), clampColor( false )
+	{
+		child[0] = child[1] = -1;
+	}
+};
+
+// Sort key for a secondary ray: its direction's octant, then the cell of
+// a 256^3 grid over the scene that it starts in, along a Morton curve so
+// that nearby cells sort together.
+static unsigned waveKey( const ray& r, const BoundingBox& bounds )
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+	unsigned key = 0;
+	for( int k = 0; k < 3; ++k ) {
+		double extent = bounds.max[k] - bounds.min[k];
+		double f = extent > 0.0 ? (p[k] - bounds.min[k]) / extent : 0.0;
+		unsigned cell = (unsigned)max( 0.0, min( f * 256.0, 255.0 ) );
+		for( int b = 0; b < 8; ++b )
+			key |= ((cell >> b) & 1) << (3 * b + k);
+		if( d[k] < 0.0 )
+			key |= 1 << (24 + k);
+	}
+	return key;
+}
+
+// The same shading as traceRay, but where traceRay would recurse, the ray
+// is queued for the next bounce with the weight its colour comes back
+// with, and the colours are summed once every bounce has been traced.
+void RayTracer::traceTile( int x0, int y0, int x1, int y1 )
+{
+	if( !scene )
+		return;
+
+	x1 = min( x1, buffer_width );
+	y1 = min( y1, buffer_height );
+	if( x0 >= x1 || y0 >= y1 )
+		return;
+
+	vector<WaveRay> rays;
+	const std::map<int, Material> outside;
+	for( int j = y0; j < y1; ++j ) {
+		for( int i = x0; i < x1; ++i ) {
+			ray r( vec3f(0,0,0), vec3f(0,0,0) );
+			scene->getCamera()->rayThrough( double(i)/double(buffer_width), double(j)/double(buffer_height), r );
+			rays.push_back( WaveRay( r, 0, outside ) );
+		}
+	}
+
+	const BoundingBox& bounds = scene->getSceneBounds();
+	vector< pair<unsigned, int> > batch;
+	vector<isect> hits;
+	vector<char> hit;
+
+	for( size_t first = 0; first < rays.size(); ) {
+		size_t last = rays.size();
+
+		// primary rays stay in pixel order, which is coherent already
+		batch.clear();
+		for( size_t k = first; k < last; ++k )
+			batch.push_back( make_pair( first > 0 ? waveKey( rays[k].r, bounds ) : 0u, (int)k ) );
+		if( first > 0 )
+			sort( batch.begin(), batch.end() );
+
+		hits.resize( batch.size() );
+		hit.resize( batch.size() );
+		for( size_t b = 0; b < batch.size(); ++b )
+			hit[b] = scene->intersect( rays[ batch[b].second ].r, hits[b] );
+
+		for( size_t b = 0; b < batch.size(); ++b ) {
+			int k = batch[b].second;
+			if( !hit[b] ) {
+				rays[k].color = missColor( scene, rays[k].r );
+				continue;
+			}
+
+			isect& i = hits[b];
+			const ray r = rays[k].r;
+			vec3f shade;
+			if (m_bCaustic) {
+				shade += m_photon_map.shade(r.at(i.t));
+			}
+			rays[k].clampColor = rays[k].depth > 0;
+
+			if (m_bTrace) {
+				const Material& m = i.getMaterial();
+				shade += m.shade(scene, r, i);
+				if (rays[k].depth >= traceUI->getDepth()) {
+					rays[k].color = shade;
+					rays[k].clampColor = false;
+					continue;
+				}
+
+				vec3f conPoint = r.at(i.t);
+				vec3f Rdir = 2 * (i.N*-r.getDirection()) * i.N - (-r.getDirection());
+				std::map<int, Material> media = rays[k].media;
+				const double fresnel_coeff = getFresnelCoeff(i, r, media);
+
+				if (!m.kr.iszero()) {
+					rays[k].child[0] = (int)rays.size();
+					rays[k].coeff[0] = fresnel_coeff;
+					rays[k].k[0] = m.kr;
+					rays.push_back( WaveRay( ray(conPoint, Rdir), rays[k].depth + 1, media ) );
+				}
+
+				bool entering;
+				vec3f Tdir;
+				if (!m.kt.iszero() && i.obj->hasInterior() && refract(r, i, media, Tdir, entering)) {
+					rays[k].child[1] = (int)rays.size();
+					rays[k].coeff[1] = traceUI->IsEnableFresnel() ? 1 - fresnel_coeff : 1.0;
+					rays[k].k[1] = m.kt;
+					rays.push_back( WaveRay( ray(conPoint, Tdir), rays[k].depth + 1, media ) );
+				}
+			}
+			rays[k].color = shade;
+		}
+
+		first = last;
+	}
+
+	for( int k = (int)rays.size() - 1; k >= 0; --k ) {
+		WaveRay& w = rays[k];
+		for( int c = 0; c < 2; ++c ) {
+			if( w.child[c] >= 0 )
+				w.color += w.coeff[c] * prod( w.k[c], rays[ w.child[c] ].color );
+		}
+		if( w.clampColor )
+			w.color = w.color.clamp();
+	}
+
+	int k = 0;
+	for( int j = y0; j < y1; ++j )
+		for( int i = x0; i < x1; ++i )
+			setPixel( i, j, rays[ k++ ].color );
+}
@@ -5,7 +5,12 @@
 #include "PhotonMapping.h"
 #include "scene/scene.h"
 #include "scene/ray.h"
+#include "scene/footprint.h"
+#include "scene/envmap.h"
+#include <stdio.h>
 #include <map>
+#include <atomic>
+#include <memory>
 
 class RayTracer
 {
@@ -13,38 +18,178 @@ public:
     RayTracer();
     ~RayTracer();
 
-    vec3f trace( Scene *scene, double x, double y );
-	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth );
+    // hitObject, if given, gets the object the first ray hit, or NULL
+    vec3f trace( Scene *scene, double x, double y, const Geometry** hitObject = NULL );
+	vec3f traceRay( Scene *scene, const ray& r, const vec3f& thresh, int depth, const Geometry** hitObject = NULL );
 
 
+	// the band's image so far, clamped to 8 bits per channel
 	void getBuffer( unsigned char *&buf, int &w, int &h );
+	// the linear colour of a pixel: the mean of its samples so far
+	vec3f getPixel( int i, int j ) const;
+
+	// For a display that shows the image while it renders.  The band is
+	// split into squares displayTileSize() wide, and writing a pixel marks
+	// its square.  takeDirtyRegions hands over the squares marked since it
+	// last ran, runs of them along a row merged, and clears the marks; it
+	// may run while other threads trace.  Regions are in the band's rows.
+	struct Region
+	{
+		int x, y, w, h;
+	};
+	static int displayTileSize();
+	void getBufferSize( int &w, int &h ) const;
+	bool displayDirty() const { return m_anyDirty.load( std::memory_order_acquire ); }
+	void takeDirtyRegions( std::vector<Region>& regions );
+	// r as 8-bit RGB, r.w * r.h pixels bottom row first, as in getBuffer
+	void getRegion( const Region& r, unsigned char *out ) const;
+
+	// Hold only rows [start, start + rows) of the image in the framebuffer,
+	// and clear them.  Very large images are traced a band at a time, and
+	// only the band's rows may be traced.  rows of 0, the default, means
+	// the whole image; the band is kept across traceSetup.
+	void setBand( int start, int rows );
+	// Write the band's framebuffer to fp, or read one back into the band
+	// setBand last made, which must be the same size.
+	bool saveBand( FILE *fp ) const;
+	bool loadBand( FILE *fp );
 	double aspectRatio();
 	void traceSetup(int w, int h, bool trace = true, bool caustic = false, int photonNum = 6, int queryNum = 3, double coneAtten = -100, double amplify = 1.0);
 	void traceLines( int start = 0, int stop = 10000000 );
 	void tracePixel( int i, int j );
+	// Trace the pixels in [x0,x1) x [y0,y1) a bounce at a time rather than
+	// depth first: each bounce's rays from the whole tile are sorted by
+	// where they start and which way they go, then traced as one batch.
+	void traceTile( int x0, int y0, int x1, int y1 );
+	// have traceLines go tile by tile through traceTile
+	void setWavefront( bool on ) { m_bWavefront = on; }
+
+	// Keep each pixel's first hit and, while the scene and image size stay
+	// the same, shade later renders from it instead of tracing the first
+	// ray again: for re-rendering after changing only lights, materials or
+	// trace settings.  Wavefront tiles always trace.
+	void setHitCache( bool enable );
+
+	// Incremental rendering of a sequence.  With tile tracking on,
+	// traceChangedTiles traces the whole image the first time, in tiles,
+	// noting where each tile's rays went.  After that it traces only the
+	// tiles whose rays went through a box the frames since have changed.
+	// The framebuffer must hold the whole image, and traceSetup starts
+	// over.
+	void setTileTracking( bool enable );
+	int traceChangedTiles();	// returns the number of tiles traced
+	int tileCount() const;
+	// Antialias tracePixel and traceLines: each pixel starts from a sample
+	// at each corner, and is split into quarters, up to maxDepth times,
+	// wherever the samples differ by more than threshold in some channel
+	// or see different objects.  0 traces one ray per pixel.  Tiles from
+	// traceTile are not antialiased.
+	void setSupersampling( int maxDepth, double threshold );
+	// rays per pixel, averaged over every antialiased pixel so far
+	double samplesPerPixel() const;
+
+	// Progressive rendering, for an early look at the whole image.  The
+	// first coarsePasses() passes trace one pixel per block, halving the
+	// block from 16x16 to 1x1, and fill each block with it; after them the
+	// image is what traceLines gives.  Each pass after that adds a sample
+	// at a new spot inside every pixel, averaged in the framebuffer.  A
+	// pass can be traced in bands of rows; passes go in order.
+	static int coarsePasses();
+	void tracePass( int pass, int start = 0, int stop = 10000000 );
 
 	bool loadScene( char* fn );
 	bool loadHeightMap(char* fn);
 	void loadBackground(char* fn);
-
-	vec3f getBackgroundImage(double x, double y);
 	void clearBackground();
+	// every file the image depends on: the scene's and the background's
+	void getSourceFiles( vector<string>& files ) const;
+	// how the background image wraps the scene; planar by default
+	void setBackgroundMapping( EnvironmentMap::Mapping m ) { m_background.setMapping( m ); }
 	double getFresnelCoeff(isect& i, const ray& r);
 	bool sceneLoaded();
+	// move the loaded scene's animation (its particle sources) to a frame
+	void setFrame( int frame );
+	Scene *getScene() { return scene; }
 
 private:
-	bool useBackground;
-	unsigned char *backgroundImage;
+	vec3f tracePrimary( int i, int j, const Geometry** hitObject = NULL );
+	vec3f shadeHit( Scene *scene, const ray& r, isect& i, const vec3f& thresh, int depth );
+	vec3f missColor( Scene *scene, const ray& r );
+	bool refract( const ray& r, const isect& i, std::map<int, Material>& media, vec3f& dir, bool& entering );
+	double getFresnelCoeff( isect& i, const ray& r, std::map<int, Material>& media );
+	void setPixel( int i, int j, const vec3f& col );
+
+	struct Sample
+	{
+		vec3f color;
+		const Geometry *object;
+	};
+	Sample sample( double x, double y );
+	Sample sampleCorner( int i, int j );
+	void addSample( int i, int j, const vec3f& col );
+	void markDirty( int i, int j );
+	void markAllDirty();
+	int bandRows() const;
+	void clearBand();
+	void markChangedTiles();
+	void sceneChanged();
+	vec3f refine( double x, double y, double w, double h, const Sample *corners, int depth );
+
+	EnvironmentMap m_background;
+	string m_backgroundFile;	// empty when there is none
+	double m_pixelSpread;	// radians between neighbouring primary rays
 	unsigned char *buffer;
 	int buffer_width, buffer_height;
 	int bufferSize;
-	int background_height, background_width;
 	Scene *scene;
 	std::map<int, Material> mediaHistory;
 	bool m_bSceneLoaded;
 	PhotonMap m_photon_map;
 	bool m_bCaustic;
 	bool m_bTrace;
+	bool m_bWavefront;
+	int m_aaDepth;
+	double m_aaThreshold;
+	std::atomic<long long> m_aaSamples;	// the threaded renderer shares these
+	std::atomic<long long> m_aaPixels;
+
+	// The framebuffer: per pixel of the band, the sum of its samples'
+	// linear colours and how many there are.  Renders write it directly,
+	// each pixel from one thread; buffer only holds its 8-bit copy for
+	// getBuffer.
+	int m_bandStart, m_bandRows;
+	std::vector<float> m_accum;
+	std::vector<int> m_sampleCount;
+
+	// per display tile of the band, whether it changed since the display
+	// last took it
+	int m_dirtyColumns, m_dirtyRows;
+	std::unique_ptr< std::atomic<bool>[] > m_dirty;
+	std::atomic<bool> m_anyDirty;
+
+	// The hit cache.  A pixel's entry is only used by whoever traces that
+	// pixel: tracePixel, which threads call side by side, samples its
+	// neighbours' corners without the cache; traceLines, run by one thread
+	// at a time, shares each row of corners between two rows of pixels.
+	enum HitState { HIT_UNKNOWN, HIT_OBJECT, HIT_NOTHING, HIT_UNCACHED };
+	struct PrimaryHit
+	{
+		const SceneObject *obj;
+		const Geometry *top;
+		double t;
+		vec3f N;
+		HitState state;
+	};
+	bool m_bHitCache;
+	int m_sceneVersion;		// bumped whenever the geometry may change
+	int m_hitVersion;		// the version m_hits was filled for
+	std::vector<PrimaryHit> m_hits;
+
+	// tile tracking: per tile, where its rays went and whether to re-trace it
+	bool m_bTrackTiles;
+	BoundingBox m_footprintGrid;
+	std::vector<Footprint> m_footprints;
+	std::vector<char> m_tileChanged;
 };
 
 #endif // __RAYTRACER_H__
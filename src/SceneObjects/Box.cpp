@@ -60,3 +60,49 @@ bool Box::intersectLocal(const ray& r, isect& i) const
 	i.setN(Nnear);
 	return true;
 }
+
+// The same slab test over the whole line, without rejecting boxes behind
+// the ray's origin.
+bool Box::intersectLocalSpan(const ray& r, Span& s) const
+{
+	numeric_limits<double> doubleLimit;
+	double Tfar = doubleLimit.infinity(), Tnear = -Tfar;
+	vec3f Nnear, Nfar;
+
+	const vec3f &dir = r.getDirection();
+	const vec3f &ori = r.getPosition();
+	const double lBound = -0.5, uBound = 0.5;
+
+	for (int axis = 0; axis < 3; ++axis) {
+		if (dir[axis] == 0.0) {
+			if (ori[axis] < lBound || ori[axis] > uBound) {
+				return false;
+			}
+			continue;
+		}
+		vec3f N1, N2;
+		double t1 = (lBound - ori[axis]) / dir[axis];
+		N1[axis] = -1;
+		double t2 = (uBound - ori[axis]) / dir[axis];
+		N2[axis] = 1;
+		if (t1 > t2) {
+			swap(t1, t2);
+			swap(N1, N2);
+		}
+
+		if (t1 > Tnear) {
+			Tnear = t1;
+			Nnear = N1;
+		}
+		if (t2 < Tfar) {
+			Tfar = t2;
+			Nfar = N2;
+		}
+		if (Tfar < Tnear) {
+			return false;
+		}
+	}
+	s.include(Tnear, Nnear);
+	s.include(Tfar, Nfar);
+	return true;
+}
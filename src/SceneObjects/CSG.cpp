@@ -4,51 +4,42 @@
 
 #include "CSG.h"
 
-typedef vector<SegmentPoint>::iterator SegIter;
-
-Segments& Segments::Merge(const Segments& pSegments, int relation){
-	vector<SegmentPoint> interval;
+// Both inputs are ordered, so a single pass over them, counting how many
+// operands the ray is inside, keeps the output ordered too.
+void Segments::Merge(const Segments& left, const Segments& right, int relation)
+{
+	clear();
 
-	for (SegIter it = mPoints.begin(); it != mPoints.end(); ++it)
-	{
-		it->contri = 1;
-		interval.push_back(*it);
-	}
+	int require = (relation == CSG_AND) ? 2 : 1;
+	int rightContri = (relation == CSG_MINUS) ? -1 : 1;
+	int before = 0, after = 0;
+	int l = 0, r = 0;
 
-	vector<SegmentPoint> pPoints(pSegments.mPoints);
-	for (SegIter it = pPoints.begin(); it != pPoints.end(); ++it)
+	while (l < left.size() || r < right.size())
 	{
-		it->contri = (relation == CSG_MINUS) ? -1 : 1;
-		interval.push_back(*it);
-	}
+		bool fromLeft = r >= right.size() || (l < left.size() && left[l].t <= right[r].t);
+		SegmentPoint pt = fromLeft ? left[l++] : right[r++];
+		int contri = fromLeft ? 1 : rightContri;
 
-	int before = 0, after = 0;
-	int require = (relation == CSG_AND) ? 2 : 1;
-	sort(interval.begin(), interval.end());
-	mPoints.clear();
-	
-	for (SegIter it = interval.begin(); it != interval.end(); ++it)
-	{
-		if (it->isRight)
+		if (pt.isRight)
 		{
-			after -= it->contri;
+			after -= contri;
 		}
 		else
 		{
-			after += it->contri;
+			after += contri;
 		}
 
 		if (before < require && after >= require){
-			it->isRight = false;
-			mPoints.push_back(*it);
+			pt.isRight = false;
+			addPoint(pt);
 		}
 		else if (before >= require&&after < require){
-			it->isRight = true;
-			mPoints.push_back(*it);
+			pt.isRight = true;
+			addPoint(pt);
 		}
 		before = after;
 	}
-	return *this;
 }
 
 CSGTree* CSGTree::merge(const CSGTree* pTree, CSG_RELATION relation){
@@ -62,33 +53,27 @@ CSGTree* CSGTree::merge(const CSGTree* pTree, CSG_RELATION relation){
 	return this;
 }
 
-bool Segments::firstPositive(SegmentPoint& p)
+// The points are ordered, so the first one ahead of the ray is the answer.
+bool Segments::firstPositive(SegmentPoint& p) const
 {
-	bool hasOne = false;
-	for (SegIter it = mPoints.begin(); it != mPoints.end(); ++it)
+	for (int k = 0; k < mCount; ++k)
 	{
-		if (it->t > RAY_EPSILON)
+		if ((*this)[k].t > RAY_EPSILON)
 		{
-			if (hasOne)
-			{
-				if (it->t < p.t) p = *it;
-			}
-			else
-			{
-				hasOne = true;
-				p = (*it);
-			}
+			p = (*this)[k];
+			return true;
 		}
 	}
-	return hasOne;
+	return false;
 }
 
 bool CSGTree::intersect(const ray& r, isect& i) const 
 {
 	if (!root) return false;
-	Segments* inters = root->intersectLocal(r);
+	Segments inters;
+	root->intersectLocal(r, inters);
 	SegmentPoint sp;
-	if (!inters->firstPositive(sp)) return false;
+	if (!inters.firstPositive(sp)) return false;
 	i.t = sp.t;
 	if (sp.isRight)
 	{
@@ -101,43 +86,59 @@ bool CSGTree::intersect(const ray& r, isect& i) const
 	return true;
 }
 
-Segments* CSGNode::intersectLocal(const ray& r) const
+// Whether the whole line through r, behind its origin too, meets the box.
+static bool lineHitsBox(const BoundingBox& box, const ray& r)
 {
-	Segments* result = new Segments();
-	if (isLeaf)
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	double tMin = -1.0e308, tMax = 1.0e308;
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		SegmentPoint pNear, pFar;
-		isect i;
-		ray backR(r.at(-10000), r.getDirection());
-		if (!object->intersect(backR, i)) return result;
-		pNear.t = i.t - 10000;
-		pNear.normal = i.N;
-		pNear.isRight = false;
-		ray contiR(r.at(pNear.t + RAY_EPSILON * 10), r.getDirection());
-		if (!object->intersect(contiR, i))
-		{
-			pFar = pNear;
-		}
-		else 
+		double lo = box.min[axis] - RAY_EPSILON;
+		double hi = box.max[axis] + RAY_EPSILON;
+		if (d[axis] == 0.0)
 		{
-			pFar.t = i.t + pNear.t;
-			pFar.normal = i.N;
+			if (p[axis] < lo || p[axis] > hi) return false;
+			continue;
 		}
-		pFar.isRight = true;
-		result->addPoint(pNear);
-		result->addPoint(pFar);
-		return result;
+		double t1 = (lo - p[axis]) / d[axis];
+		double t2 = (hi - p[axis]) / d[axis];
+		if (t1 > t2) swap(t1, t2);
+		if (t1 > tMin) tMin = t1;
+		if (t2 < tMax) tMax = t2;
+		if (tMin > tMax) return false;
 	}
-	else
+	return true;
+}
+
+void CSGNode::intersectLocal(const ray& r, Segments& result) const
+{
+	result.clear();
+	if (bounded && !lineHitsBox(bound, r)) return;
+
+	if (isLeaf)
 	{
-		if (!lchild || !rchild) return result;
-		Segments* leftSeg = new Segments();
-		Segments* rightSeg = new Segments();
-		leftSeg = lchild->intersectLocal(r);
-		rightSeg = rchild->intersectLocal(r);
-		leftSeg->Merge(*rightSeg, relation);
-		return leftSeg;
+		Span span;
+		if (!object->intersectSpan(r, span)) return;
+		SegmentPoint pNear, pFar;
+		pNear.t = span.tIn;
+		pNear.normal = span.nIn;
+		pNear.isRight = false;
+		pFar.t = span.tOut;
+		pFar.normal = span.nOut;
+		pFar.isRight = true;
+		result.addPoint(pNear);
+		result.addPoint(pFar);
+		return;
 	}
+
+	if (!lchild || !rchild) return;
+	Segments leftSeg, rightSeg;
+	lchild->intersectLocal(r, leftSeg);
+	// nothing can survive an AND or MINUS with an empty left side
+	if (leftSeg.size() == 0 && relation != CSG_OR) return;
+	rchild->intersectLocal(r, rightSeg);
+	result.Merge(leftSeg, rightSeg, relation);
 }
 
 BoundingBox CSGNode::getBoundingBox() const 
@@ -150,15 +151,36 @@ void CSGNode::computeBoundingBox()
 	if (isLeaf)
 	{
 		bound = object->getBoundingBox();
+		bounded = object->hasBoundingBoxCapability();
 	}
-	else
+	else if (!lchild || !rchild)
 	{
-		if (!lchild || !rchild)
+		bound = BoundingBox();
+		bounded = false;
+	}
+	else if (relation == CSG_OR)
+	{
+		bound = lchild->bound.plus(rchild->bound);
+		bounded = lchild->bounded && rchild->bounded;
+	}
+	else if (relation == CSG_AND)
+	{
+		if (lchild->bounded && rchild->bounded)
 		{
-			bound = BoundingBox();
+			bound.min = maximum(lchild->bound.min, rchild->bound.min);
+			bound.max = minimum(lchild->bound.max, rchild->bound.max);
 		}
-		bound = lchild->getBoundingBox();
-		bound.plus(rchild->getBoundingBox());
+		else
+		{
+			bound = lchild->bounded ? lchild->bound : rchild->bound;
+		}
+		bounded = lchild->bounded || rchild->bounded;
+	}
+	else
+	{
+		// MINUS can only take away from the left side
+		bound = lchild->bound;
+		bounded = lchild->bounded;
 	}
 }
 
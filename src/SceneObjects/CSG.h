@@ -14,30 +14,44 @@ public:
 	double t;
 	vec3f normal;
 	bool isRight;
-	int contri;
-
-	bool operator<(const SegmentPoint& other){
-		return t < other.t - RAY_EPSILON;
-	}
 };
 
+// The points where a ray enters and leaves a CSG solid, in order of t.
+// A few primitives' worth fit in the inline buffer, so evaluating a tree
+// normally doesn't touch the heap.
 class Segments{
 public:
-	Segments() : mPoints(){}
-	Segments& Merge(const Segments& pSegments, int relation);
-	bool firstPositive(SegmentPoint& p);
-	void addPoint(SegmentPoint& pt)
+	Segments() : mCount(0) {}
+	// this = left combined with right; both must be in order of t
+	void Merge(const Segments& left, const Segments& right, int relation);
+	bool firstPositive(SegmentPoint& p) const;
+	void addPoint(const SegmentPoint& pt)
+	{
+		if (mCount < INLINE_POINTS) mInline[mCount] = pt;
+		else mOverflow.push_back(pt);
+		++mCount;
+	}
+	int size() const { return mCount; }
+	const SegmentPoint& operator[](int k) const
+	{
+		return (k < INLINE_POINTS) ? mInline[k] : mOverflow[k - INLINE_POINTS];
+	}
+	void clear()
 	{
-		mPoints.push_back(pt);
+		mCount = 0;
+		mOverflow.clear();
 	}
 private:
-	vector<SegmentPoint> mPoints;
+	enum { INLINE_POINTS = 8 };
+	SegmentPoint mInline[INLINE_POINTS];
+	vector<SegmentPoint> mOverflow;
+	int mCount;
 };
 
 class CSGNode 
 {
 public:
-	CSGNode() : lchild(NULL), rchild(NULL), object(NULL), relation(CSG_AND), isLeaf(0) {}
+	CSGNode() : lchild(NULL), rchild(NULL), object(NULL), relation(CSG_AND), isLeaf(0), bounded(false) {}
 	void setObject(Geometry* obj)
 	{
 		this->object = obj;
@@ -48,13 +62,15 @@ public:
 	}
 	BoundingBox getBoundingBox() const;
 	void computeBoundingBox();
-	Segments* intersectLocal(const ray& r) const;
+	void intersectLocal(const ray& r, Segments& result) const;
 	CSGNode* lchild;
 	CSGNode* rchild;
 	Geometry* object;
 	CSG_RELATION relation;
 	bool isLeaf;
 	BoundingBox bound;
+	// false if some leaf below has no bounding box, so bound can't cull
+	bool bounded;
 };
 
 class CSGTree {
@@ -66,7 +82,7 @@ public:
 	CSGTree(CSGNode* nodes) : root(nodes) {}
 	CSGTree* merge(const CSGTree* pTree, CSG_RELATION relation);
 	bool intersect(const ray& r, isect& i) const;
-	CSGNode* getRoot() { return root; }
+	CSGNode* getRoot() const { return root; }
 private:
 	CSGNode* root;
 };
@@ -86,6 +102,7 @@ public:
 	virtual bool hasBoundingBoxCapability() const { return true; }
 	virtual bool hasInterior() const{ return true; }
 	virtual BoundingBox ComputeLocalBoundingBox();
+	const CSGTree* getTree() const { return tree; }
 
 private:
 	CSGTree* tree;
@@ -145,3 +145,55 @@ bool Cone::intersectCaps( const ray& r, isect& i ) const
 
 	return false;
 }
+
+// As for the cylinder: the nearest and farthest crossings of body and
+// caps, or the two body crossings of an uncapped cone.  The height test
+// is a little loose so that cones meeting rim to rim leave no crack.
+bool Cone::intersectLocalSpan( const ray& r, Span& s ) const
+{
+	vec3f d = r.getDirection();
+	vec3f p = r.getPosition();
+
+	double a = (d[0]*d[0]) + (d[1]*d[1]) - (C*d[2]*d[2]);
+	double b = 2.0 * (d[0]*p[0] + d[1]*p[1] - C*d[2]*p[2]) - B*d[2];
+	double c = (p[0]*p[0]) + (p[1]*p[1]) - A - (B*p[2]) - (C*p[2]*p[2]);
+
+	double roots[2];
+	int n = 0;
+	if( a == 0.0 ) {
+		// the line runs parallel to the slope and crosses the body once
+		if( b != 0.0 ) {
+			roots[n++] = -c / b;
+		}
+	} else {
+		double disc = b*b - 4.0*a*c;
+		if( disc > 0.0 ) {
+			disc = sqrt( disc );
+			roots[n++] = (-b - disc) / (2.0 * a);
+			roots[n++] = (-b + disc) / (2.0 * a);
+		}
+	}
+
+	for( int k = 0; k < n; ++k ) {
+		vec3f P = r.at( roots[k] );
+		if( P[2] >= -RAY_EPSILON && P[2] <= height + RAY_EPSILON ) {
+			double p3 = -C*P[2] + (b_radius - t_radius)*b_radius / height;
+			s.include( roots[k], vec3f( P[0], P[1], p3 ).normalize() );
+		}
+	}
+
+	if( capped && d[2] != 0.0 ) {
+		double t = -p[2] / d[2];
+		vec3f P = r.at( t );
+		if( P[0]*P[0] + P[1]*P[1] <= b_radius * b_radius ) {
+			s.include( t, vec3f( 0.0, 0.0, -1.0 ) );
+		}
+		t = (height - p[2]) / d[2];
+		P = r.at( t );
+		if( P[0]*P[0] + P[1]*P[1] <= t_radius * t_radius ) {
+			s.include( t, vec3f( 0.0, 0.0, 1.0 ) );
+		}
+	}
+
+	return !s.isEmpty();
+}
@@ -21,8 +21,13 @@ public:
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool intersectLocalSpan( const ray& r, Span& s ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 	virtual bool hasInterior() const{ return capped; }
+	bool isCapped() const { return capped; }
+	double getHeight() const { return height; }
+	double getBottomRadius() const { return b_radius; }
+	double getTopRadius() const { return t_radius; }
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
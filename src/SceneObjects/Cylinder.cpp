@@ -141,3 +141,40 @@ bool Cylinder::intersectCaps( const ray& r, isect& i ) const
 
 	return false;
 }
+
+// The nearest and farthest crossings of the body and caps.  An uncapped
+// tube isn't closed, so its span just runs between its two body crossings.
+bool Cylinder::intersectLocalSpan( const ray& r, Span& s ) const
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	double a = d[0]*d[0] + d[1]*d[1];
+	if( a != 0.0 ) {
+		double b = 2.0 * (p[0]*d[0] + p[1]*d[1]);
+		double c = p[0]*p[0] + p[1]*p[1] - 1.0;
+		double disc = b*b - 4.0*a*c;
+		if( disc >= 0.0 ) {
+			disc = sqrt( disc );
+			double roots[2] = { (-b - disc) / (2.0 * a), (-b + disc) / (2.0 * a) };
+			for( int k = 0; k < 2; ++k ) {
+				vec3f P = r.at( roots[k] );
+				if( P[2] >= -RAY_EPSILON && P[2] <= 1.0 + RAY_EPSILON ) {
+					s.include( roots[k], vec3f( P[0], P[1], 0.0 ).normalize() );
+				}
+			}
+		}
+	}
+
+	if( capped && d[2] != 0.0 ) {
+		for( int k = 0; k < 2; ++k ) {
+			double t = (k - p[2]) / d[2];
+			vec3f P = r.at( t );
+			if( P[0]*P[0] + P[1]*P[1] <= 1.0 ) {
+				s.include( t, vec3f( 0.0, 0.0, k ? 1.0 : -1.0 ) );
+			}
+		}
+	}
+
+	return !s.isEmpty();
+}
@@ -13,8 +13,10 @@ public:
 	}
 
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool intersectLocalSpan( const ray& r, Span& s ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 	virtual bool hasInterior() const{ return capped; }
+	bool isCapped() const { return capped; }
     virtual BoundingBox ComputeLocalBoundingBox()
     {
         BoundingBox localbounds;
@@ -0,0 +1,36 @@
+#include "Instance.h"
+
+Prototype::~Prototype()
+{
+	for( size_t k = 0; k < owned.size(); ++k )
+		delete owned[k];
+}
+
+void Prototype::setObjects( vector<Geometry*>& objects )
+{
+	owned.swap( objects );
+	bounded.clear();
+	vector<BoundingBox> bounds;
+	for( size_t k = 0; k < owned.size(); ++k ) {
+		if( owned[k]->hasBoundingBoxCapability() ) {
+			bounded.push_back( owned[k] );
+			bounds.push_back( owned[k]->getBoundingBox() );
+		}
+	}
+	bvh.build( bounds );
+}
+
+bool Prototype::intersect( const ray& r, isect& i ) const
+{
+	GeometryHit hit( bounded, r, i, false );
+	double tMax = 1.0e308;
+	bvh.intersect( r, tMax, hit );
+	return hit.have_one;
+}
+
+// Geometry::intersect has already brought the ray into the prototype's
+// space, and takes the hit back out again.
+bool Instance::intersectLocal( const ray& r, isect& i ) const
+{
+	return prototype->intersect( r, i );
+}
@@ -0,0 +1,61 @@
+#ifndef __INSTANCE_H__
+#define __INSTANCE_H__
+
+#include <vector>
+
+#include "../scene/scene.h"
+#include "../scene/bvh.h"
+
+// Geometry defined once and placed any number of times.  The objects live
+// in the prototype's own space, under its own transform root, with a BVH
+// over them; they are never added to the scene themselves.
+class Prototype
+{
+public:
+	Prototype() {}
+	~Prototype();
+
+	// the transform that the prototype's objects hang off
+	TransformNode *getRoot() { return &root; }
+
+	// Take over the objects (swapped in) and build the hierarchy.  Only
+	// bounded ones can be hit; the rest, like the trimesh that owns a set
+	// of faces, are just kept to be deleted with the others.
+	void setObjects( vector<Geometry*>& objects );
+	// every object taken over, bounded or not
+	const vector<Geometry*>& getObjects() const { return owned; }
+
+	// closest hit, in the prototype's space
+	bool intersect( const ray& r, isect& i ) const;
+	BoundingBox getBounds() const { return bvh.getBounds(); }
+
+private:
+	TransformRoot root;
+	vector<Geometry*> owned;
+	vector<Geometry*> bounded;
+	BVH bvh;
+};
+
+// One placement of a prototype.  Its transform takes the prototype's
+// space to the scene's, so every instance shares the same objects.  A
+// hit reports the prototype's object, and so its material.
+class Instance
+	: public Geometry
+{
+public:
+	Instance( Scene *scene, Prototype *proto )
+		: Geometry( scene ), prototype( proto )
+	{
+	}
+
+	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual BoundingBox ComputeLocalBoundingBox() { return prototype->getBounds(); }
+
+	Prototype *getPrototype() const { return prototype; }
+
+private:
+	Prototype *prototype;
+};
+
+#endif // __INSTANCE_H__
@@ -0,0 +1,191 @@
+#include <cmath>
+
+#include "ParticleCloud.h"
+
+// One entry of the material table.  A hit names its material through
+// isect::obj, so each entry is a stand-in object that is never traced.
+class ParticleLevel
+	: public MaterialSceneObject
+{
+public:
+	ParticleLevel( Scene *scene, Material *mat )
+		: MaterialSceneObject( scene, mat ) {}
+};
+
+ParticleCloud::ParticleCloud( Scene *scene, Material *mat )
+	: MaterialSceneObject( scene, mat ), m_step( 0.0 ), m_radius( 0.01 ),
+	m_initialLife( 0.0 )
+{
+}
+
+ParticleCloud::~ParticleCloud()
+{
+	clearLevels();
+}
+
+void ParticleCloud::clearLevels()
+{
+	for( size_t k = 0; k < m_levels.size(); ++k )
+		delete m_levels[k];
+	m_levels.clear();
+}
+
+void ParticleCloud::setLifeColors( const vec3f& birth, const vec3f& death, double initialLife, int levels )
+{
+	clearLevels();
+	m_birth = birth;
+	m_death = death;
+	m_initialLife = initialLife;
+
+	for( int k = 0; k < levels; ++k ) {
+		double f = (k + 0.5) / levels;
+		Material *mat = new Material( getMaterial() );
+		mat->ke = death + (birth - death) * f;
+		ParticleLevel *level = new ParticleLevel( scene, mat );
+		level->setOrder( order );
+		m_levels.push_back( level );
+	}
+}
+
+void ParticleCloud::setOrder( int ord )
+{
+	MaterialSceneObject::setOrder( ord );
+	for( size_t k = 0; k < m_levels.size(); ++k )
+		m_levels[k]->setOrder( ord );
+}
+
+BoundingBox ParticleCloud::particleBounds( int k ) const
+{
+	vec3f half = m_velocity[k] * (0.5 * m_step);
+	vec3f pad( m_radius, m_radius, m_radius );
+	BoundingBox b;
+	b.min = minimum( m_position[k] - half, m_position[k] + half ) - pad;
+	b.max = maximum( m_position[k] - half, m_position[k] + half ) + pad;
+	return b;
+}
+
+void ParticleCloud::setParticles( vector<vec3f>& position, vector<vec3f>& velocity,
+	vector<double>& life, double step )
+{
+	m_position.swap( position );
+	m_velocity.swap( velocity );
+	m_life.swap( life );
+	m_step = step;
+
+	vector<BoundingBox> bounds( m_position.size() );
+	for( size_t k = 0; k < bounds.size(); ++k )
+		bounds[k] = particleBounds( (int)k );
+	m_bvh.build( bounds );
+}
+
+BoundingBox ParticleCloud::ComputeLocalBoundingBox()
+{
+	return m_bvh.getBounds();
+}
+
+// The capsule is the set of points within m_radius of the segment a-b:
+// a cylinder around the segment, closed by a sphere at each end.
+bool ParticleCloud::intersectParticle( int k, const ray& r, double& t, vec3f& N ) const
+{
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	vec3f half = m_velocity[k] * (0.5 * m_step);
+	vec3f a = m_position[k] - half;
+	vec3f ba = half * 2.0;
+	vec3f oa = p - a;
+
+	double rr = m_radius * m_radius;
+	double dd = d * d;
+	double baba = ba * ba;
+	double bard = ba * d;
+	double baoa = ba * oa;
+
+	bool hit = false;
+
+	// the side: distance from the axis is the radius, between the ends
+	double A = baba * dd - bard * bard;
+	if( A > 0.0 ) {
+		double B = baba * (oa * d) - baoa * bard;
+		double C = baba * (oa * oa) - baoa * baoa - rr * baba;
+		double h = B * B - A * C;
+		if( h >= 0.0 ) {
+			h = sqrt( h );
+			double roots[2] = { (-B - h) / A, (-B + h) / A };
+			for( int j = 0; j < 2; ++j ) {
+				double y = baoa + roots[j] * bard;
+				if( roots[j] > RAY_EPSILON && roots[j] < t && y > 0.0 && y < baba ) {
+					t = roots[j];
+					N = r.at( t ) - (a + ba * (y / baba));
+					hit = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// the end caps, each only on its own side of the segment
+	for( int end = 0; end < 2; ++end ) {
+		vec3f c = end ? a + ba : a;
+		vec3f oc = p - c;
+		double B = oc * d;
+		double h = B * B - dd * (oc * oc - rr);
+		if( h < 0.0 )
+			continue;
+		h = sqrt( h );
+		double roots[2] = { (-B - h) / dd, (-B + h) / dd };
+		for( int j = 0; j < 2; ++j ) {
+			if( roots[j] <= RAY_EPSILON || roots[j] >= t )
+				continue;
+			double y = baoa + roots[j] * bard;
+			if( end ? (y >= baba) : (y <= 0.0) ) {
+				t = roots[j];
+				N = r.at( t ) - c;
+				hit = true;
+				break;
+			}
+		}
+	}
+
+	if( hit )
+		N = N.normalize();
+	return hit;
+}
+
+// gathers the closest particle hit during the BVH walk
+struct CloudHit
+{
+	const ParticleCloud *cloud;
+	const ray *r;
+	int particle;
+	vec3f N;
+
+	bool operator()( int k, double& tMax )
+	{
+		if( !cloud->intersectParticle( k, *r, tMax, N ) )
+			return false;
+		particle = k;
+		return true;
+	}
+};
+
+bool ParticleCloud::intersectLocal( const ray& r, isect& i ) const
+{
+	CloudHit hit;
+	hit.cloud = this;
+	hit.r = &r;
+	hit.particle = -1;
+
+	double t = 1.0e308;
+	if( !m_bvh.intersect( r, t, hit ) )
+		return false;
+
+	i.t = t;
+	i.N = hit.N;
+	i.obj = this;
+	if( !m_levels.empty() ) {
+		int n = (int)m_levels.size();
+		int level = (m_initialLife > 0.0) ? (int)(m_life[ hit.particle ] / m_initialLife * n) : n - 1;
+		i.obj = m_levels[ max( 0, min( level, n - 1 ) ) ];
+	}
+	return true;
+}
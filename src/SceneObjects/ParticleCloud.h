@@ -0,0 +1,67 @@
+#ifndef __PARTICLE_CLOUD_H__
+#define __PARTICLE_CLOUD_H__
+
+#include <vector>
+
+#include "../scene/scene.h"
+#include "../scene/bvh.h"
+
+class ParticleLevel;
+
+// Many particles drawn as one object.  Each particle is a capsule (a
+// segment with a radius) centred on its position and stretched along its
+// velocity by one frame's travel.  The particles live in flat arrays with
+// a BVH over them, and rather than a material each, they share a table of
+// materials indexed by how much life they have left.
+class ParticleCloud
+	: public MaterialSceneObject
+{
+public:
+	ParticleCloud( Scene *scene, Material *mat );
+	~ParticleCloud();
+
+	// Replace the particles; the arrays are swapped in.  step is the time
+	// a frame covers, so a particle spans position +/- velocity * step/2.
+	void setParticles( vector<vec3f>& position, vector<vec3f>& velocity,
+		vector<double>& life, double step );
+	void setRadius( double radius ) { m_radius = radius; }
+	// Emissive colour by life: birth at initialLife, fading to death at 0,
+	// in the given number of steps.  Everything else comes from the
+	// cloud's own material.
+	void setLifeColors( const vec3f& birth, const vec3f& death, double initialLife, int levels = 16 );
+
+	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual BoundingBox ComputeLocalBoundingBox();
+	virtual void setOrder( int ord );
+
+	int size() const { return (int)m_life.size(); }
+	const vector<vec3f>& getPositions() const { return m_position; }
+	const vector<vec3f>& getVelocities() const { return m_velocity; }
+	const vector<double>& getLives() const { return m_life; }
+	double getStep() const { return m_step; }
+	double getRadius() const { return m_radius; }
+	const vec3f& getBirthColor() const { return m_birth; }
+	const vec3f& getDeathColor() const { return m_death; }
+	double getInitialLife() const { return m_initialLife; }
+
+	// closest hit on particle k beyond RAY_EPSILON and before t; lowers t
+	bool intersectParticle( int k, const ray& r, double& t, vec3f& N ) const;
+
+private:
+	BoundingBox particleBounds( int k ) const;
+	void clearLevels();
+
+	vector<vec3f> m_position;
+	vector<vec3f> m_velocity;
+	vector<double> m_life;
+	double m_step;
+	double m_radius;
+	BVH m_bvh;
+
+	vec3f m_birth, m_death;
+	double m_initialLife;
+	vector<ParticleLevel*> m_levels;
+};
+
+#endif // __PARTICLE_CLOUD_H__
@@ -1,117 +1,155 @@
 #include "ParticleSys.h"
-#include "Cylinder.h"
 #include <random>
+#include <future>
+#include <thread>
 
-void ParticleSource::render()
+//Pools smaller than this are integrated on the calling thread; bigger ones
+//are split so that each worker gets at least this many particles.
+static const int s_minChunk = 1 << 16;
+
+void ParticlePool::reserve(int n)
 {
-	double time = 0;
-	std::default_random_engine generator1, generator2;
-	std::uniform_real_distribution<double> position_distribution(-1.0, 1.0);
-	std::uniform_real_distribution<double> velocity_distribution(-1.0, 1.0);
-	for (int frame = 0; frame < m_numFrame; ++frame) {
-		time = frame * m_frameTime;
-		//initialize the particles
-		for (int i = 0; i < m_numParticles; ++i) {
-			Particle *myParticle = new Particle;
-			myParticle->life = m_initialLife;
-			vec3f position;
-			for (int i = 0; i < 3; ++i) {
-				position[i] = position_distribution(generator1);
-			}
-			myParticle->position = position;
-			vec3f velocity;
-			for (int i = 0; i < 3; ++i) {
-				velocity[i] = velocity_distribution(generator2);
-			}
-			myParticle->velocity = velocity.normalize() * m_initialSpeed;
+	x.reserve(n); y.reserve(n); z.reserve(n);
+	vx.reserve(n); vy.reserve(n); vz.reserve(n);
+	life.reserve(n);
+}
 
-			particles.push_back(myParticle);
-		}
-		//calculate the particles
-		for (Particles::iterator iter = particles.begin(); iter != particles.end(); ++iter) {
-			Particle* particle = *iter;
-			particle->life -= m_frameTime;
+void ParticlePool::push(const vec3f& position, const vec3f& velocity, double l)
+{
+	x.push_back(position[0]); y.push_back(position[1]); z.push_back(position[2]);
+	vx.push_back(velocity[0]); vy.push_back(velocity[1]); vz.push_back(velocity[2]);
+	life.push_back(l);
+}
 
-			//kill the ones that are dead
-			if (particle->life < 0) {
-				delete particle;
-				particles.erase(iter);
-				continue;
-			}
+void ParticlePool::clear()
+{
+	x.clear(); y.clear(); z.clear();
+	vx.clear(); vy.clear(); vz.clear();
+	life.clear();
+}
 
-			//evolve
-			particle->position += particle->velocity * m_frameTime;
-			particle->velocity += m_gravity * m_frameTime;
+//one plain loop per array, with no branches, so the compiler can vectorize
+void ParticlePool::integrate(int first, int last, double dt, const vec3f& gravity)
+{
+	double *px = &x[0], *py = &y[0], *pz = &z[0];
+	double *pvx = &vx[0], *pvy = &vy[0], *pvz = &vz[0];
+	double *pl = &life[0];
+	double gx = gravity[0] * dt, gy = gravity[1] * dt, gz = gravity[2] * dt;
+
+	for (int i = first; i < last; ++i)
+		pl[i] -= dt;
+	for (int i = first; i < last; ++i)
+		px[i] += pvx[i] * dt;
+	for (int i = first; i < last; ++i)
+		py[i] += pvy[i] * dt;
+	for (int i = first; i < last; ++i)
+		pz[i] += pvz[i] * dt;
+	for (int i = first; i < last; ++i)
+		pvx[i] += gx;
+	for (int i = first; i < last; ++i)
+		pvy[i] += gy;
+	for (int i = first; i < last; ++i)
+		pvz[i] += gz;
+}
+
+void ParticlePool::removeDead()
+{
+	int n = size();
+	for (int i = 0; i < n; ) {
+		if (life[i] >= 0) {
+			++i;
+			continue;
 		}
+		--n;
+		x[i] = x[n]; y[i] = y[n]; z[i] = z[n];
+		vx[i] = vx[n]; vy[i] = vy[n]; vz[i] = vz[n];
+		life[i] = life[n];
 	}
+	x.resize(n); y.resize(n); z.resize(n);
+	vx.resize(n); vy.resize(n); vz.resize(n);
+	life.resize(n);
+}
 
-	//Now that the system is complete, I need to render the particles into primitives for ray tracing
-	/**
-	//transformations of the particle source
-	//Set an upDir
-	vec3f upDir;
-	if (abs(orientation[2]) > RAY_EPSILON) {
-		upDir = vec3f(1, 1, -(orientation[0] + orientation[1]) / orientation[2]).normalize();
+void ParticleSource::render()
+{
+	setFrame(m_numFrame);
+}
+
+void ParticleSource::setFrame(int frame)
+{
+	//the simulation only runs forward; going back means starting over
+	if (frame < m_frame) {
+		reset();
 	}
-	else {
-		//Given Orientation is in xy plane
-		upDir = vec3f(0, 0, 1);
+	while (m_frame < frame) {
+		step();
 	}
-	//basic transformation of the particle system
-	TransformRoot transform;
-	//translate to the origin
-	transform.createChild(mat4f::translate(origin));
-	//rotation of the axes;
-	vec4f row1(orientation.cross(upDir)); row1[3] = 0.0;
-	vec4f row2(upDir); row2[3] = 0.0;
-	vec4f row3(orientation); row3[3] = 0.0;
-	vec4f row4; row4[3] = 1.0;
-	transform.createChild(mat4f(row1, row2, row3, row4).transpose());
-	*/
-	for (Particles::iterator iter = particles.begin(); iter != particles.end(); ++iter) {
-		Particle* particle = *iter;
-
-		//set the material according to life============================================
-		Material* myMat = new Material();
-		myMat->ke = vec3f(1.0, 0.0, 0.0); //pure red, for now
-
-		//the object====================================================================
-		SceneObject* obj = new Cylinder(scene, myMat, true);
+	fillCloud();
+}
 
-		//set the transformation matrix of the obj======================================
-		TransformNode *transform = this->transform;
+void ParticleSource::reset()
+{
+	particles.clear();
+	m_positionGenerator = std::default_random_engine();
+	m_velocityGenerator = std::default_random_engine();
+	m_frame = 0;
+}
 
-		//translate the cylinder to the position of the particle
-		transform = transform->createChild(mat4f::translate(particle->position));
+//emit this frame's particles, then move everything on by one frame
+void ParticleSource::step()
+{
+	std::uniform_real_distribution<double> position_distribution(-1.0, 1.0);
+	std::uniform_real_distribution<double> velocity_distribution(-1.0, 1.0);
+	//initialize the particles
+	particles.reserve(particles.size() + m_numParticles);
+	for (int i = 0; i < m_numParticles; ++i) {
+		vec3f position;
+		for (int i = 0; i < 3; ++i) {
+			position[i] = position_distribution(m_positionGenerator);
+		}
+		vec3f velocity;
+		for (int i = 0; i < 3; ++i) {
+			velocity[i] = velocity_distribution(m_velocityGenerator);
+		}
+		particles.push(position, velocity.normalize() * m_initialSpeed, m_initialLife);
+	}
 
-		//rotate the cylinder to the direction of velocity
-		vec3f upDir;
-		if (abs(particle->velocity[2]) > RAY_EPSILON) {
-			upDir = vec3f(1, 1, -(particle->velocity[0] + particle->velocity[1]) / particle->velocity[2]).normalize();
+	//evolve, in parallel slices for big pools
+	int count = particles.size();
+	if (count > 0) {
+		int workers = (int)std::thread::hardware_concurrency();
+		workers = max(1, min(workers, count / s_minChunk));
+		vector<std::future<void>> jobs;
+		for (int w = 1; w < workers; ++w) {
+			int first = (int)((long long)count * w / workers);
+			int last = (int)((long long)count * (w + 1) / workers);
+			jobs.push_back(std::async(std::launch::async, &ParticlePool::integrate,
+				&particles, first, last, m_frameTime, m_gravity));
 		}
-		else {
-			//Given velocity is in xy plane
-			upDir = vec3f(0, 0, 1);
+		particles.integrate(0, (int)((long long)count / workers), m_frameTime, m_gravity);
+		for (size_t j = 0; j < jobs.size(); ++j) {
+			jobs[j].get();
 		}
-		vec4f row1(particle->velocity.cross(upDir)); row1[3] = 0.0;
-		vec4f row2(upDir); row2[3] = 0.0;
-		vec4f row3(particle->velocity); row3[3] = 0.0;
-		vec4f row4; row4[3] = 1.0;
-		transform = transform-> createChild(mat4f(row1, row2, row3, row4).transpose());
+	}
 
-		//scale the cylinder to be as long as the velocity times frameTime
-		transform = transform->createChild(mat4f::scale(vec3f(0.01, 0.01, m_frameTime * particle->velocity.length())));
+	//kill the ones that are dead
+	particles.removeDead();
+	++m_frame;
+}
 
-		//move down z axis by 0.5
-		transform = transform->createChild(mat4f::translate(vec3f(0.0, 0.0, -0.5)));
-		
-		obj->setTransform(transform);
-		scene->add(obj);
+//hand the particles to the cloud; each is drawn across one frame's travel
+void ParticleSource::fillCloud()
+{
+	int n = particles.size();
+	vector<vec3f> position(n), velocity(n);
+	vector<double> life(particles.life);
+	for (int i = 0; i < n; ++i) {
+		position[i] = vec3f(particles.x[i], particles.y[i], particles.z[i]);
+		velocity[i] = vec3f(particles.vx[i], particles.vy[i], particles.vz[i]);
 	}
+	setParticles(position, velocity, life, m_frameTime);
 }
 
 ParticleSource::~ParticleSource() {
-	for (Particles::iterator iter = particles.begin(); iter != particles.end(); ++iter) {
-		delete *iter;
-	}
-}
\ No newline at end of file
+	reset();
+}
@@ -1,26 +1,38 @@
 #ifndef PARTICLE_SYS_H
 #define PARTICLE_SYS_H
 
-#include <list>
 #include <vector>
+#include <random>
 #include "../vecmath/vecmath.h"
 #include "../scene/ray.h"
 #include "../scene/material.h"
 #include "../scene/scene.h"
+#include "ParticleCloud.h"
 
-struct Particle
+//The live particles, one array per component so the integrate step runs
+//straight down contiguous doubles.  Order is not kept: a dead particle is
+//replaced by the last one.
+struct ParticlePool
 {
-public:
-	vec3f position;
-	vec3f velocity;
-	double life;
+	vector<double> x, y, z;
+	vector<double> vx, vy, vz;
+	vector<double> life;
+
+	int size() const { return (int)life.size(); }
+	void reserve(int n);
+	void push(const vec3f& position, const vec3f& velocity, double life);
+	void clear();
+	//advance particles [first, last) by dt
+	void integrate(int first, int last, double dt, const vec3f& gravity);
+	//drop every particle whose life has run out
+	void removeDead();
 };
 
-class ParticleSource : public MaterialSceneObject
+// A particle cloud that runs its own simulation.  Moving to another frame
+// only refills the cloud's arrays, so the scene doesn't have to be rebuilt.
+class ParticleSource : public ParticleCloud
 {
-	friend class Particle;
-	typedef list<Particle*> Particles; //use list to remove particles more easily
-	Particles particles;
+	ParticlePool particles;
 
 	//parameters for the particle source
 	//System states
@@ -33,17 +45,32 @@ class ParticleSource : public MaterialSceneObject
 	int m_numFrame; //number of frames
 	int m_numParticles; //number of particles projected
 	double m_initialLife;
-	//Render parameters
+	vec3f m_birthColor, m_deathColor; //emissive colour as the particles age
+	//Simulation state
+	int m_frame; //number of frames simulated so far
+	std::default_random_engine m_positionGenerator, m_velocityGenerator;
+
+	void reset();
+	void step();
+	void fillCloud();
 public:
 	ParticleSource(Scene *scene, Material *mat, TransformNode *transform)
-		: MaterialSceneObject(scene, mat), m_initialSpeed(1.0), m_initialLife(10.0), m_numFrame(5), m_frameTime(0.1), m_numParticles(10)
+		: ParticleCloud(scene, mat), m_initialSpeed(1.0), m_initialLife(10.0), m_numFrame(5), m_frameTime(0.1), m_numParticles(10),
+		m_frame(0)
 	{
 		this->transform = transform;
 		m_gravity = vec3f(0, 0, 0);
+		m_birthColor = m_deathColor = vec3f(1.0, 0.0, 0.0); //pure red, for now
+		setLifeColors(m_birthColor, m_deathColor, m_initialLife);
 	}
 	~ParticleSource();
 	//draw the system based on given parameters
 	void render();
+	//simulate up to the given frame, continuing from the current one when
+	//possible, and refill the cloud
+	void setFrame(int frame);
+	int getFrame() const { return m_frame; }
+
 	void setGravity(double x, double y, double z) {
 		m_gravity[0] = x; m_gravity[1] = y; m_gravity[2] = z;
 	}
@@ -64,6 +91,15 @@ public:
 	}
 	void setInitialLife(double initialLife) {
 		m_initialLife = initialLife;
+		setLifeColors(m_birthColor, m_deathColor, m_initialLife);
+	}
+	void setBirthColor(const vec3f& color) {
+		m_birthColor = color;
+		setLifeColors(m_birthColor, m_deathColor, m_initialLife);
+	}
+	void setDeathColor(const vec3f& color) {
+		m_deathColor = color;
+		setLifeColors(m_birthColor, m_deathColor, m_initialLife);
 	}
 
 };
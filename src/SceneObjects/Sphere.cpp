@@ -34,3 +34,19 @@ bool Sphere::intersectLocal( const ray& r, isect& i ) const
 	return true;
 }
 
+
+bool Sphere::intersectLocalSpan( const ray& r, Span& s ) const
+{
+	vec3f v = -r.getPosition();
+	double b = v.dot(r.getDirection());
+	double discriminant = b*b - v.dot(v) + 1;
+
+	if( discriminant < 0.0 ) {
+		return false;
+	}
+
+	discriminant = sqrt( discriminant );
+	s.include( b - discriminant, r.at( b - discriminant ).normalize() );
+	s.include( b + discriminant, r.at( b + discriminant ).normalize() );
+	return true;
+}
@@ -13,6 +13,7 @@ public:
 	}
     
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool intersectLocalSpan( const ray& r, Span& s ) const;
 	virtual bool hasBoundingBoxCapability() const { return true; }
 	virtual bool hasInterior() const{ return true; }
     virtual BoundingBox ComputeLocalBoundingBox()
@@ -37,3 +37,24 @@ bool Square::intersectLocal( const ray& r, isect& i ) const
 
 	return true;
 }
+
+// A square has no inside: its span is the single crossing.
+bool Square::intersectLocalSpan( const ray& r, Span& s ) const
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	if( d[2] == 0.0 ) {
+		return false;
+	}
+
+	double t = -p[2]/d[2];
+	vec3f P = r.at( t );
+
+	if( P[0] < -0.5 || P[0] > 0.5 || P[1] < -0.5 || P[1] > 0.5 ) {
+		return false;
+	}
+
+	s.include( t, vec3f( 0.0, 0.0, 1.0 ) );
+	return true;
+}
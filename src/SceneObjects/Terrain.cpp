@@ -0,0 +1,244 @@
+#include <cmath>
+#include <float.h>
+#include <climits>
+
+#include "Terrain.h"
+
+HeightField::HeightField( Scene *scene, Material *mat, int width, int height,
+	vector<unsigned short>& samples, double scale )
+	: MaterialSceneObject( scene, mat ), m_width( width ), m_height( height ),
+	m_scale( scale )
+{
+	m_samples.swap( samples );
+	buildPyramid();
+}
+
+void HeightField::buildPyramid()
+{
+	m_levels.clear();
+	if( m_width < 2 || m_height < 2 )
+		return;
+
+	Level base;
+	base.w = m_width - 1;
+	base.h = m_height - 1;
+	base.lo.resize( base.w * base.h );
+	base.hi.resize( base.w * base.h );
+	for( int y = 0; y < base.h; ++y ) {
+		const unsigned short *row0 = &m_samples[ y * m_width ];
+		const unsigned short *row1 = row0 + m_width;
+		for( int x = 0; x < base.w; ++x ) {
+			unsigned short lo = min( min( row0[x], row0[x + 1] ), min( row1[x], row1[x + 1] ) );
+			unsigned short hi = max( max( row0[x], row0[x + 1] ), max( row1[x], row1[x + 1] ) );
+			base.lo[ y * base.w + x ] = lo;
+			base.hi[ y * base.w + x ] = hi;
+		}
+	}
+	m_levels.push_back( base );
+
+	while( m_levels.back().w > 1 || m_levels.back().h > 1 ) {
+		const Level& below = m_levels.back();
+		Level up;
+		up.w = (below.w + 1) / 2;
+		up.h = (below.h + 1) / 2;
+		up.lo.assign( up.w * up.h, USHRT_MAX );
+		up.hi.assign( up.w * up.h, 0 );
+		for( int y = 0; y < below.h; ++y ) {
+			for( int x = 0; x < below.w; ++x ) {
+				int from = y * below.w + x;
+				int to = (y / 2) * up.w + x / 2;
+				up.lo[ to ] = min( up.lo[ to ], below.lo[ from ] );
+				up.hi[ to ] = max( up.hi[ to ], below.hi[ from ] );
+			}
+		}
+		m_levels.push_back( up );
+	}
+}
+
+BoundingBox HeightField::ComputeLocalBoundingBox()
+{
+	BoundingBox localbounds;
+	double lo = 0.0, hi = 0.0;
+	if( !m_levels.empty() ) {
+		lo = m_levels.back().lo[0] * m_scale;
+		hi = m_levels.back().hi[0] * m_scale;
+	}
+	localbounds.min = vec3f( 0.0, 0.0, lo - RAY_EPSILON );
+	localbounds.max = vec3f( m_width - 1, m_height - 1, hi + RAY_EPSILON );
+	return localbounds;
+}
+
+// Entry and exit of the ray through a box, clipped to [tmin, tmax].
+static bool clipToBox( const vec3f& p, const vec3f& d, const vec3f& lo, const vec3f& hi,
+	double& tmin, double& tmax )
+{
+	for( int k = 0; k < 3; ++k ) {
+		if( d[k] == 0.0 ) {
+			if( p[k] < lo[k] || p[k] > hi[k] )
+				return false;
+			continue;
+		}
+		double inv = 1.0 / d[k];
+		double t0 = (lo[k] - p[k]) * inv;
+		double t1 = (hi[k] - p[k]) * inv;
+		if( t0 > t1 )
+			swap( t0, t1 );
+		if( t0 > tmin )
+			tmin = t0;
+		if( t1 < tmax )
+			tmax = t1;
+		if( tmin > tmax )
+			return false;
+	}
+	return true;
+}
+
+// One-sided, like the trimesh faces this replaces: hits only from above.
+static bool intersectTriangle( const vec3f& p, const vec3f& d,
+	const vec3f& a, const vec3f& b, const vec3f& c, double& t )
+{
+	vec3f ab = b - a;
+	vec3f ac = c - a;
+	vec3f n = ab.cross( ac );
+	double len = n.length();
+	if( len == 0.0 )
+		return false;
+	n /= len;
+
+	double vdotn = d * n;
+	if( -vdotn < NORMAL_EPSILON )
+		return false;
+
+	double tt = -((p - a) * n) / vdotn;
+	if( tt < RAY_EPSILON )
+		return false;
+
+	// barycentric test in the plane
+	vec3f m = p + tt * d - a;
+	double u = (m.cross( ac ) * n) / len;
+	double v = (ab.cross( m ) * n) / len;
+	if( u < 0.0 || v < 0.0 || u + v > 1.0 )
+		return false;
+
+	t = tt;
+	return true;
+}
+
+// The two triangles of cell (cx,cy), split along the diagonal from
+// (cx,cy) to (cx+1,cy+1).  t comes in as the closest hit so far.
+bool HeightField::intersectCell( const ray& r, int cx, int cy, double& t ) const
+{
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	vec3f v00( cx, cy, sample( cx, cy ) );
+	vec3f v10( cx + 1, cy, sample( cx + 1, cy ) );
+	vec3f v01( cx, cy + 1, sample( cx, cy + 1 ) );
+	vec3f v11( cx + 1, cy + 1, sample( cx + 1, cy + 1 ) );
+
+	bool hit = false;
+	double tt;
+	if( intersectTriangle( p, d, v11, v01, v00, tt ) && tt < t ) {
+		t = tt;
+		hit = true;
+	}
+	if( intersectTriangle( p, d, v11, v00, v10, tt ) && tt < t ) {
+		t = tt;
+		hit = true;
+	}
+	return hit;
+}
+
+// Walk the pyramid front to back, skipping any node whose height range
+// the ray misses or which starts beyond the closest hit found so far.
+bool HeightField::intersectLocal( const ray& r, isect& i ) const
+{
+	if( m_levels.empty() )
+		return false;
+
+	vec3f p = r.getPosition();
+	vec3f d = r.getDirection();
+
+	// pending nodes; at most three siblings wait at each level
+	struct Node { int level, x, y; };
+	Node stack[ 4 * 32 ];
+	int top = 0;
+
+	Node root = { (int)m_levels.size() - 1, 0, 0 };
+	stack[ top++ ] = root;
+
+	// children are pushed far to near so the near one is popped first
+	int nearX = d[0] >= 0.0 ? 0 : 1;
+	int nearY = d[1] >= 0.0 ? 0 : 1;
+	const int order[4][2] = {
+		{ 1 - nearX, 1 - nearY }, { nearX, 1 - nearY },
+		{ 1 - nearX, nearY }, { nearX, nearY }
+	};
+
+	const Level& base = m_levels[0];
+	double best = DBL_MAX;
+	bool hit = false;
+
+	while( top > 0 ) {
+		Node node = stack[ --top ];
+		const Level& level = m_levels[ node.level ];
+		int idx = node.y * level.w + node.x;
+
+		// cells covered by this node
+		int x0 = node.x << node.level;
+		int y0 = node.y << node.level;
+		int x1 = min( (node.x + 1) << node.level, base.w );
+		int y1 = min( (node.y + 1) << node.level, base.h );
+
+		vec3f lo( x0 - RAY_EPSILON, y0 - RAY_EPSILON, level.lo[ idx ] * m_scale - RAY_EPSILON );
+		vec3f hi( x1 + RAY_EPSILON, y1 + RAY_EPSILON, level.hi[ idx ] * m_scale + RAY_EPSILON );
+		double tmin = 0.0, tmax = best;
+		if( !clipToBox( p, d, lo, hi, tmin, tmax ) )
+			continue;
+
+		if( node.level == 0 ) {
+			if( intersectCell( r, node.x, node.y, best ) )
+				hit = true;
+			continue;
+		}
+
+		const Level& below = m_levels[ node.level - 1 ];
+		for( int k = 0; k < 4; ++k ) {
+			Node child = { node.level - 1, node.x * 2 + order[k][0], node.y * 2 + order[k][1] };
+			if( child.x < below.w && child.y < below.h )
+				stack[ top++ ] = child;
+		}
+	}
+
+	if( !hit )
+		return false;
+
+	vec3f P = r.at( best );
+	i.obj = this;
+	i.t = best;
+	i.N = normalAt( P[0], P[1] );
+	return true;
+}
+
+vec3f HeightField::vertexNormal( int x, int y ) const
+{
+	int xl = max( x - 1, 0 ), xh = min( x + 1, m_width - 1 );
+	int yl = max( y - 1, 0 ), yh = min( y + 1, m_height - 1 );
+	double dx = (sample( xh, y ) - sample( xl, y )) / (xh - xl);
+	double dy = (sample( x, yh ) - sample( x, yl )) / (yh - yl);
+	return vec3f( -dx, -dy, 1.0 );
+}
+
+vec3f HeightField::normalAt( double x, double y ) const
+{
+	int cx = (int)floor( x );
+	int cy = (int)floor( y );
+	cx = max( 0, min( cx, m_width - 2 ) );
+	cy = max( 0, min( cy, m_height - 2 ) );
+	double fx = x - cx;
+	double fy = y - cy;
+
+	vec3f n = (1.0 - fy) * ((1.0 - fx) * vertexNormal( cx, cy ) + fx * vertexNormal( cx + 1, cy ))
+		+ fy * ((1.0 - fx) * vertexNormal( cx, cy + 1 ) + fx * vertexNormal( cx + 1, cy + 1 ));
+	return n.normalize();
+}
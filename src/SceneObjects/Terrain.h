@@ -0,0 +1,56 @@
+#ifndef __TERRAIN_H__
+#define __TERRAIN_H__
+
+// The HeightField primitive.  (The file isn't called HeightField.h so that
+// it doesn't collide with the height map reader in fileio/.)
+
+#include <vector>
+
+#include "../scene/scene.h"
+
+// A regular grid of height samples, in local coordinates x = 0..width-1,
+// y = 0..height-1, z = sample * scale.  Each grid cell is the same pair of
+// triangles the old per-pixel trimesh used, but nothing is stored per
+// cell except a min/max pyramid, and normals are interpolated from the
+// grid when a hit is found.
+class HeightField
+	: public MaterialSceneObject
+{
+public:
+	// samples holds width*height values, row by row; it's swapped in
+	HeightField( Scene *scene, Material *mat, int width, int height,
+		vector<unsigned short>& samples, double scale );
+
+	virtual bool intersectLocal( const ray& r, isect& i ) const;
+	virtual bool hasBoundingBoxCapability() const { return true; }
+	virtual bool hasInterior() const { return false; }
+	virtual BoundingBox ComputeLocalBoundingBox();
+
+	// smooth normal at a point of the grid, from central differences
+	vec3f normalAt( double x, double y ) const;
+
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+private:
+	double sample( int x, int y ) const { return m_samples[ y * m_width + x ] * m_scale; }
+	vec3f vertexNormal( int x, int y ) const;
+	void buildPyramid();
+	bool intersectCell( const ray& r, int cx, int cy, double& t ) const;
+
+	// Level 0 holds the lowest and highest corner of each cell; each level
+	// above is the min/max of 2x2 nodes of the one below, up to a single
+	// node for the whole grid.
+	struct Level
+	{
+		int w, h;
+		vector<unsigned short> lo, hi;
+	};
+
+	int m_width, m_height;
+	double m_scale;
+	vector<unsigned short> m_samples;
+	vector<Level> m_levels;
+};
+
+#endif // __TERRAIN_H__
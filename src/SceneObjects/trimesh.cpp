@@ -28,6 +28,16 @@ void Trimesh::addNormal( const vec3f &n )
 
 // Returns false if the vertices a,b,c don't all exist
 bool Trimesh::addFace( int a, int b, int c )
+{
+    return insertFace( a, b, c, NULL );
+}
+
+bool Trimesh::addFace( int a, int b, int c, const BoundingBox& bounds )
+{
+    return insertFace( a, b, c, &bounds );
+}
+
+bool Trimesh::insertFace( int a, int b, int c, const BoundingBox *bounds )
 {
     int vcnt = vertices.size();
 
@@ -37,7 +47,10 @@ bool Trimesh::addFace( int a, int b, int c )
     TrimeshFace *newFace = new TrimeshFace( scene, new Material(*this->material), this, a, b, c );
     newFace->setTransform(this->transform);
     faces.push_back( newFace );
-    scene->add(newFace);
+    if( bounds )
+        scene->add(newFace, *bounds);
+    else
+        scene->add(newFace);
     return true;
 }
 
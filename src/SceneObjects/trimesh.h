@@ -20,6 +20,9 @@ class Trimesh : public MaterialSceneObject
     Faces faces;
     Normals normals;
     Materials materials;
+
+    // both addFaces: the face's bounds are given, or found if bounds is NULL
+    bool insertFace( int a, int b, int c, const BoundingBox *bounds );
 public:
     Trimesh( Scene *scene, Material *mat, TransformNode *transform )
         : MaterialSceneObject(scene, mat)
@@ -34,7 +37,24 @@ public:
     void addMaterial( Material *m );
     void addNormal( const vec3f & );
 
+    // optional; lets the readers size each array once up front
+    void reserveVertices( size_t n ) { vertices.reserve( n ); }
+    void reserveFaces( size_t n ) { faces.reserve( n ); }
+    void reserveNormals( size_t n ) { normals.reserve( n ); }
+    void reserveMaterials( size_t n ) { materials.reserve( n ); }
+
+    // hand over a whole array read elsewhere; swaps, so nothing is copied
+    void swapVertices( vector<vec3f>& v ) { vertices.swap( v ); }
+    void swapNormals( vector<vec3f>& n ) { normals.swap( n ); }
+
     bool addFace( int a, int b, int c );
+    // as above, with the face's bounds already known
+    bool addFace( int a, int b, int c, const BoundingBox& bounds );
+
+    const vector<vec3f>& getVertices() const { return vertices; }
+    const vector<vec3f>& getNormals() const { return normals; }
+    const vector<Material*>& getMaterials() const { return materials; }
+    const vector<TrimeshFace*>& getFaces() const { return faces; }
 
     char *doubleCheck();
     
@@ -1,51 +1,40 @@
 #include <Fl/fl_ask.h>
 
 #include "HeightField.h"
-#include "bitmap.h"
+#include "mappedbitmap.h"
 
 #include "parse.h"
-#include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/Terrain.h"
 #include "../scene/light.h"
 #include "../scene/material.h"
 
 Scene *readHeights(char* fn) {
-	int width, height;
-	unsigned char *height_map;
-	height_map = readBMP(fn, width, height);
-	if (!height_map)
+	MappedBitmap height_map;
+	if (!height_map.open(fn))
 	{
 		fl_alert("Error loading height map\n");
 		return false;
 	}
 
 	Scene * ret = new Scene();
+	ret->addSourceFile(fn);
 	//TODO: customize mat
 	Material * mat = new Material();
 	mat->kd = vec3f(1.0, 1.0, 1.0);
-	//extract the points
-	Trimesh * trimesh = new Trimesh(ret, mat, &ret->transformRoot);
-
+	//keep the heights as the sum of the three channels, 0..765, so that
+	//a sample is two bytes; the scale makes it (r+g+b)/3/128 as before.
+	//the sum is read straight from the mapped file's rows
+	int width = height_map.width(), height = height_map.height();
+	vector<unsigned short> samples(width * height);
 	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			int pos = y * width + x;
-			unsigned char pixel[3];
-			memcpy(pixel, height_map + pos * 3, 3);
-			double height = double(pixel[0] + pixel[1] + pixel[2]) / 3 / 128;
-			vec3f point(x, y, height);
-			trimesh->addVertex(point);
-			if (x > 0 && y > 0) { //link the points
-				trimesh->addFace(pos, pos - 1, pos - 1 - width);
-				trimesh->addFace(pos, pos - 1 - width, pos - width);
-			}
-		}
+		const unsigned char *pixel = height_map.row(y);
+		for (int x = 0; x < width; ++x, pixel += 3)
+			samples[y * width + x] = pixel[0] + pixel[1] + pixel[2];
 	}
-	
-	char *error;
-	if (error = trimesh->doubleCheck())
-		throw ParseError(error);
 
-	//add a trimesh
-	ret->add(trimesh);
+	HeightField * field = new HeightField(ret, mat, width, height, samples, 1.0 / 384);
+	field->setTransform(&ret->transformRoot);
+	ret->add(field);
 
 	//add a pointlight
 	PointLight* point_light = new PointLight(ret, vec3f(width, height, 10), vec3f(1.0, 1.0, 1.0));
@@ -10,90 +10,23 @@
 //
 
 #include "bitmap.h"
- 
-BMP_BITMAPFILEHEADER bmfh; 
-BMP_BITMAPINFOHEADER bmih; 
+#include "mappedbitmap.h"
 
+// Mapped rather than read, the file's rows go straight into the one
+// buffer returned, turned from BGR to RGB on the way.
 unsigned char *readBMP(char *fname, int& width, int& height)
 { 
-	FILE* file; 
-	BMP_DWORD pos; 
- 
-	if ( (file=fopen( fname, "rb" )) == NULL )  
-		return NULL; 
-	 
-//	I am doing fread( &bmfh, sizeof(BMP_BITMAPFILEHEADER), 1, file ) in a safe way. :}
-	fread( &(bmfh.bfType), 2, 1, file); 
-	fread( &(bmfh.bfSize), 4, 1, file); 
-	fread( &(bmfh.bfReserved1), 2, 1, file); 
-	fread( &(bmfh.bfReserved2), 2, 1, file); 
-	fread( &(bmfh.bfOffBits), 4, 1, file); 
-
-	pos = bmfh.bfOffBits; 
- 
-	fread( &bmih, sizeof(BMP_BITMAPINFOHEADER), 1, file ); 
- 
-	// error checking
-	if ( bmfh.bfType!= 0x4d42 ) {	// "BM" actually
+	MappedBitmap bmp;
+	if ( !bmp.open( fname ) )
 		return NULL;
-	}
-	if ( bmih.biBitCount != 24 )  
-		return NULL; 
-/*
- 	if ( bmih.biCompression != BMP_BI_RGB ) {
-		return NULL;
-	}
-*/
-	fseek( file, pos, SEEK_SET ); 
- 
-	width = bmih.biWidth; 
-	height = bmih.biHeight; 
- 
-	int padWidth = width * 3; 
-	int pad = 0; 
-	if ( padWidth % 4 != 0 ) 
-	{ 
-		pad = 4 - (padWidth % 4); 
-		padWidth += pad; 
-	} 
-	int bytes = height*padWidth; 
- 
-	unsigned char *data = new unsigned char [bytes]; 
 
-	int foo = fread( data, bytes, 1, file ); 
-	
-	if (!foo) {
-		delete [] data;
-		return NULL;
-	}
-
-	fclose( file );
-	
-	// shuffle bitmap data such that it is (R,G,B) tuples in row-major order
-	int i, j;
-	j = 0;
-	unsigned char temp;
-	unsigned char* in;
-	unsigned char* out;
+	width = bmp.width();
+	height = bmp.height();
 
-	in = data;
-	out = data;
-
-	for ( j = 0; j < height; ++j )
-	{
-		for ( i = 0; i < width; ++i )
-		{
-			out[1] = in[1];
-			temp = in[2];
-			out[2] = in[0];
-			out[0] = temp;
+	unsigned char *data = new unsigned char [(size_t)width * height * 3];
+	for ( int j = 0; j < height; ++j )
+		bmp.rgbRow( j, data + (size_t)j * width * 3 );
 
-			in += 3;
-			out += 3;
-		}
-		in += pad;
-	}
-			  
 	return data; 
 } 
  
@@ -105,6 +38,9 @@ void writeBMP(char *iname, int width, int height, unsigned char *data)
 	bytes += pad;
 	bytes *= height;
 
+	BMP_BITMAPFILEHEADER bmfh;
+	BMP_BITMAPINFOHEADER bmih;
+
 	bmfh.bfType = 0x4d42;    // "BM"
 	bmfh.bfSize = sizeof(BMP_BITMAPFILEHEADER) + sizeof(BMP_BITMAPINFOHEADER) + bytes;
 	bmfh.bfReserved1 = 0;
@@ -0,0 +1,838 @@
+#ifdef WIN32
+#pragma warning( disable : 4786 )
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "compiledscene.h"
+#include "mmapfile.h"
+#include "parse.h"
+
+#include "../scene/light.h"
+#include "../SceneObjects/trimesh.h"
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/CSG.h"
+#include "../SceneObjects/ParticleCloud.h"
+#include "../SceneObjects/Instance.h"
+
+// Layout (all values native doubles / 32-bit ints, no padding):
+//
+//   header     magic[8], version, byte order mark
+//   camera     eye, rotation, normalized height, aspect ratio
+//   ambient    scene ambient color
+//   materials  count, then ke ka ks kd kr kt shininess index
+//   transforms count, then global xform, inverse, normal matrix
+//   lights     count, then kind and fields
+//   prototypes count, then per prototype a count and its object records
+//   objects    count, then one record per object (see putObject)
+//
+// Objects name their transform and material by index into the tables, and
+// instances their prototype by index into the prototypes before them.
+// Trimesh faces aren't listed on their own; they come back with their mesh.
+
+static const char s_magic[8] = { 'S', 'B', 'T', '-', 'R', 'A', 'Y', 'B' };
+static const unsigned s_version = 3;
+static const unsigned s_byteOrder = 0x01020304;
+
+enum {
+	LIGHT_DIRECTIONAL = 1,
+	LIGHT_POINT,
+	LIGHT_AMBIENT
+};
+
+enum {
+	OBJ_SPHERE = 1,
+	OBJ_BOX,
+	OBJ_CYLINDER,
+	OBJ_CONE,
+	OBJ_SQUARE,
+	OBJ_TRIMESH,
+	OBJ_CSG,
+	OBJ_PARTICLES,
+	OBJ_INSTANCE
+};
+
+// the smallest object record: an instance's kind, transform, prototype
+// and bounds
+static const size_t s_minObjectSize = 3 * sizeof( unsigned ) + 6 * sizeof( double );
+
+bool isCompiledScene( const char *fname )
+{
+	FILE *f = fopen( fname, "rb" );
+	if( !f )
+		return false;
+
+	char magic[ sizeof( s_magic ) ];
+	bool ret = fread( magic, sizeof( magic ), 1, f ) == 1
+		&& memcmp( magic, s_magic, sizeof( s_magic ) ) == 0;
+	fclose( f );
+	return ret;
+}
+
+//
+// writing
+//
+
+class SceneWriter
+{
+public:
+	SceneWriter( FILE *f ) : m_f( f ), m_ok( true ) {}
+
+	void setFile( FILE *f ) { m_f = f; }
+	bool ok() const { return m_ok; }
+
+	void putBytes( const void *p, size_t n )
+	{
+		if( m_ok && n && fwrite( p, n, 1, m_f ) != 1 )
+			m_ok = false;
+	}
+	void putUInt( unsigned u ) { putBytes( &u, sizeof( u ) ); }
+	void putInt( int i ) { putBytes( &i, sizeof( i ) ); }
+	void putDouble( double d ) { putBytes( &d, sizeof( d ) ); }
+	void putVec( const vec3f& v )
+	{
+		double d[3] = { v[0], v[1], v[2] };
+		putBytes( d, sizeof( d ) );
+	}
+	void putMat( const mat3f& m )
+	{
+		for( int i = 0; i < 3; ++i )
+			putVec( m[i] );
+	}
+	void putMat( const mat4f& m )
+	{
+		for( int i = 0; i < 4; ++i )
+			for( int j = 0; j < 4; ++j )
+				putDouble( m[i][j] );
+	}
+	void putBounds( const BoundingBox& b )
+	{
+		putVec( b.min );
+		putVec( b.max );
+	}
+
+	// table indices; the tables themselves are written before the objects
+	unsigned transformIndex( TransformNode *t );
+	unsigned materialIndex( const Material& m );
+	// Add a prototype to the table, after any its objects place, and
+	// collect what its objects refer to.  False if it holds an object
+	// that can't be written.
+	bool addPrototype( Prototype *p );
+	unsigned prototypeIndex( Prototype *p ) { return m_prototypeIds[ p ]; }
+
+	void putMaterials();
+	void putTransforms();
+	void putPrototypes();
+	void putObject( Geometry *obj );
+
+private:
+	void putCSGNode( const CSGNode *node );
+
+	FILE *m_f;
+	bool m_ok;
+
+	map<TransformNode*,unsigned> m_transformIds;
+	vector<TransformNode*> m_transforms;
+	map<string,unsigned> m_materialIds;
+	vector<const Material*> m_materials;
+	map<Prototype*,unsigned> m_prototypeIds;
+	vector< vector<Geometry*> > m_prototypes;	// each one's objects to write
+};
+
+static string materialKey( const Material& m )
+{
+	double d[ 20 ];
+	const vec3f *v[] = { &m.ke, &m.ka, &m.ks, &m.kd, &m.kr, &m.kt };
+	for( int i = 0; i < 6; ++i )
+		for( int j = 0; j < 3; ++j )
+			d[ i * 3 + j ] = (*v[i])[j];
+	d[ 18 ] = m.shininess;
+	d[ 19 ] = m.index;
+	return string( (const char *)d, sizeof( d ) );
+}
+
+unsigned SceneWriter::transformIndex( TransformNode *t )
+{
+	map<TransformNode*,unsigned>::iterator i = m_transformIds.find( t );
+	if( i != m_transformIds.end() )
+		return i->second;
+
+	unsigned id = m_transforms.size();
+	m_transformIds[ t ] = id;
+	m_transforms.push_back( t );
+	return id;
+}
+
+unsigned SceneWriter::materialIndex( const Material& m )
+{
+	string key = materialKey( m );
+	map<string,unsigned>::iterator i = m_materialIds.find( key );
+	if( i != m_materialIds.end() )
+		return i->second;
+
+	unsigned id = m_materials.size();
+	m_materialIds[ key ] = id;
+	m_materials.push_back( &m );
+	return id;
+}
+
+void SceneWriter::putMaterials()
+{
+	putUInt( m_materials.size() );
+	for( size_t i = 0; i < m_materials.size(); ++i ) {
+		const Material& m = *m_materials[i];
+		putVec( m.ke );
+		putVec( m.ka );
+		putVec( m.ks );
+		putVec( m.kd );
+		putVec( m.kr );
+		putVec( m.kt );
+		putDouble( m.shininess );
+		putDouble( m.index );
+	}
+}
+
+void SceneWriter::putTransforms()
+{
+	putUInt( m_transforms.size() );
+	for( size_t i = 0; i < m_transforms.size(); ++i ) {
+		putMat( m_transforms[i]->getXform() );
+		putMat( m_transforms[i]->getInverse() );
+		putMat( m_transforms[i]->getNormi() );
+	}
+}
+
+// Kind of object we know how to write, or 0 for ones we can't.  Particle
+// sources are written as plain clouds holding their current frame.
+static unsigned objectKind( Geometry *obj )
+{
+	if( dynamic_cast<Instance*>( obj ) )	return OBJ_INSTANCE;
+	if( dynamic_cast<Sphere*>( obj ) )		return OBJ_SPHERE;
+	if( dynamic_cast<Box*>( obj ) )			return OBJ_BOX;
+	if( dynamic_cast<Cylinder*>( obj ) )	return OBJ_CYLINDER;
+	if( dynamic_cast<Cone*>( obj ) )		return OBJ_CONE;
+	if( dynamic_cast<Square*>( obj ) )		return OBJ_SQUARE;
+	if( dynamic_cast<Trimesh*>( obj ) )		return OBJ_TRIMESH;
+	if( dynamic_cast<CSG*>( obj ) )			return OBJ_CSG;
+	if( dynamic_cast<ParticleCloud*>( obj ) )	return OBJ_PARTICLES;
+	return 0;
+}
+
+// Add obj to the objects to write, unless it's a trimesh face, which is
+// written with its mesh.  An object with no record stops the whole write
+// rather than going missing from the compiled scene.
+static bool listObject( Geometry *obj, vector<Geometry*>& objects )
+{
+	if( dynamic_cast<TrimeshFace*>( obj ) )
+		return true;
+	if( !objectKind( obj ) ) {
+		cerr << "Error: the scene has an object compiled scenes can't hold; "
+			"render it from its .ray file instead." << endl;
+		return false;
+	}
+	objects.push_back( obj );
+	return true;
+}
+
+// Collect the table entries an object refers to, so the tables can be
+// written ahead of the objects.
+static bool collectTables( SceneWriter& w, Geometry *obj )
+{
+	w.transformIndex( obj->getTransform() );
+	if( Instance *inst = dynamic_cast<Instance*>( obj ) )
+		return w.addPrototype( inst->getPrototype() );
+
+	SceneObject *so = dynamic_cast<SceneObject*>( obj );
+	w.materialIndex( so->getMaterial() );
+
+	if( Trimesh *mesh = dynamic_cast<Trimesh*>( obj ) ) {
+		const vector<Material*>& mats = mesh->getMaterials();
+		for( size_t i = 0; i < mats.size(); ++i )
+			w.materialIndex( *mats[i] );
+	} else if( CSG *csg = dynamic_cast<CSG*>( obj ) ) {
+		vector<const CSGNode*> stack( 1, csg->getTree()->getRoot() );
+		while( !stack.empty() ) {
+			const CSGNode *node = stack.back();
+			stack.pop_back();
+			if( node->isLeaf ) {
+				if( !collectTables( w, node->object ) )
+					return false;
+			} else {
+				stack.push_back( node->lchild );
+				stack.push_back( node->rchild );
+			}
+		}
+	}
+	return true;
+}
+
+bool SceneWriter::addPrototype( Prototype *p )
+{
+	if( m_prototypeIds.count( p ) )
+		return true;
+
+	vector<Geometry*> objects;
+	const vector<Geometry*>& owned = p->getObjects();
+	for( size_t i = 0; i < owned.size(); ++i ) {
+		if( !listObject( owned[i], objects ) )
+			return false;
+	}
+	for( size_t i = 0; i < objects.size(); ++i ) {
+		if( !collectTables( *this, objects[i] ) )
+			return false;
+	}
+
+	m_prototypeIds[ p ] = m_prototypes.size();
+	m_prototypes.push_back( objects );
+	return true;
+}
+
+void SceneWriter::putPrototypes()
+{
+	putUInt( m_prototypes.size() );
+	for( size_t i = 0; i < m_prototypes.size(); ++i ) {
+		putUInt( m_prototypes[i].size() );
+		for( size_t k = 0; k < m_prototypes[i].size(); ++k )
+			putObject( m_prototypes[i][k] );
+	}
+}
+
+// type, transform, material, order, bounds, then per-type fields; an
+// instance has its prototype in place of the material and order
+void SceneWriter::putObject( Geometry *obj )
+{
+	unsigned kind = objectKind( obj );
+
+	putUInt( kind );
+	putUInt( transformIndex( obj->getTransform() ) );
+	if( kind == OBJ_INSTANCE ) {
+		putUInt( prototypeIndex( ((Instance*)obj)->getPrototype() ) );
+		putBounds( obj->getBoundingBox() );
+		return;
+	}
+
+	SceneObject *so = dynamic_cast<SceneObject*>( obj );
+	putUInt( materialIndex( so->getMaterial() ) );
+	putInt( so->getOrder() );
+	putBounds( obj->getBoundingBox() );
+
+	switch( kind ) {
+	case OBJ_CYLINDER:
+		putUInt( ((Cylinder*)obj)->isCapped() );
+		break;
+
+	case OBJ_CONE:
+		{
+			Cone *cone = (Cone*)obj;
+			putUInt( cone->isCapped() );
+			putDouble( cone->getHeight() );
+			putDouble( cone->getBottomRadius() );
+			putDouble( cone->getTopRadius() );
+		}
+		break;
+
+	case OBJ_TRIMESH:
+		{
+			Trimesh *mesh = (Trimesh*)obj;
+			const vector<vec3f>& verts = mesh->getVertices();
+			const vector<vec3f>& norms = mesh->getNormals();
+			const vector<Material*>& mats = mesh->getMaterials();
+			const vector<TrimeshFace*>& faces = mesh->getFaces();
+
+			putUInt( verts.size() );
+			putUInt( norms.size() );
+			putUInt( mats.size() );
+			putUInt( faces.size() );
+			for( size_t i = 0; i < verts.size(); ++i )
+				putVec( verts[i] );
+			for( size_t i = 0; i < norms.size(); ++i )
+				putVec( norms[i] );
+			for( size_t i = 0; i < mats.size(); ++i )
+				putUInt( materialIndex( *mats[i] ) );
+			for( size_t i = 0; i < faces.size(); ++i ) {
+				const TrimeshFace& f = *faces[i];
+				putInt( f[0] );
+				putInt( f[1] );
+				putInt( f[2] );
+				putBounds( f.getBoundingBox() );
+			}
+		}
+		break;
+
+	case OBJ_CSG:
+		putCSGNode( ((CSG*)obj)->getTree()->getRoot() );
+		break;
+
+	case OBJ_PARTICLES:
+		{
+			ParticleCloud *cloud = (ParticleCloud*)obj;
+			const vector<vec3f>& pos = cloud->getPositions();
+			const vector<vec3f>& vel = cloud->getVelocities();
+			const vector<double>& life = cloud->getLives();
+
+			putDouble( cloud->getStep() );
+			putDouble( cloud->getRadius() );
+			putDouble( cloud->getInitialLife() );
+			putVec( cloud->getBirthColor() );
+			putVec( cloud->getDeathColor() );
+			putUInt( life.size() );
+			for( size_t i = 0; i < life.size(); ++i ) {
+				putVec( pos[i] );
+				putVec( vel[i] );
+				putDouble( life[i] );
+			}
+		}
+		break;
+	}
+}
+
+// pre-order: leaf flag, then either the leaf object or relation + children
+void SceneWriter::putCSGNode( const CSGNode *node )
+{
+	putUInt( node->isLeaf );
+	if( node->isLeaf ) {
+		putObject( node->object );
+	} else {
+		putUInt( node->relation );
+		putCSGNode( node->lchild );
+		putCSGNode( node->rchild );
+	}
+}
+
+bool writeCompiledScene( const char *fname, Scene *scene )
+{
+	vector<Geometry*> objects;
+	for( Scene::cgiter g = scene->beginObjects(); g != scene->endObjects(); ++g ) {
+		if( !listObject( *g, objects ) )
+			return false;
+	}
+
+	// the tables are filled in before anything is written, so a scene
+	// that can't be written leaves no file
+	SceneWriter w( NULL );
+	for( size_t i = 0; i < objects.size(); ++i ) {
+		if( !collectTables( w, objects[i] ) )
+			return false;
+	}
+
+	FILE *f = fopen( fname, "wb" );
+	if( !f )
+		return false;
+	w.setFile( f );
+
+	w.putBytes( s_magic, sizeof( s_magic ) );
+	w.putUInt( s_version );
+	w.putUInt( s_byteOrder );
+
+	Camera *camera = scene->getCamera();
+	w.putVec( camera->getEye() );
+	w.putMat( camera->getRotation() );
+	w.putDouble( camera->getNormalizedHeight() );
+	w.putDouble( camera->getAspectRatio() );
+	w.putVec( scene->getAmbient() );
+
+	w.putMaterials();
+	w.putTransforms();
+
+	vector<Light*> lights;
+	for( Scene::cliter l = scene->beginLights(); l != scene->endLights(); ++l ) {
+		if( dynamic_cast<DirectionalLight*>( *l ) || dynamic_cast<PointLight*>( *l )
+			|| dynamic_cast<AmbientLight*>( *l ) )
+			lights.push_back( *l );
+	}
+	w.putUInt( lights.size() );
+	for( size_t i = 0; i < lights.size(); ++i ) {
+		vec3f color = lights[i]->getColor( vec3f() );
+		if( DirectionalLight *dl = dynamic_cast<DirectionalLight*>( lights[i] ) ) {
+			w.putUInt( LIGHT_DIRECTIONAL );
+			w.putVec( dl->getOrientation() );
+			w.putVec( color );
+		} else if( PointLight *pl = dynamic_cast<PointLight*>( lights[i] ) ) {
+			double c, l, q;
+			pl->getDistanceAttenuation( c, l, q );
+			w.putUInt( LIGHT_POINT );
+			w.putVec( pl->getPosition() );
+			w.putVec( color );
+			w.putDouble( c );
+			w.putDouble( l );
+			w.putDouble( q );
+		} else {
+			w.putUInt( LIGHT_AMBIENT );
+			w.putVec( color );
+		}
+	}
+
+	w.putPrototypes();
+	w.putUInt( objects.size() );
+	for( size_t i = 0; i < objects.size(); ++i )
+		w.putObject( objects[i] );
+
+	bool ok = w.ok();
+	if( fclose( f ) != 0 )
+		ok = false;
+	return ok;
+}
+
+//
+// reading
+//
+
+class SceneReader
+{
+public:
+	SceneReader( const char *begin, const char *end, Scene *scene )
+		: m_cur( begin ), m_end( end ), m_scene( scene ) {}
+
+	void getBytes( void *p, size_t n )
+	{
+		if( (size_t)(m_end - m_cur) < n )
+			throw ParseError( "Compiled scene is truncated." );
+		memcpy( p, m_cur, n );
+		m_cur += n;
+	}
+	unsigned getUInt() { unsigned u; getBytes( &u, sizeof( u ) ); return u; }
+	int getInt() { int i; getBytes( &i, sizeof( i ) ); return i; }
+	double getDouble() { double d; getBytes( &d, sizeof( d ) ); return d; }
+	vec3f getVec() { vec3f v; getBytes( &v[0], 3 * sizeof( double ) ); return v; }
+	mat3f getMat3()
+	{
+		mat3f m;
+		for( int i = 0; i < 3; ++i )
+			m[i] = getVec();
+		return m;
+	}
+	mat4f getMat4()
+	{
+		mat4f m;
+		for( int i = 0; i < 4; ++i )
+			for( int j = 0; j < 4; ++j )
+				m[i][j] = getDouble();
+		return m;
+	}
+	BoundingBox getBounds()
+	{
+		BoundingBox b;
+		b.min = getVec();
+		b.max = getVec();
+		return b;
+	}
+
+	// a count of records at least minSize bytes each, checked against what's left
+	unsigned getCount( size_t minSize )
+	{
+		unsigned n = getUInt();
+		if( minSize && n > (size_t)(m_end - m_cur) / minSize )
+			throw ParseError( "Compiled scene is truncated." );
+		return n;
+	}
+
+	void getMaterials();
+	void getTransforms();
+	void getLights();
+	void getPrototypes();
+	// reads one object record; the caller decides where it goes
+	Geometry *getObject( BoundingBox& bounds );
+
+private:
+	CSGNode *getCSGNode();
+
+	Material *newMaterial( unsigned id )
+	{
+		if( id >= m_materials.size() )
+			throw ParseError( "Compiled scene has a bad material index." );
+		return new Material( m_materials[id] );
+	}
+	TransformNode *transform( unsigned id )
+	{
+		if( id >= m_transforms.size() )
+			throw ParseError( "Compiled scene has a bad transform index." );
+		return m_transforms[id];
+	}
+
+	const char *m_cur;
+	const char *m_end;
+	Scene *m_scene;
+
+	vector<Material> m_materials;
+	vector<TransformNode*> m_transforms;
+	vector<Prototype*> m_prototypes;
+};
+
+void SceneReader::getMaterials()
+{
+	unsigned n = getCount( 20 * sizeof( double ) );
+	m_materials.resize( n );
+	for( unsigned i = 0; i < n; ++i ) {
+		Material& m = m_materials[i];
+		m.ke = getVec();
+		m.ka = getVec();
+		m.ks = getVec();
+		m.kd = getVec();
+		m.kr = getVec();
+		m.kt = getVec();
+		m.shininess = getDouble();
+		m.index = getDouble();
+	}
+}
+
+void SceneReader::getTransforms()
+{
+	unsigned n = getCount( 41 * sizeof( double ) );
+	m_transforms.reserve( n );
+	for( unsigned i = 0; i < n; ++i ) {
+		mat4f xform = getMat4();
+		mat4f inverse = getMat4();
+		mat3f normi = getMat3();
+		m_transforms.push_back(
+			m_scene->transformRoot.createBakedChild( xform, inverse, normi ) );
+	}
+}
+
+void SceneReader::getLights()
+{
+	unsigned n = getCount( sizeof( unsigned ) );
+	for( unsigned i = 0; i < n; ++i ) {
+		unsigned kind = getUInt();
+		if( kind == LIGHT_DIRECTIONAL ) {
+			vec3f orien = getVec();
+			vec3f color = getVec();
+			m_scene->add( new DirectionalLight( m_scene, orien, color ) );
+		} else if( kind == LIGHT_POINT ) {
+			vec3f pos = getVec();
+			vec3f color = getVec();
+			PointLight *light = new PointLight( m_scene, pos, color );
+			double c = getDouble();
+			double l = getDouble();
+			double q = getDouble();
+			light->setDistanceAttenuation( c, l, q );
+			m_scene->add( light );
+		} else if( kind == LIGHT_AMBIENT ) {
+			m_scene->add( new AmbientLight( m_scene, vec3f( 1, 1, 1 ), getVec() ) );
+		} else {
+			throw ParseError( "Compiled scene has an unknown light." );
+		}
+	}
+}
+
+// Each prototype's objects are read into the scene and taken back out,
+// as readScene() does with a prototype's block.
+void SceneReader::getPrototypes()
+{
+	unsigned n = getCount( sizeof( unsigned ) );
+	for( unsigned i = 0; i < n; ++i ) {
+		Prototype *proto = new Prototype;
+		m_scene->addPrototype( proto );
+
+		unsigned count = getCount( s_minObjectSize );
+		m_scene->beginPrototype();
+		for( unsigned k = 0; k < count; ++k ) {
+			BoundingBox bounds;
+			Geometry *obj = getObject( bounds );
+			m_scene->add( obj, bounds );
+		}
+		vector<Geometry*> taken;
+		m_scene->endPrototype( taken );
+
+		proto->setObjects( taken );
+		m_prototypes.push_back( proto );
+	}
+}
+
+Geometry *SceneReader::getObject( BoundingBox& bounds )
+{
+	unsigned kind = getUInt();
+	TransformNode *xform = transform( getUInt() );
+	if( kind == OBJ_INSTANCE ) {
+		unsigned id = getUInt();
+		if( id >= m_prototypes.size() )
+			throw ParseError( "Compiled scene has a bad prototype index." );
+		bounds = getBounds();
+		Instance *inst = new Instance( m_scene, m_prototypes[id] );
+		inst->setTransform( xform );
+		return inst;
+	}
+
+	unsigned matId = getUInt();
+	int order = getInt();
+	bounds = getBounds();
+
+	MaterialSceneObject *obj = NULL;
+	switch( kind ) {
+	case OBJ_SPHERE:
+		obj = new Sphere( m_scene, newMaterial( matId ) );
+		break;
+
+	case OBJ_BOX:
+		obj = new Box( m_scene, newMaterial( matId ) );
+		break;
+
+	case OBJ_SQUARE:
+		obj = new Square( m_scene, newMaterial( matId ) );
+		break;
+
+	case OBJ_CYLINDER:
+		{
+			bool capped = getUInt() != 0;
+			obj = new Cylinder( m_scene, newMaterial( matId ), capped );
+		}
+		break;
+
+	case OBJ_CONE:
+		{
+			bool capped = getUInt() != 0;
+			double height = getDouble();
+			double br = getDouble();
+			double tr = getDouble();
+			obj = new Cone( m_scene, newMaterial( matId ), height, br, tr, capped );
+		}
+		break;
+
+	case OBJ_TRIMESH:
+		{
+			unsigned nverts = getCount( 0 );
+			unsigned nnorms = getCount( 0 );
+			unsigned nmats = getCount( 0 );
+			unsigned nfaces = getCount( 0 );
+			if( (double)(m_end - m_cur) < 24.0 * nverts + 24.0 * nnorms
+				+ 4.0 * nmats + 60.0 * nfaces )
+				throw ParseError( "Compiled scene is truncated." );
+
+			Trimesh *mesh = new Trimesh( m_scene, newMaterial( matId ), xform );
+			mesh->reserveVertices( nverts );
+			mesh->reserveNormals( nnorms );
+			mesh->reserveMaterials( nmats );
+			mesh->reserveFaces( nfaces );
+			for( unsigned i = 0; i < nverts; ++i )
+				mesh->addVertex( getVec() );
+			for( unsigned i = 0; i < nnorms; ++i )
+				mesh->addNormal( getVec() );
+			for( unsigned i = 0; i < nmats; ++i )
+				mesh->addMaterial( newMaterial( getUInt() ) );
+			for( unsigned i = 0; i < nfaces; ++i ) {
+				int a = getInt();
+				int b = getInt();
+				int c = getInt();
+				if( !mesh->addFace( a, b, c, getBounds() ) )
+					throw ParseError( "Compiled scene has a bad trimesh face." );
+			}
+			obj = mesh;
+		}
+		break;
+
+	case OBJ_PARTICLES:
+		{
+			double step = getDouble();
+			double radius = getDouble();
+			double initialLife = getDouble();
+			vec3f birth = getVec();
+			vec3f death = getVec();
+			unsigned n = getCount( 7 * sizeof( double ) );
+
+			vector<vec3f> pos( n ), vel( n );
+			vector<double> life( n );
+			for( unsigned i = 0; i < n; ++i ) {
+				pos[i] = getVec();
+				vel[i] = getVec();
+				life[i] = getDouble();
+			}
+
+			ParticleCloud *cloud = new ParticleCloud( m_scene, newMaterial( matId ) );
+			cloud->setRadius( radius );
+			cloud->setParticles( pos, vel, life, step );
+			cloud->setLifeColors( birth, death, initialLife );
+			obj = cloud;
+		}
+		break;
+
+	case OBJ_CSG:
+		{
+			CSGNode *root = getCSGNode();
+			m_scene->addCSGNode( root );
+			obj = new CSG( m_scene, newMaterial( matId ), new CSGTree( root ) );
+		}
+		break;
+
+	default:
+		throw ParseError( "Compiled scene has an unknown object." );
+	}
+
+	obj->setTransform( xform );
+	obj->setOrder( order );
+	return obj;
+}
+
+CSGNode *SceneReader::getCSGNode()
+{
+	CSGNode *node = new CSGNode;
+	if( getUInt() ) {
+		BoundingBox bounds;
+		Geometry *obj = getObject( bounds );
+		obj->setBoundingBox( bounds );
+		node->setIsLeaf( true );
+		node->setObject( obj );
+		m_scene->addCSGObject( obj );
+		m_scene->addCSGNode( node );
+	} else {
+		unsigned relation = getUInt();
+		if( relation < CSG_OR || relation > CSG_MINUS )
+			throw ParseError( "Compiled scene has a bad CSG relation." );
+		node->isLeaf = false;
+		node->relation = (CSG_RELATION)relation;
+		node->lchild = getCSGNode();
+		node->rchild = getCSGNode();
+	}
+	node->computeBoundingBox();
+	return node;
+}
+
+Scene *readCompiledScene( const char *fname )
+{
+	MappedFile file;
+	if( !file.open( fname ) ) {
+		cerr << "Error: couldn't read scene file " << fname << endl;
+		return NULL;
+	}
+
+	// like readScene(), a scene that fails part way is abandoned rather than
+	// deleted: ~Scene only copes with scenes that went through initScene()
+	Scene *scene = new Scene;
+	scene->addSourceFile( fname );
+	SceneReader r( file.begin(), file.end(), scene );
+
+	char magic[ sizeof( s_magic ) ];
+	r.getBytes( magic, sizeof( magic ) );
+	if( memcmp( magic, s_magic, sizeof( s_magic ) ) != 0 )
+		throw ParseError( "Not a compiled scene." );
+	if( r.getUInt() != s_version )
+		throw ParseError( "Compiled scene version mismatch; recompile it." );
+	if( r.getUInt() != s_byteOrder )
+		throw ParseError( "Compiled scene was written on a different byte order." );
+
+	Camera *camera = scene->getCamera();
+	camera->setEye( r.getVec() );
+	camera->setRotation( r.getMat3() );
+	camera->setNormalizedHeight( r.getDouble() );
+	camera->setAspectRatio( r.getDouble() );
+	scene->setAmbient( r.getVec() );
+
+	r.getMaterials();
+	r.getTransforms();
+	r.getLights();
+	r.getPrototypes();
+
+	unsigned n = r.getCount( s_minObjectSize );
+	for( unsigned i = 0; i < n; ++i ) {
+		BoundingBox bounds;
+		Geometry *obj = r.getObject( bounds );
+		scene->add( obj, bounds );
+	}
+	return scene;
+}
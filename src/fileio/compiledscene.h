@@ -0,0 +1,29 @@
+//
+// compiledscene.h
+//
+// A binary snapshot of a parsed scene (".rayb").  Everything the .ray reader
+// derives -- global transforms and their inverses, materials, mesh arrays,
+// object bounds -- is stored resolved, so loading is a straight copy out of a
+// memory-mapped file with no parsing, matrix inversion or bounds recompute.
+//
+// The file is a dump of native doubles and 32-bit ints; it's meant to be
+// produced and consumed on the same kind of machine (the header records the
+// byte order and the loader refuses anything else).
+//
+
+#ifndef COMPILEDSCENE_H
+#define COMPILEDSCENE_H
+
+#include "../scene/scene.h"
+
+// true if the file starts with the compiled scene signature
+bool isCompiledScene( const char *fname );
+
+// write a scene returned by readScene(); returns false on I/O error, or,
+// saying why, if the scene holds an object a compiled scene can't
+bool writeCompiledScene( const char *fname, Scene *scene );
+
+// throws ParseError on a damaged or mismatched file, NULL if it can't be opened
+Scene *readCompiledScene( const char *fname );
+
+#endif // COMPILEDSCENE_H
@@ -0,0 +1,171 @@
+//
+// imagewriter.cpp
+//
+// Row-at-a-time BMP, PPM and PFM output.
+//
+
+#include <string.h>
+#include <ctype.h>
+
+#include "imagewriter.h"
+
+// offsets in a 32k x 32k image run past 2GB
+#ifdef WIN32
+#define fseek64 _fseeki64
+#define ftell64 _ftelli64
+#else
+#define fseek64 fseeko
+#define ftell64 ftello
+#endif
+
+static void putLE( std::string& s, unsigned int v, int bytes )
+{
+	for( int k = 0; k < bytes; ++k )
+		s += (char)( (v >> (8 * k)) & 0xff );
+}
+
+ImageWriter::ImageWriter()
+	: m_file( NULL ), m_format( BMP ), m_width( 0 ), m_height( 0 ),
+	m_rowsDone( 0 ), m_rowBytes( 0 ), m_error( "" )
+{}
+
+// A BMP gives its file size in 32 bits, which one over 4GB overflows.
+static unsigned long long bmpFileSize( int rowBytes, int height )
+{
+	return 14 + 40 + (unsigned long long)rowBytes * height;
+}
+
+ImageWriter::~ImageWriter()
+{
+	close();
+}
+
+std::string ImageWriter::header() const
+{
+	std::string h;
+	char text[64];
+	switch( m_format ) {
+	case PPM:
+		sprintf( text, "P6\n%d %d\n255\n", m_width, m_height );
+		h = text;
+		break;
+
+	case PFM:
+		// a negative scale says the floats are little endian, as they
+		// are on every machine this builds for
+		sprintf( text, "PF\n%d %d\n-1.0\n", m_width, m_height );
+		h = text;
+		break;
+
+	case BMP:
+		// the same 14 byte file header and 40 byte info header writeBMP
+		// writes, with no palette
+		putLE( h, 0x4d42, 2 );	// "BM"
+		putLE( h, (unsigned int)bmpFileSize( m_rowBytes, m_height ), 4 );
+		putLE( h, 0, 4 );
+		putLE( h, 14 + 40, 4 );
+		putLE( h, 40, 4 );
+		putLE( h, m_width, 4 );
+		putLE( h, m_height, 4 );
+		putLE( h, 1, 2 );
+		putLE( h, 24, 2 );
+		putLE( h, 0, 4 );		// BMP_BI_RGB
+		putLE( h, 0, 4 );
+		putLE( h, (int)(100 / 2.54 * 72), 4 );
+		putLE( h, (int)(100 / 2.54 * 72), 4 );
+		putLE( h, 0, 4 );
+		putLE( h, 0, 4 );
+		break;
+	}
+	return h;
+}
+
+bool ImageWriter::open( const char *fname, int width, int height, bool resume )
+{
+	close();
+
+	std::string ext;
+	const char *dot = strrchr( fname, '.' );
+	for( const char *c = dot ? dot + 1 : ""; *c; ++c )
+		ext += (char)tolower( *c );
+
+	if( ext == "ppm" ) {
+		m_format = PPM;
+		m_rowBytes = width * 3;
+	} else if( ext == "pfm" ) {
+		m_format = PFM;
+		m_rowBytes = width * 3 * (int)sizeof( float );
+	} else {
+		m_format = BMP;
+		m_rowBytes = (width * 3 + 3) / 4 * 4;
+	}
+	m_width = width;
+	m_height = height;
+	m_rowsDone = 0;
+	m_error = "";
+
+	if( m_format == BMP && bmpFileSize( m_rowBytes, m_height ) > 0xffffffffull ) {
+		m_error = "the image is too large for a BMP; write a .ppm or .pfm instead";
+		return false;
+	}
+	m_row.assign( m_rowBytes, 0 );
+
+	std::string h = header();
+
+	if( resume && (m_file = fopen( fname, "r+b" )) != NULL ) {
+		// keep the file if it starts with the header this image would
+		// have, and carry on after its last whole row
+		std::vector<char> old( h.size() );
+		if( fread( &old[0], h.size(), 1, m_file ) == 1 && memcmp( &old[0], h.data(), h.size() ) == 0
+			&& fseek64( m_file, 0, SEEK_END ) == 0 ) {
+			long long rows = (ftell64( m_file ) - (long long)h.size()) / m_rowBytes;
+			m_rowsDone = (int)(rows < height ? rows : height);
+			if( fseek64( m_file, (long long)h.size() + (long long)m_rowsDone * m_rowBytes, SEEK_SET ) == 0 )
+				return true;
+		}
+		fclose( m_file );
+		m_rowsDone = 0;
+	}
+
+	if( (m_file = fopen( fname, "wb" )) == NULL ) {
+		m_error = "the file can't be created";
+		return false;
+	}
+	if( fwrite( h.data(), h.size(), 1, m_file ) != 1 ) {
+		close();
+		m_error = "the file can't be written";
+		return false;
+	}
+	return true;
+}
+
+void ImageWriter::close()
+{
+	if( m_file )
+		fclose( m_file );
+	m_file = NULL;
+}
+
+bool ImageWriter::writeRow( const float *rgb )
+{
+	if( !m_file || finished() )
+		return false;
+
+	if( m_format == PFM ) {
+		memcpy( &m_row[0], rgb, m_rowBytes );
+	} else {
+		// BMP keeps its pixels as BGR
+		int r = (m_format == BMP) ? 2 : 0;
+		for( int i = 0; i < m_width; ++i ) {
+			m_row[ i * 3 + r ] = toByte( rgb[ i * 3 ] );
+			m_row[ i * 3 + 1 ] = toByte( rgb[ i * 3 + 1 ] );
+			m_row[ i * 3 + 2 - r ] = toByte( rgb[ i * 3 + 2 ] );
+		}
+	}
+
+	// flushed row by row, so a render that dies keeps what it finished
+	if( fwrite( &m_row[0], m_rowBytes, 1, m_file ) != 1 || fflush( m_file ) != 0 )
+		return false;
+	++m_rowsDone;
+	return true;
+}
@@ -0,0 +1,69 @@
+//
+// imagewriter.h
+//
+// Writes an image to disk a row at a time, in the order the file keeps its
+// rows, so a large render never has to hold the whole image.  The format
+// comes from the name's extension: .bmp, .ppm (8-bit) or .pfm (float).
+// Each is a header followed by rows of one size, so a file that was cut
+// short can be picked up again after its last whole row.
+//
+
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// A linear colour channel as 8 bits: clamped to [0,1], NaN as 0, then
+// scaled.  Everything that shows or saves the framebuffer at 8 bits uses
+// it, so they all agree.
+inline unsigned char toByte( float c )
+{
+	return (unsigned char)(int)( 255.0 * (c > 0.0f ? (c < 1.0f ? c : 1.0f) : 0.0f) );
+}
+
+class ImageWriter
+{
+public:
+	enum Format { BMP, PPM, PFM };
+
+	ImageWriter();
+	~ImageWriter();
+
+	// Start a width x height image.  With resume, a file already there
+	// with the same format and size is kept, and rowsDone() counts its
+	// whole rows; anything else is started afresh.  On failure error()
+	// says why.
+	bool open( const char *fname, int width, int height, bool resume = false );
+	void close();
+	const char *error() const { return m_error; }
+
+	// Rows are numbered as in the framebuffer, from the bottom of the
+	// image.  BMP and PFM store them bottom up, PPM top down.
+	bool bottomUp() const { return m_format != PPM; }
+	int rowsDone() const { return m_rowsDone; }
+	bool finished() const { return m_rowsDone == m_height; }
+	// the row writeRow takes next
+	int nextRow() const { return bottomUp() ? m_rowsDone : m_height - 1 - m_rowsDone; }
+
+	// Append nextRow(); rgb holds width linear colours.
+	bool writeRow( const float *rgb );
+
+private:
+	// not copyable, the file is owned
+	ImageWriter( const ImageWriter& );
+	ImageWriter& operator=( const ImageWriter& );
+
+	std::string header() const;
+
+	FILE *m_file;
+	Format m_format;
+	int m_width, m_height;
+	int m_rowsDone;
+	int m_rowBytes;		// in the file, with any padding
+	const char *m_error;
+	std::vector<unsigned char> m_row;
+};
+
+#endif // IMAGEWRITER_H
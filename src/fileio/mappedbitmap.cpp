@@ -0,0 +1,86 @@
+//
+// mappedbitmap.cpp
+//
+// The headers are read a field at a time from the mapped bytes, little
+// endian, so the structs' padding never comes into it.
+//
+
+#include "mappedbitmap.h"
+#include "bitmap.h"
+
+static BMP_DWORD getLE( const unsigned char *p, int bytes )
+{
+	BMP_DWORD v = 0;
+	for( int k = bytes - 1; k >= 0; --k )
+		v = (v << 8) | p[k];
+	return v;
+}
+
+MappedBitmap::MappedBitmap()
+	: m_rows( NULL ), m_stride( 0 ), m_width( 0 ), m_height( 0 )
+{}
+
+MappedBitmap::~MappedBitmap()
+{
+	close();
+}
+
+bool MappedBitmap::open( const char *fname )
+{
+	close();
+	if( !m_file.open( fname ) )
+		return false;
+
+	// a 14 byte file header, then at least the 40 byte info header
+	const unsigned char *p = (const unsigned char *)m_file.begin();
+	size_t size = m_file.size();
+	bool ok = size >= 14 + 40 && getLE( p, 2 ) == 0x4d42;	// "BM"
+	if( ok ) {
+		BMP_DWORD offBits = getLE( p + 10, 4 );
+		BMP_DWORD infoSize = getLE( p + 14, 4 );
+		BMP_LONG width = (BMP_LONG)getLE( p + 18, 4 );
+		BMP_LONG height = (BMP_LONG)getLE( p + 22, 4 );
+		// a negative height means the rows are stored top down
+		long long rows = (height < 0) ? -(long long)height : height;
+		unsigned long long padWidth = ((unsigned long long)width * 3 + 3) / 4 * 4;
+
+		ok = infoSize >= 40 && offBits >= 14 + (unsigned long long)infoSize
+			&& getLE( p + 28, 2 ) == 24
+			&& getLE( p + 30, 4 ) == BMP_BI_RGB
+			&& width > 0 && rows > 0 && rows <= 0x7fffffff
+			&& offBits + padWidth * rows <= size;
+		if( ok ) {
+			m_width = width;
+			m_height = (int)rows;
+			if( height > 0 ) {
+				m_rows = p + offBits;
+				m_stride = (ptrdiff_t)padWidth;
+			} else {
+				m_rows = p + offBits + (size_t)(padWidth * (rows - 1));
+				m_stride = -(ptrdiff_t)padWidth;
+			}
+		}
+	}
+
+	if( !ok )
+		close();
+	return ok;
+}
+
+void MappedBitmap::close()
+{
+	m_file.close();
+	m_rows = NULL;
+	m_stride = 0;
+	m_width = m_height = 0;
+}
+
+void MappedBitmap::rgbRow( int y, unsigned char *out ) const
+{
+	const unsigned char *in = row( y );
+	for( int i = 0; i < m_width; ++i, in += 3, out += 3 ) {
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+	}
+}
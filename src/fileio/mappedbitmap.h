@@ -0,0 +1,51 @@
+//
+// mappedbitmap.h
+//
+// A 24-bit BMP read in place: the file is mapped into memory and its
+// rows are used where they lie, still padded and in BGR order, so even a
+// very large image is never copied.  Everything about one file is kept in
+// its own object, so any number can be open at once, on any threads.
+//
+
+#ifndef MAPPEDBITMAP_H
+#define MAPPEDBITMAP_H
+
+#include <stddef.h>
+
+#include "mmapfile.h"
+
+class MappedBitmap
+{
+public:
+	MappedBitmap();
+	~MappedBitmap();
+
+	// Map fname and check its headers; false, leaving nothing open, if it
+	// is not an uncompressed 24-bit BMP holding all its rows.
+	bool open( const char *fname );
+	void close();
+	bool isOpen() const { return m_file.isOpen(); }
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// Row y, counted from the bottom as readBMP counts them, whichever
+	// way the file stores them: width BGR triples.  Valid until close().
+	const unsigned char *row( int y ) const { return m_rows + (ptrdiff_t)y * m_stride; }
+	// channel c of pixel (x, y): 0 red, 1 green, 2 blue
+	unsigned char channel( int x, int y, int c ) const { return row( y )[ x * 3 + 2 - c ]; }
+	// row y as RGB triples, into width * 3 bytes at out
+	void rgbRow( int y, unsigned char *out ) const;
+
+private:
+	// not copyable, the mapping is owned
+	MappedBitmap( const MappedBitmap& );
+	MappedBitmap& operator=( const MappedBitmap& );
+
+	MappedFile m_file;
+	const unsigned char *m_rows;	// the bottom row
+	ptrdiff_t m_stride;				// bytes from one row up to the next
+	int m_width, m_height;
+};
+
+#endif // MAPPEDBITMAP_H
@@ -0,0 +1,640 @@
+#ifdef WIN32
+#pragma warning( disable : 4786 )
+#endif
+
+#include <cstring>
+#include <cstdlib>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "meshio.h"
+#include "mmapfile.h"
+#include "parse.h"
+#include "../SceneObjects/trimesh.h"
+
+// Files smaller than this are read on the calling thread; bigger ones are
+// split so that each worker gets at least this much.
+static const size_t s_minChunk = 1 << 20;
+
+// The mesh as read, before it's handed over to the Trimesh.
+struct MeshData
+{
+	vector<vec3f> vertices;
+	vector<vec3f> normals;		// one per vertex, or empty
+	vector<int> triangles;		// three vertex indices per face
+};
+
+static unsigned workerCount( size_t bytes )
+{
+	unsigned n = thread::hardware_concurrency();
+	if( n == 0 )
+		n = 1;
+	size_t chunks = bytes / s_minChunk + 1;
+	return chunks < n ? (unsigned)chunks : n;
+}
+
+// Run job(0) .. job(n-1), job(0) on the calling thread, and pass on the
+// first ParseError once they've all finished.
+template<class Job>
+static void runParallel( unsigned n, Job job )
+{
+	vector<future<void>> workers;
+	for( unsigned i = 1; i < n; ++i )
+		workers.push_back( async( launch::async, job, i ) );
+
+	bool failed = false;
+	string msg;
+	try {
+		job( 0 );
+	} catch( ParseError& pe ) {
+		failed = true;
+		msg = pe.getMsg();
+	}
+	for( size_t i = 0; i < workers.size(); ++i ) {
+		try {
+			workers[i].get();
+		} catch( ParseError& pe ) {
+			if( !failed ) {
+				failed = true;
+				msg = pe.getMsg();
+			}
+		}
+	}
+
+	if( failed )
+		throw ParseError( msg );
+}
+
+//
+// Wavefront OBJ
+//
+// Two passes over line-aligned chunks of the file, both in parallel.  The
+// first counts records per chunk; prefix sums of the counts then give each
+// chunk its own slice of the arrays (and the running vertex count that
+// negative, relative indices need), so the second pass writes in place.
+//
+
+struct ObjChunk
+{
+	const char *begin, *end;
+	size_t verts, norms, tris;				// counted by the first pass
+	size_t vertBase, normBase, triBase;		// where this chunk's records go
+};
+
+static inline bool isBlank( char ch )
+{
+	return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static inline const char *skipBlanks( const char *p, const char *e )
+{
+	while( p < e && isBlank( *p ) )
+		++p;
+	return p;
+}
+
+static inline const char *tokenEnd( const char *p, const char *e )
+{
+	while( p < e && !isBlank( *p ) )
+		++p;
+	return p;
+}
+
+enum ObjRecord { OBJ_OTHER, OBJ_VERTEX, OBJ_NORMAL, OBJ_FACE };
+
+// classify a line and leave p just past the keyword
+static ObjRecord objRecord( const char *&p, const char *e )
+{
+	p = skipBlanks( p, e );
+	if( e - p >= 2 && p[0] == 'v' && isBlank( p[1] ) ) {
+		p += 2;
+		return OBJ_VERTEX;
+	}
+	if( e - p >= 3 && p[0] == 'v' && p[1] == 'n' && isBlank( p[2] ) ) {
+		p += 3;
+		return OBJ_NORMAL;
+	}
+	if( e - p >= 2 && p[0] == 'f' && isBlank( p[1] ) ) {
+		p += 2;
+		return OBJ_FACE;
+	}
+	return OBJ_OTHER;
+}
+
+static inline const char *lineEnd( const char *p, const char *e )
+{
+	const char *nl = (const char *)memchr( p, '\n', e - p );
+	return nl ? nl : e;
+}
+
+static void countObjChunk( ObjChunk& c )
+{
+	c.verts = c.norms = c.tris = 0;
+	for( const char *p = c.begin; p < c.end; ) {
+		const char *e = lineEnd( p, c.end );
+		switch( objRecord( p, e ) ) {
+		case OBJ_VERTEX:
+			++c.verts;
+			break;
+		case OBJ_NORMAL:
+			++c.norms;
+			break;
+		case OBJ_FACE:
+			{
+				size_t corners = 0;
+				for( p = skipBlanks( p, e ); p < e; p = skipBlanks( tokenEnd( p, e ), e ) )
+					++corners;
+				if( corners < 3 )
+					throw ParseError( "Faces must have at least 3 vertices." );
+				c.tris += corners - 2;
+			}
+			break;
+		default:
+			break;
+		}
+		p = (e < c.end) ? e + 1 : c.end;
+	}
+}
+
+// reads a signed integer, stopping at the first non-digit
+static inline long readIndex( const char *&p, const char *e )
+{
+	bool neg = false;
+	if( p < e && (*p == '-' || *p == '+') ) {
+		neg = (*p == '-');
+		++p;
+	}
+	long v = 0;
+	for( ; p < e && *p >= '0' && *p <= '9'; ++p )
+		v = v * 10 + (*p - '0');
+	return neg ? -v : v;
+}
+
+// OBJ indices start at 1; negative ones count back from the last record read
+static inline int resolveIndex( long i, size_t seen, size_t total )
+{
+	long r = (i > 0) ? i - 1 : (long)seen + i;
+	if( i == 0 || r < 0 || (size_t)r >= total )
+		throw ParseError( "Bad index in face." );
+	return (int)r;
+}
+
+static void fillObjChunk( const ObjChunk& c, MeshData& mesh, vector<vec3f>& normals,
+	vector<int>& cornerNormals )
+{
+	size_t nverts = mesh.vertices.size();
+	size_t nnorms = normals.size();
+	size_t v = c.vertBase;
+	size_t n = c.normBase;
+	size_t t = c.triBase * 3;
+	vector<int> corners, cornerN;
+
+	for( const char *p = c.begin; p < c.end; ) {
+		const char *e = lineEnd( p, c.end );
+		ObjRecord rec = objRecord( p, e );
+
+		if( rec == OBJ_VERTEX || rec == OBJ_NORMAL ) {
+			double xyz[3];
+			for( int k = 0; k < 3; ++k ) {
+				p = skipBlanks( p, e );
+				const char *te = tokenEnd( p, e );
+				if( p == te )
+					throw ParseError( "Expected three coordinates." );
+				xyz[k] = parseScalar( p, te );
+				p = te;
+			}
+			if( rec == OBJ_VERTEX )
+				mesh.vertices[ v++ ] = vec3f( xyz[0], xyz[1], xyz[2] );
+			else
+				normals[ n++ ] = vec3f( xyz[0], xyz[1], xyz[2] );
+		} else if( rec == OBJ_FACE ) {
+			// v, v/vt, v//vn or v/vt/vn
+			corners.clear();
+			cornerN.clear();
+			for( p = skipBlanks( p, e ); p < e; p = skipBlanks( p, e ) ) {
+				const char *te = tokenEnd( p, e );
+				corners.push_back( resolveIndex( readIndex( p, te ), v, nverts ) );
+				int ni = -1;
+				if( p < te && *p == '/' ) {
+					++p;
+					readIndex( p, te );
+					if( p < te && *p == '/' ) {
+						++p;
+						if( p < te )
+							ni = resolveIndex( readIndex( p, te ), n, nnorms );
+					}
+				}
+				cornerN.push_back( ni );
+				p = te;
+			}
+
+			// fan, the same as inline trimesh faces
+			for( size_t k = 2; k < corners.size(); ++k ) {
+				if( !cornerNormals.empty() ) {
+					cornerNormals[ t ] = cornerN[0];
+					cornerNormals[ t + 1 ] = cornerN[k - 1];
+					cornerNormals[ t + 2 ] = cornerN[k];
+				}
+				mesh.triangles[ t++ ] = corners[0];
+				mesh.triangles[ t++ ] = corners[k - 1];
+				mesh.triangles[ t++ ] = corners[k];
+			}
+		}
+		p = (e < c.end) ? e + 1 : c.end;
+	}
+}
+
+static void readObj( const char *begin, const char *end, MeshData& mesh )
+{
+	unsigned n = workerCount( end - begin );
+
+	vector<ObjChunk> chunks( n );
+	const char *p = begin;
+	for( unsigned i = 0; i < n; ++i ) {
+		ObjChunk& c = chunks[i];
+		c.begin = p;
+		if( i == n - 1 ) {
+			c.end = end;
+		} else {
+			// end just past the newline at or after the even split point
+			const char *split = begin + (end - begin) / n * (i + 1);
+			if( split < p ) {
+				c.end = p;
+			} else {
+				c.end = lineEnd( split, end );
+				if( c.end < end )
+					++c.end;
+			}
+		}
+		p = c.end;
+	}
+
+	runParallel( n, [&chunks]( unsigned i ) { countObjChunk( chunks[i] ); } );
+
+	size_t verts = 0, norms = 0, tris = 0;
+	for( unsigned i = 0; i < n; ++i ) {
+		chunks[i].vertBase = verts;
+		chunks[i].normBase = norms;
+		chunks[i].triBase = tris;
+		verts += chunks[i].verts;
+		norms += chunks[i].norms;
+		tris += chunks[i].tris;
+	}
+
+	vector<vec3f> normals( norms );
+	vector<int> cornerNormals( norms ? tris * 3 : 0 );
+	mesh.vertices.resize( verts );
+	mesh.triangles.resize( tris * 3 );
+
+	runParallel( n, [&]( unsigned i ) {
+		fillObjChunk( chunks[i], mesh, normals, cornerNormals );
+	} );
+
+	// Trimesh normals are per vertex.  Use the file's if every corner has
+	// one; a vertex shared by corners with different normals keeps the last.
+	if( norms ) {
+		for( size_t k = 0; k < cornerNormals.size(); ++k ) {
+			if( cornerNormals[k] < 0 )
+				return;
+		}
+		mesh.normals.resize( verts );
+		for( size_t k = 0; k < cornerNormals.size(); ++k )
+			mesh.normals[ mesh.triangles[k] ] = normals[ cornerNormals[k] ];
+	}
+}
+
+//
+// binary little-endian PLY
+//
+
+enum PlyType {
+	PLY_NONE, PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16,
+	PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64
+};
+
+struct PlyProperty
+{
+	string name;
+	PlyType type;
+	PlyType countType;		// PLY_NONE unless this is a list
+};
+
+struct PlyElement
+{
+	string name;
+	size_t count;
+	vector<PlyProperty> props;
+};
+
+static PlyType plyType( const string& s )
+{
+	if( s == "char" || s == "int8" )		return PLY_INT8;
+	if( s == "uchar" || s == "uint8" )		return PLY_UINT8;
+	if( s == "short" || s == "int16" )		return PLY_INT16;
+	if( s == "ushort" || s == "uint16" )	return PLY_UINT16;
+	if( s == "int" || s == "int32" )		return PLY_INT32;
+	if( s == "uint" || s == "uint32" )		return PLY_UINT32;
+	if( s == "float" || s == "float32" )	return PLY_FLOAT32;
+	if( s == "double" || s == "float64" )	return PLY_FLOAT64;
+	throw ParseError( "Unknown PLY property type " + s + "." );
+}
+
+static size_t plySize( PlyType t )
+{
+	switch( t ) {
+	case PLY_INT8: case PLY_UINT8:		return 1;
+	case PLY_INT16: case PLY_UINT16:	return 2;
+	case PLY_INT32: case PLY_UINT32:
+	case PLY_FLOAT32:					return 4;
+	case PLY_FLOAT64:					return 8;
+	default:							return 0;
+	}
+}
+
+// the data may be unaligned, so everything goes through memcpy
+static inline double plyValue( const char *p, PlyType t )
+{
+	switch( t ) {
+	case PLY_INT8:		{ signed char v; memcpy( &v, p, 1 ); return v; }
+	case PLY_UINT8:		{ unsigned char v; memcpy( &v, p, 1 ); return v; }
+	case PLY_INT16:		{ short v; memcpy( &v, p, 2 ); return v; }
+	case PLY_UINT16:	{ unsigned short v; memcpy( &v, p, 2 ); return v; }
+	case PLY_INT32:		{ int v; memcpy( &v, p, 4 ); return v; }
+	case PLY_UINT32:	{ unsigned v; memcpy( &v, p, 4 ); return v; }
+	case PLY_FLOAT32:	{ float v; memcpy( &v, p, 4 ); return v; }
+	case PLY_FLOAT64:	{ double v; memcpy( &v, p, 8 ); return v; }
+	default:			return 0.0;
+	}
+}
+
+// bytes per record, or 0 if the element has list properties
+static size_t fixedStride( const PlyElement& el )
+{
+	size_t stride = 0;
+	for( size_t i = 0; i < el.props.size(); ++i ) {
+		if( el.props[i].countType != PLY_NONE )
+			return 0;
+		stride += plySize( el.props[i].type );
+	}
+	return stride;
+}
+
+// step over one record of an element with list properties
+static const char *skipRecord( const PlyElement& el, const char *p, const char *end )
+{
+	for( size_t i = 0; i < el.props.size(); ++i ) {
+		const PlyProperty& prop = el.props[i];
+		size_t n = 1;
+		if( prop.countType != PLY_NONE ) {
+			if( (size_t)(end - p) < plySize( prop.countType ) )
+				throw ParseError( "PLY file is truncated." );
+			n = (size_t)plyValue( p, prop.countType );
+			p += plySize( prop.countType );
+		}
+		if( (size_t)(end - p) < n * plySize( prop.type ) )
+			throw ParseError( "PLY file is truncated." );
+		p += n * plySize( prop.type );
+	}
+	return p;
+}
+
+static const char *skipElement( const PlyElement& el, const char *p, const char *end )
+{
+	size_t stride = fixedStride( el );
+	if( stride ) {
+		if( (size_t)(end - p) / stride < el.count )
+			throw ParseError( "PLY file is truncated." );
+		return p + stride * el.count;
+	}
+	for( size_t i = 0; i < el.count; ++i )
+		p = skipRecord( el, p, end );
+	return p;
+}
+
+static const char *readPlyHeader( const char *begin, const char *end, vector<PlyElement>& elements )
+{
+	const char *p = begin;
+	bool format = false;
+
+	while( true ) {
+		if( p >= end )
+			throw ParseError( "PLY header has no end_header." );
+		const char *e = lineEnd( p, end );
+		istringstream line( string( p, e ) );
+		p = (e < end) ? e + 1 : e;
+
+		string word;
+		if( !(line >> word) || word == "comment" || word == "obj_info" || word == "ply" )
+			continue;
+
+		if( word == "end_header" ) {
+			break;
+		} else if( word == "format" ) {
+			string kind;
+			line >> kind;
+			if( kind != "binary_little_endian" )
+				throw ParseError( "Only binary_little_endian PLY files are supported." );
+			format = true;
+		} else if( word == "element" ) {
+			PlyElement el;
+			if( !(line >> el.name >> el.count) )
+				throw ParseError( "Bad PLY element." );
+			elements.push_back( el );
+		} else if( word == "property" ) {
+			if( elements.empty() )
+				throw ParseError( "PLY property outside an element." );
+			PlyProperty prop;
+			string type;
+			line >> type;
+			prop.countType = PLY_NONE;
+			if( type == "list" ) {
+				string countType;
+				line >> countType >> type;
+				prop.countType = plyType( countType );
+			}
+			prop.type = plyType( type );
+			if( !(line >> prop.name) )
+				throw ParseError( "Bad PLY property." );
+			elements.back().props.push_back( prop );
+		} else {
+			throw ParseError( "Unknown PLY header line " + word + "." );
+		}
+	}
+
+	if( !format )
+		throw ParseError( "PLY header has no format." );
+	return p;
+}
+
+static const char *readPlyVertices( const PlyElement& el, const char *p, const char *end,
+	MeshData& mesh )
+{
+	size_t stride = fixedStride( el );
+	if( !stride )
+		throw ParseError( "PLY vertices can't have list properties." );
+	if( (size_t)(end - p) / stride < el.count )
+		throw ParseError( "PLY file is truncated." );
+
+	// x y z and optional nx ny nz
+	const char *names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+	int offset[6];
+	PlyType type[6];
+	size_t off = 0;
+	for( int k = 0; k < 6; ++k )
+		offset[k] = -1;
+	for( size_t i = 0; i < el.props.size(); ++i ) {
+		for( int k = 0; k < 6; ++k ) {
+			if( el.props[i].name == names[k] ) {
+				offset[k] = (int)off;
+				type[k] = el.props[i].type;
+			}
+		}
+		off += plySize( el.props[i].type );
+	}
+	if( offset[0] < 0 || offset[1] < 0 || offset[2] < 0 )
+		throw ParseError( "PLY vertices need x, y and z." );
+	bool hasNormals = offset[3] >= 0 && offset[4] >= 0 && offset[5] >= 0;
+
+	mesh.vertices.resize( el.count );
+	if( hasNormals )
+		mesh.normals.resize( el.count );
+
+	unsigned n = workerCount( stride * el.count );
+	size_t count = el.count;
+	runParallel( n, [&]( unsigned w ) {
+		size_t first = count * w / n;
+		size_t last = count * (w + 1) / n;
+		const char *rec = p + first * stride;
+		for( size_t i = first; i < last; ++i, rec += stride ) {
+			mesh.vertices[i] = vec3f( plyValue( rec + offset[0], type[0] ),
+				plyValue( rec + offset[1], type[1] ),
+				plyValue( rec + offset[2], type[2] ) );
+			if( hasNormals ) {
+				mesh.normals[i] = vec3f( plyValue( rec + offset[3], type[3] ),
+					plyValue( rec + offset[4], type[4] ),
+					plyValue( rec + offset[5], type[5] ) );
+			}
+		}
+	} );
+
+	return p + stride * el.count;
+}
+
+// Face records are variable length, so they're walked in order: once to
+// count the triangles, then again to fill the pre-sized index array.
+static const char *readPlyFaces( const PlyElement& el, const char *p, const char *end,
+	MeshData& mesh )
+{
+	int list = -1;
+	for( size_t i = 0; i < el.props.size(); ++i ) {
+		const PlyProperty& prop = el.props[i];
+		if( prop.countType != PLY_NONE
+			&& (prop.name == "vertex_indices" || prop.name == "vertex_index") )
+			list = (int)i;
+	}
+	if( list < 0 )
+		return skipElement( el, p, end );
+
+	const PlyProperty& prop = el.props[list];
+	size_t countSize = plySize( prop.countType );
+	size_t indexSize = plySize( prop.type );
+
+	// everything before and after the index list in a record
+	PlyElement before, after;
+	before.props.assign( el.props.begin(), el.props.begin() + list );
+	after.props.assign( el.props.begin() + list + 1, el.props.end() );
+
+	size_t tris = 0;
+	const char *q = p;
+	for( size_t f = 0; f < el.count; ++f ) {
+		q = skipRecord( before, q, end );
+		if( (size_t)(end - q) < countSize )
+			throw ParseError( "PLY file is truncated." );
+		size_t corners = (size_t)plyValue( q, prop.countType );
+		if( corners < 3 )
+			throw ParseError( "Faces must have at least 3 vertices." );
+		q += countSize;
+		if( (size_t)(end - q) / indexSize < corners )
+			throw ParseError( "PLY file is truncated." );
+		q = skipRecord( after, q + corners * indexSize, end );
+		tris += corners - 2;
+	}
+
+	double nverts = (double)mesh.vertices.size();
+	mesh.triangles.resize( tris * 3 );
+	int *t = mesh.triangles.empty() ? NULL : &mesh.triangles[0];
+	for( size_t f = 0; f < el.count; ++f ) {
+		p = skipRecord( before, p, end );
+		size_t corners = (size_t)plyValue( p, prop.countType );
+		p += countSize;
+
+		double a = plyValue( p, prop.type );
+		double b = plyValue( p + indexSize, prop.type );
+		if( a < 0 || a >= nverts || b < 0 || b >= nverts )
+			throw ParseError( "Bad index in face." );
+		for( size_t k = 2; k < corners; ++k ) {
+			double c = plyValue( p + k * indexSize, prop.type );
+			if( c < 0 || c >= nverts )
+				throw ParseError( "Bad index in face." );
+			*t++ = (int)a;
+			*t++ = (int)b;
+			*t++ = (int)c;
+			b = c;
+		}
+		p = skipRecord( after, p + corners * indexSize, end );
+	}
+	return p;
+}
+
+static void readPly( const char *begin, const char *end, MeshData& mesh )
+{
+	const unsigned probe = 1;
+	if( *(const unsigned char *)&probe != 1 )
+		throw ParseError( "PLY files are only read on little-endian machines." );
+
+	vector<PlyElement> elements;
+	const char *p = readPlyHeader( begin, end, elements );
+
+	bool vertices = false;
+	for( size_t i = 0; i < elements.size(); ++i ) {
+		const PlyElement& el = elements[i];
+		if( el.name == "vertex" ) {
+			p = readPlyVertices( el, p, end, mesh );
+			vertices = true;
+		} else if( el.name == "face" ) {
+			if( !vertices )
+				throw ParseError( "PLY faces must come after the vertices." );
+			p = readPlyFaces( el, p, end, mesh );
+		} else {
+			p = skipElement( el, p, end );
+		}
+	}
+}
+
+void readMeshFile( const string& fname, Trimesh *mesh )
+{
+	MappedFile file;
+	if( !file.open( fname.c_str() ) )
+		throw ParseError( "Couldn't open mesh file " + fname + "." );
+
+	MeshData data;
+	try {
+		const char *b = file.begin();
+		if( file.size() >= 4 && memcmp( b, "ply", 3 ) == 0 && (b[3] == '\n' || b[3] == '\r') )
+			readPly( b, file.end(), data );
+		else
+			readObj( b, file.end(), data );
+	} catch( ParseError& pe ) {
+		throw ParseError( fname + ": " + pe.getMsg() );
+	}
+
+	mesh->swapVertices( data.vertices );
+	mesh->swapNormals( data.normals );
+	mesh->reserveFaces( data.triangles.size() / 3 );
+	for( size_t i = 0; i < data.triangles.size(); i += 3 ) {
+		if( !mesh->addFace( data.triangles[i], data.triangles[i + 1], data.triangles[i + 2] ) )
+			throw ParseError( fname + ": Bad face in trimesh." );
+	}
+}
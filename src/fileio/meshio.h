@@ -0,0 +1,24 @@
+//
+// meshio.h
+//
+// Readers for external mesh files, referenced from a scene as
+//
+//     trimesh { file = "model.ply"; material = { ... }; }
+//
+// Wavefront OBJ (v, vn and f records; everything else is skipped) and
+// binary little-endian PLY are understood.  Both map the file, size each
+// mesh array once, and split large files across threads.
+//
+
+#ifndef MESHIO_H
+#define MESHIO_H
+
+#include <string>
+
+class Trimesh;
+
+// Fill mesh's vertices, normals and faces from fname.  PLY is recognized
+// by its header, anything else is read as OBJ.  Throws ParseError.
+void readMeshFile( const std::string& fname, Trimesh *mesh );
+
+#endif // MESHIO_H
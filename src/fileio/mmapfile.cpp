@@ -0,0 +1,130 @@
+//
+// mmapfile.cpp
+//
+// Win32 and POSIX implementations of MappedFile.
+//
+
+#include "mmapfile.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+MappedFile::MappedFile()
+	: m_data( NULL ), m_size( 0 ), m_bOpen( false )
+#ifdef WIN32
+	, m_hFile( INVALID_HANDLE_VALUE ), m_hMapping( NULL )
+#else
+	, m_fd( -1 )
+#endif
+{}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef WIN32
+
+bool MappedFile::open( const char *fname )
+{
+	close();
+
+	m_hFile = CreateFileA( fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if( m_hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER size;
+	if( !GetFileSizeEx( m_hFile, &size ) ) {
+		close();
+		return false;
+	}
+
+	m_size = (size_t)size.QuadPart;
+	m_bOpen = true;
+	if( m_size == 0 )
+		return true;		// nothing to map, but that's not an error
+
+	m_hMapping = CreateFileMappingA( m_hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+	if( m_hMapping == NULL ) {
+		close();
+		return false;
+	}
+
+	m_data = (const char *)MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 );
+	if( m_data == NULL ) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if( m_data )
+		UnmapViewOfFile( m_data );
+	if( m_hMapping )
+		CloseHandle( m_hMapping );
+	if( m_hFile != INVALID_HANDLE_VALUE )
+		CloseHandle( m_hFile );
+
+	m_data = NULL;
+	m_size = 0;
+	m_bOpen = false;
+	m_hMapping = NULL;
+	m_hFile = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::open( const char *fname )
+{
+	close();
+
+	m_fd = ::open( fname, O_RDONLY );
+	if( m_fd < 0 )
+		return false;
+
+	struct stat st;
+	if( fstat( m_fd, &st ) != 0 ) {
+		close();
+		return false;
+	}
+
+	m_size = (size_t)st.st_size;
+	m_bOpen = true;
+	if( m_size == 0 )
+		return true;		// nothing to map, but that's not an error
+
+	void *p = mmap( NULL, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0 );
+	if( p == MAP_FAILED ) {
+		close();
+		return false;
+	}
+	madvise( p, m_size, MADV_SEQUENTIAL );
+
+	m_data = (const char *)p;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if( m_data )
+		munmap( (void *)m_data, m_size );
+	if( m_fd >= 0 )
+		::close( m_fd );
+
+	m_data = NULL;
+	m_size = 0;
+	m_bOpen = false;
+	m_fd = -1;
+}
+
+#endif
@@ -0,0 +1,46 @@
+//
+// mmapfile.h
+//
+// A read-only memory mapping of a whole file.  The scene and mesh readers
+// scan the mapped bytes directly instead of pulling characters through an
+// istream.
+//
+
+#ifndef MMAPFILE_H
+#define MMAPFILE_H
+
+#include <stddef.h>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// map the named file; returns false if it can't be opened or mapped.
+	// An empty file maps successfully with size() == 0.
+	bool open( const char *fname );
+	void close();
+
+	bool isOpen() const { return m_bOpen; }
+	const char *begin() const { return m_data; }
+	const char *end() const { return m_data + m_size; }
+	size_t size() const { return m_size; }
+
+private:
+	// not copyable, the mapping is owned
+	MappedFile( const MappedFile& );
+	MappedFile& operator=( const MappedFile& );
+
+	const char *m_data;
+	size_t m_size;
+	bool m_bOpen;
+#ifdef WIN32
+	void *m_hFile;
+	void *m_hMapping;
+#else
+	int m_fd;
+#endif
+};
+
+#endif // MMAPFILE_H
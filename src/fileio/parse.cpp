@@ -5,187 +5,319 @@
 #endif
 
 #include <cstring>
+#include <cstdlib>
 
 #include "parse.h"
 
-static string readID( istream& is );
-static Obj *readString( istream& is );
-static Obj *readScalar( istream& is );
-static Obj *readTuple( istream& is );
-static Obj *readDict( istream& is );
-static Obj *readObject( istream& is );
-static Obj *readName( istream& is );
-static void eatWS( istream& is );
-static void eatNL( istream& is );
-
-Obj *readFile( istream& is )
+// The tokenizer works directly on the scene bytes (see ParseBuffer).
+// Nothing is copied except identifiers and strings, and numbers are
+// converted in place.
+
+static string readID( ParseBuffer& pb );
+static Obj *readString( ParseBuffer& pb );
+static Obj *readScalar( ParseBuffer& pb );
+static Obj *readTuple( ParseBuffer& pb );
+static Obj *readScalarRows( ParseBuffer& pb );
+static Obj *readDict( ParseBuffer& pb );
+static Obj *readObject( ParseBuffer& pb );
+static Obj *readName( ParseBuffer& pb );
+static void eatWS( ParseBuffer& pb );
+static void eatNL( ParseBuffer& pb );
+
+Obj *readFile( ParseBuffer& pb )
 {
-	return readObject( is );
+	return readObject( pb );
 }
 
-static void eatWS( istream& is )
+// -1 at the end of the buffer, like istream::peek()
+static inline int peek( const ParseBuffer& pb )
 {
-	int ch = is.peek();
-	while( ch == ' ' || ch == '\t' || ch == '\n' || ch == 0x0D || ch == 0x0A) {
-		is.get();
-		if( !is ) {
-			return;
-		}
-		ch = is.peek();
-	}
+	return pb.cur < pb.end ? (unsigned char)*pb.cur : -1;
+}
+
+static inline int get( ParseBuffer& pb )
+{
+	return pb.cur < pb.end ? (unsigned char)*pb.cur++ : -1;
 }
 
-static void eatNL( istream& is )
+static inline bool isScalarChar( int ch )
 {
-	int ch = is.peek();
-	while( ch != '\n' ) {
-		is.get();
-		if( !is ) {
+	return (ch >= '0' && ch <= '9') || ch == '-' || ch == '+' || ch == '.'
+		|| ch == 'e' || ch == 'E';
+}
+
+static void eatWS( ParseBuffer& pb )
+{
+	while( pb.cur < pb.end ) {
+		char ch = *pb.cur;
+		if( ch != ' ' && ch != '\t' && ch != '\n' && ch != 0x0D ) {
 			return;
 		}
-		ch = is.peek();
+		++pb.cur;
 	}
 }
 
-static bool eat( istream& is ) 
+static void eatNL( ParseBuffer& pb )
 {
-	while( is ) {
-		eatWS( is );
-		if( is ) {
-			int ch = is.peek();
-			if( ch == '/' ) {
-				is.get();
-				int ch = is.peek();
-				if( ch == '/' ) {
-					eatNL( is );
-				} else if( ch == '*' ) {
-					while( true ) {
-						is.get();
-						ch = is.peek();
-						if( ch == '*' ) {
-							is.get();
-							ch = is.peek();
-							if( ch == '/' ) {
-								is.get();
-								break;
-							} else if( ch == -1 ) {	
-								is.get();
-								throw ParseError( 
-									"Parse Error: unterminated comment" );
-							}
-						} else if( ch == -1 ) {
-							is.get();
-							throw ParseError( 
-								"Parse Error: unterminated comment" );
-						}
-					}
-				} else {
-					return true;
+	const char *nl = (const char *)memchr( pb.cur, '\n', pb.end - pb.cur );
+	pb.cur = nl ? nl : pb.end;
+}
+
+static bool eat( ParseBuffer& pb )
+{
+	while( true ) {
+		eatWS( pb );
+		int ch = peek( pb );
+		if( ch == -1 ) {
+			return false;
+		}
+		if( ch != '/' ) {
+			return true;
+		}
+
+		++pb.cur;
+		ch = peek( pb );
+		if( ch == '/' ) {
+			eatNL( pb );
+		} else if( ch == '*' ) {
+			++pb.cur;
+			while( true ) {
+				const char *star = (const char *)memchr( pb.cur, '*', pb.end - pb.cur );
+				if( !star || star + 1 >= pb.end ) {
+					pb.cur = pb.end;
+					throw ParseError(
+						"Parse Error: unterminated comment" );
+				}
+				pb.cur = star + 1;
+				if( *pb.cur == '/' ) {
+					++pb.cur;
+					break;
 				}
-			} else if( ch == -1 ) {
-				is.get();
-				return false;
-			} else {
-				return true;
 			}
 		} else {
-			return false;
+			return true;
 		}
 	}
-	return false;
 }
 
-static Obj *readName( istream& is )
+static Obj *readName( ParseBuffer& pb )
 {
-	string s = readID( is );
+	string s = readID( pb );
 
 	if( s == "true" ) {
 		return new BooleanObj( true );
 	} else if( s == "false" ) {
 		return new BooleanObj( false );
 	} else {
-		if( !eat( is ) ) {
+		if( !eat( pb ) ) {
 			return new IdObj( s );
 		}
 
-		int ch = is.peek();
+		int ch = peek( pb );
 		if( strchr( "}),;", ch ) != NULL ) {
 			return new IdObj( s );
 		} else {
-			return new NamedObj( s, readObject( is ) );
+			return new NamedObj( s, readObject( pb ) );
 		}
 	}
 }
 
-static string readID( istream& is )
+static string readID( ParseBuffer& pb )
 {
-	int ch;
-	string ret( "" );
-
-	ret += char( is.get() );
+	const char *start = pb.cur;
 
-	while( is ) {
-		ch = is.peek();
-		if( strchr( " \t\n={}();,/", ch ) != NULL ) {
+	++pb.cur;
+	while( pb.cur < pb.end ) {
+		if( strchr( " \t\r\n={}();,/", *pb.cur ) != NULL ) {
 			break;
-		} else {
-			ret += char( ch );
-			is.get();
 		}
+		++pb.cur;
 	}
 
-	return ret;
+	return string( start, pb.cur );
 }
 
-static Obj *readString( istream& is ) 
+static Obj *readString( ParseBuffer& pb )
 {
-	int ch;
-	string ret( "" );
+	++pb.cur;
 
-	is.get();
+	const char *start = pb.cur;
+	const char *quote = (const char *)memchr( pb.cur, '"', pb.end - pb.cur );
+	if( !quote ) {
+		pb.cur = pb.end;
+		throw ParseError( "Parse error: unterminated string." );
+	}
 
-	while( true ) {
-		ch = is.peek();
-		if( ch == '"' ) {
-			is.get();
-			return new StringObj( ret );
+	pb.cur = quote + 1;
+	return new StringObj( string( start, quote ) );
+}
+
+// Exactly representable powers of ten.  A decimal with at most 15
+// significant digits and an exponent in this range converts with a single
+// correctly rounded multiply or divide.
+static const double s_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+double parseScalar( const char *b, const char *e )
+{
+	const char *p = b;
+	bool neg = false;
+	if( p < e && (*p == '-' || *p == '+') ) {
+		neg = (*p == '-');
+		++p;
+	}
+
+	unsigned long long mant = 0;
+	int digits = 0;
+	int exp10 = 0;
+	bool any = false;
+
+	for( ; p < e && *p >= '0' && *p <= '9'; ++p ) {
+		any = true;
+		if( digits < 19 ) {
+			mant = mant * 10 + (*p - '0');
+			if( mant ) ++digits;
 		} else {
-			ret += char( ch );
+			++exp10;
+			digits = 20;	// too many digits for the fast path
 		}
-		is.get();
 	}
+	if( p < e && *p == '.' ) {
+		for( ++p; p < e && *p >= '0' && *p <= '9'; ++p ) {
+			any = true;
+			if( digits < 19 ) {
+				mant = mant * 10 + (*p - '0');
+				if( mant ) ++digits;
+				--exp10;
+			} else {
+				digits = 20;
+			}
+		}
+	}
+	if( any && p < e && (*p == 'e' || *p == 'E') ) {
+		const char *q = p + 1;
+		bool eneg = false;
+		if( q < e && (*q == '-' || *q == '+') ) {
+			eneg = (*q == '-');
+			++q;
+		}
+		if( q < e && *q >= '0' && *q <= '9' ) {
+			int ex = 0;
+			for( ; q < e && *q >= '0' && *q <= '9'; ++q ) {
+				if( ex < 10000 ) ex = ex * 10 + (*q - '0');
+			}
+			exp10 += eneg ? -ex : ex;
+			p = q;
+		}
+	}
+
+	if( any && p == e && digits <= 15 && exp10 >= -22 && exp10 <= 22 ) {
+		double v = (double)mant;
+		v = (exp10 < 0) ? v / s_pow10[ -exp10 ] : v * s_pow10[ exp10 ];
+		return neg ? -v : v;
+	}
+
+	// Long mantissas, huge exponents or odd text like "1-2": let the C
+	// library have it, which also keeps atof()'s leading-prefix behavior.
+	char buf[ 128 ];
+	size_t len = e - b;
+	if( len < sizeof( buf ) ) {
+		memcpy( buf, b, len );
+		buf[ len ] = '\0';
+		return strtod( buf, NULL );
+	}
+	return strtod( string( b, e ).c_str(), NULL );
 }
 
-static Obj *readScalar( istream& is )
+static Obj *readScalar( ParseBuffer& pb )
 {
-	int ch;
-	string ret( "" );
+	const char *start = pb.cur;
+	while( pb.cur < pb.end && isScalarChar( *pb.cur ) ) {
+		++pb.cur;
+	}
+
+	return new ScalarObj( parseScalar( start, pb.cur ) );
+}
+
+// Try to read the body of a tuple whose elements are all tuples of
+// scalars (a points, faces or normals list) into one flat array.  On the
+// first element that doesn't fit, rewind and return NULL so that
+// readTuple() can fall back to the general form.
+static Obj *readScalarRows( ParseBuffer& pb )
+{
+	const char *rewind = pb.cur;
+	ScalarRowsObj *ret = new ScalarRowsObj;
+	ScalarRows& rows = ret->rows;
 
 	while( true ) {
-		ch = is.peek();
-		if( (ch == '-') || (ch == '.') || (ch == 'e') || (ch == 'E')
-				|| (ch >= '0' && ch <= '9') ) {
-			ret += char( ch );
-			is.get();
-		} else {
+		if( !eat( pb ) || get( pb ) != '(' ) {
+			break;
+		}
+
+		size_t first = rows.values.size();
+		bool ok = true;
+		while( true ) {
+			eat( pb );
+			int ch = peek( pb );
+			if( !((ch >= '0' && ch <= '9') || ch == '-') ) {
+				ok = false;
+				break;
+			}
+			const char *start = pb.cur;
+			while( pb.cur < pb.end && isScalarChar( *pb.cur ) ) {
+				++pb.cur;
+			}
+			rows.values.push_back( parseScalar( start, pb.cur ) );
+
+			eat( pb );
+			ch = get( pb );
+			if( ch == ')' ) {
+				break;
+			} else if( ch != ',' ) {
+				ok = false;
+				break;
+			}
+		}
+		if( !ok ) {
+			break;
+		}
+		rows.endRow( first );
+
+		eat( pb );
+		int ch = get( pb );
+		if( ch == ')' ) {
+			return ret;
+		} else if( ch != ',' ) {
 			break;
 		}
 	}
 
-	return new ScalarObj( atof( ret.c_str() ) );
+	delete ret;
+	pb.cur = rewind;
+	return NULL;
 }
 
-static Obj *readTuple( istream& is )
+static Obj *readTuple( ParseBuffer& pb )
 {
 	vector<Obj*> ret;
 
-	is.get();
+	++pb.cur;
+
+	eat( pb );
+	if( peek( pb ) == '(' ) {
+		Obj *rows = readScalarRows( pb );
+		if( rows ) {
+			return rows;
+		}
+	}
 
 	while( true ) {
-		eat( is );
-		ret.push_back( readObject( is ) );	
-		eat( is );
-		int ch = is.get();
+		eat( pb );
+		ret.push_back( readObject( pb ) );
+		eat( pb );
+		int ch = get( pb );
 		if( ch == ')' ) {
 			return new TupleObj( ret );
 		} else if( ch == ',' ) {
@@ -198,57 +330,107 @@ static Obj *readTuple( istream& is )
 	throw ParseError( "Parse error: internal error." );
 }
 
-static Obj *readDict( istream& is )
+static Obj *readDict( ParseBuffer& pb )
 {
 	string lhs;
 	Obj *rhs;
 
 	map<string,Obj*> ret;
 
-	is.get();
+	++pb.cur;
 
 	while( true ) {
-		eat( is );
-		if( is.peek() == '}' ) {
-			is.get();
+		if( !eat( pb ) ) {
+			throw ParseError( "Parse error: unterminated brace." );
+		}
+		if( peek( pb ) == '}' ) {
+			++pb.cur;
 			return new DictObj( ret );
 		}
-		lhs = readID( is );
-		eat( is );
-		if( is.get() != '=' ) {
+		lhs = readID( pb );
+		eat( pb );
+		if( get( pb ) != '=' ) {
 			throw ParseError( "Parse error: expected equals." );
 		}
-		rhs = readObject( is );
+		rhs = readObject( pb );
 		ret[ lhs ] = rhs;
-		eat( is );
-		int ch = is.peek();
+		eat( pb );
+		int ch = peek( pb );
 		if( ch == ';' ) {
-			is.get();
+			++pb.cur;
 		} else if( ch != '}' ) {
 			throw ParseError( "Parse error: expected semicolon or brace." );
 		}
 	}
 }
 
-static Obj *readObject( istream& is )
+static Obj *readObject( ParseBuffer& pb )
 {
-	if( !eat( is ) ) {
+	if( !eat( pb ) ) {
 		return NULL;
 	}
 
-	int ch = is.peek();
+	int ch = peek( pb );
 
 	if( (ch == '-') || (ch >= '0' && ch <= '9') ) {
-		return readScalar( is );
+		return readScalar( pb );
 	} else if( ch == '"' ) {
-		return readString( is );
+		return readString( pb );
 	} else if( ch == '(' ) {
-		return readTuple( is );
+		return readTuple( pb );
 	} else if( ch == '{' ) {
-		return readDict( is );
+		return readDict( pb );
 	} else {
-		return readName( is );
+		return readName( pb );
+	}
+}
+
+ScalarRowsObj::~ScalarRowsObj()
+{
+	if( expanded ) {
+		for( mytuple::iterator i = expanded->begin(); i != expanded->end(); ++i ) {
+			delete (*i);
+		}
+		delete expanded;
+	}
+}
+
+void ScalarRowsObj::printOn( ostream& os ) const
+{
+	os << '(';
+	for( size_t r = 0; r < rows.numRows(); ++r ) {
+		if( r ) {
+			os << ", ";
+		}
+		const double *v = rows.row( r );
+		os << '(';
+		for( size_t k = 0; k < rows.rowSize( r ); ++k ) {
+			if( k ) {
+				os << ", ";
+			}
+			os << v[k];
+		}
+		os << ')';
+	}
+	os << ')';
+}
+
+const mytuple& ScalarRowsObj::getTuple() const
+{
+	if( !expanded ) {
+		expanded = new mytuple;
+		expanded->reserve( rows.numRows() );
+		for( size_t r = 0; r < rows.numRows(); ++r ) {
+			const double *v = rows.row( r );
+			mytuple row;
+			row.reserve( rows.rowSize( r ) );
+			for( size_t k = 0; k < rows.rowSize( r ); ++k ) {
+				row.push_back( new ScalarObj( v[k] ) );
+			}
+			expanded->push_back( new TupleObj( row ) );
+		}
 	}
+	return *expanded;
 }
 
 /*
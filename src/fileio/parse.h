@@ -29,6 +29,7 @@ inline ostream& operator <<( ostream& os, const Exception& x )
 }
 
 class Obj;
+class ScalarRows;
 
 typedef vector<Obj*> 		mytuple;
 typedef map<string,Obj*> 	dict;
@@ -73,6 +74,11 @@ public:
 	virtual const dict&  getDict() const 
 	{ throw ObjTypeMismatch( string( "dict" ), getTypeName() ); }
 
+	// Tuples of scalar tuples (points, faces, normals) are stored packed.
+	// Readers that can consume them in bulk ask for the rows here; NULL
+	// means "not packed, use getTuple()".
+	virtual const ScalarRows *getRows() const { return NULL; }
+
 	virtual string 		 getName() const
 	{ throw ObjTypeMismatch( string( "named" ), getTypeName() ); }
 	virtual Obj 		 *getChild() const
@@ -194,6 +200,73 @@ private:
 	mytuple val;
 };
 
+// A tuple of scalar tuples, e.g. ((0,0,0),(1,0,0),(0,1,0)), kept as one
+// flat array of values instead of one ScalarObj per number.  Rows usually
+// all have the same length (stride); ragged rows such as polygon faces
+// record where each row starts instead.
+class ScalarRows
+{
+public:
+	ScalarRows() : stride( 0 ), ragged( false ) {}
+
+	size_t numRows() const
+	{ return ragged ? rowStart.size() - 1 : (stride ? values.size() / stride : 0); }
+	size_t rowSize( size_t r ) const
+	{ return ragged ? rowStart[r+1] - rowStart[r] : stride; }
+	const double *row( size_t r ) const
+	{ return &values[ ragged ? rowStart[r] : r * stride ]; }
+
+	// append a finished row of n values that starts at values[first]
+	void endRow( size_t first )
+	{
+		size_t n = values.size() - first;
+		if( !ragged ) {
+			if( first == 0 ) {
+				stride = n;
+			} else if( n != stride ) {
+				// switch to explicit row starts
+				ragged = true;
+				size_t rows = first / stride;
+				rowStart.reserve( rows + 2 );
+				for( size_t r = 0; r <= rows; ++r )
+					rowStart.push_back( (unsigned)(r * stride) );
+			}
+		}
+		if( ragged )
+			rowStart.push_back( (unsigned)values.size() );
+	}
+
+	vector<double> values;
+	vector<unsigned> rowStart;	// only used when ragged
+	size_t stride;
+	bool ragged;
+};
+
+class ScalarRowsObj
+	: public Obj
+{
+public:
+	ScalarRowsObj()
+		: Obj()
+		, rows()
+		, expanded( NULL )
+	{}
+	virtual ~ScalarRowsObj();
+
+	virtual string getTypeName() const { return string( "tuple" ); }
+	virtual void printOn( ostream& os ) const;
+
+	// builds the generic form on first use, for readers that don't know
+	// about packed rows
+	virtual const mytuple& getTuple() const;
+	virtual const ScalarRows *getRows() const { return &rows; }
+
+	ScalarRows rows;
+
+private:
+	mutable mytuple *expanded;
+};
+
 class DictObj
 	: public Obj
 {
@@ -261,6 +334,21 @@ private:
 	Obj *child;
 };
 
-Obj *readFile( istream& is );
+// A cursor over scene text.  The bytes usually come straight from a
+// MappedFile and are not NUL terminated, so every read is checked
+// against end.
+struct ParseBuffer
+{
+	ParseBuffer( const char *b, const char *e )
+		: cur( b ), end( e ) {}
+
+	const char *cur;
+	const char *end;
+};
+
+Obj *readFile( ParseBuffer& pb );
+
+// Convert the number text in [b, e) to a double.
+double parseScalar( const char *b, const char *e );
 
 #endif // __PARSE_H__
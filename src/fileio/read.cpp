@@ -6,11 +6,15 @@
 #include <cstring>
 #include <fstream>
 #include <strstream>
+#include <iterator>
+#include <cctype>
 
 #include <vector>
 
 #include "read.h"
 #include "parse.h"
+#include "mmapfile.h"
+#include "meshio.h"
 
 #include "../scene/scene.h"
 #include "../SceneObjects/trimesh.h"
@@ -20,6 +24,7 @@
 #include "../SceneObjects/Sphere.h"
 #include "../SceneObjects/Square.h"
 #include "../SceneObjects/ParticleSys.h"
+#include "../SceneObjects/Instance.h"
 #include "../scene/light.h"
 #include "../SceneObjects/CSG.h"
 
@@ -37,21 +42,45 @@ static CSGTree* processCSGGeometry(string name, Obj* child, Scene* scene, const
 static void processTrimesh( string name, Obj *child, Scene *scene,
                                      const mmap& materials, TransformNode *transform );
 static void processParticle(string name, Obj* child, Scene *scene, const mmap& materials, TransformNode *transform);
+static void processPrototype( Obj *child, Scene *scene, const mmap& materials );
+static void processInstance( Obj *child, Scene *scene, TransformNode *transform );
 static void processCamera( Obj *child, Scene *scene );
 static Material *getMaterial( Obj *child, const mmap& bindings );
 static Material *processMaterial( Obj *child, mmap *bindings = NULL );
 static void verifyTuple( const mytuple& tup, size_t size );
+static void verifySize( size_t got, size_t size );
+static Scene *readScene( ParseBuffer& pb );
+
+// Directory of the scene file being read, so that mesh files named in it
+// can be given relative to the scene.  Empty when reading from a stream.
+static string s_sceneDir;
+
+// Prototypes defined so far in the scene being read, by name.
+static map<string, Prototype*> s_prototypes;
+
+static string resolvePath( const string& name )
+{
+	bool absolute = !name.empty() && (name[0] == '/' || name[0] == '\\'
+		|| (name.size() > 1 && name[1] == ':'));
+	return absolute ? name : s_sceneDir + name;
+}
 
 Scene *readScene( const string& filename )
 {
-	ifstream ifs( filename.c_str() );
-	if( !ifs ) {
+	size_t slash = filename.find_last_of( "/\\" );
+	s_sceneDir = (slash == string::npos) ? string() : filename.substr( 0, slash + 1 );
+
+	MappedFile file;
+	if( !file.open( filename.c_str() ) ) {
 		cerr << "Error: couldn't read scene file " << filename << endl;
 		return NULL;
 	}
 
 	try {
-		return readScene( ifs );
+		ParseBuffer pb( file.begin(), file.end() );
+		Scene *scene = readScene( pb );
+		scene->addSourceFile( filename );
+		return scene;
 	} catch( ParseError& pe ) {
 		cout << "Parse error: " << pe << endl;
 		return NULL;
@@ -60,30 +89,39 @@ Scene *readScene( const string& filename )
 
 Scene *readScene( istream& is )
 {
-	Scene *ret = new Scene;
-	
+	// The parser works on a buffer, so pull the whole stream in first.
+	s_sceneDir.clear();
+	string text( (istreambuf_iterator<char>( is )), istreambuf_iterator<char>() );
+	ParseBuffer pb( text.data(), text.data() + text.size() );
+	return readScene( pb );
+}
+
+static Scene *readScene( ParseBuffer& pb )
+{
 	// Extract the file header
 	static const int MAXNAME = 80;
-	char buf[ MAXNAME ];
-	int ct = 0;
+	const char *start = pb.cur;
 
-	while( ct < MAXNAME - 1 ) {
-		char c;
-		is.get( c );
+	while( pb.cur < pb.end && pb.cur - start < MAXNAME - 1 ) {
+		char c = *pb.cur++;
 		if( c == ' ' || c == '\t' || c == '\n' ) {
+			--pb.cur;
 			break;
 		}
-		buf[ ct++ ] = c;
 	}
 
-	buf[ ct ] = '\0';
-
-	if( strcmp( buf, "SBT-raytracer" ) ) {
+	if( string( start, pb.cur ) != "SBT-raytracer" ) {
 		throw ParseError( string( "Input is not an SBT input file." ) );
 	}
 
-	float version;
-	is >> version;
+	while( pb.cur < pb.end && (*pb.cur == ' ' || *pb.cur == '\t' || *pb.cur == '\n' || *pb.cur == '\r') ) {
+		++pb.cur;
+	}
+	start = pb.cur;
+	while( pb.cur < pb.end && (isdigit( (unsigned char)*pb.cur ) || *pb.cur == '.' || *pb.cur == '-') ) {
+		++pb.cur;
+	}
+	float version = (float)parseScalar( start, pb.cur );
 
 	if( version != 1.0 ) {
 		ostrstream oss;
@@ -92,11 +130,14 @@ Scene *readScene( istream& is )
 		throw ParseError( string( oss.str() ) );
 	}
 
+	Scene *ret = new Scene;
+	s_prototypes.clear();
+
 	// vector<Obj*> result;
 	mmap materials;
 
 	while( true ) {
-		Obj *cur = readFile( is );
+		Obj *cur = readFile( pb );
 		if( !cur ) {
 			break;
 		}
@@ -217,9 +258,14 @@ static bool maybeExtractField( Obj *child, const string& name, bool& ret )
 // Check that a tuple has the expected size.
 static void verifyTuple( const mytuple& tup, size_t size )
 {
-	if( tup.size() != size ) {
+	verifySize( tup.size(), size );
+}
+
+static void verifySize( size_t got, size_t size )
+{
+	if( got != size ) {
 		ostrstream oss;
-		oss << "Bad tuple size " << tup.size() << ", expected " << size;
+		oss << "Bad tuple size " << got << ", expected " << size << ends;
 
 		throw ParseError( string( oss.str() ) );
 	}
@@ -300,6 +346,8 @@ static void processGeometry( string name, Obj *child, Scene *scene,
 		processTrimesh(name, child, scene, materials, transform);
 	} else if (name == "particles") { //SYS CUSTOM: particle system
 		processParticle(name, child, scene, materials, transform);
+	} else if( name == "instance" ) {
+		processInstance( child, scene, transform );
     } else {
 		SceneObject *obj = NULL;
        	Material *mat;
@@ -379,29 +427,85 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
     
     Trimesh *tmesh = new Trimesh( scene, mat, transform);
 
-    const mytuple &points = getField( child, "points" )->getTuple();
-    for( mytuple::const_iterator pi = points.begin(); pi != points.end(); ++pi )
-        tmesh->addVertex( tupleToVec( *pi ) );
-                
-    const mytuple &faces = getField( child, "faces" )->getTuple();
-    for( mytuple::const_iterator fi = faces.begin(); fi != faces.end(); ++fi )
+    if( hasField( child, "file" ) )
     {
-        const mytuple &pointids = (*fi)->getTuple();
-
-        // triangulate here and now.  assume the poly is
-        // concave and we can triangulate using an arbitrary fan
-        if( pointids.size() < 3 )
-            throw ParseError( "Faces must have at least 3 vertices." );
+        // an external OBJ or PLY instead of inline points and faces
+        string meshName = resolvePath( getField( child, "file" )->getString() );
+        scene->addSourceFile( meshName );
+        readMeshFile( meshName, tmesh );
+    }
+    else
+    {
+        // Large meshes come out of the parser as packed ScalarRows; copy those
+        // straight into the mesh arrays without going through per-number Objs.
+        Obj *points = getField( child, "points" );
+        if( const ScalarRows *rows = points->getRows() )
+        {
+            tmesh->reserveVertices( rows->numRows() );
+            for( size_t r = 0; r < rows->numRows(); ++r )
+            {
+                verifySize( rows->rowSize( r ), 3 );
+                const double *v = rows->row( r );
+                tmesh->addVertex( vec3f( v[0], v[1], v[2] ) );
+            }
+        }
+        else
+        {
+            const mytuple &pts = points->getTuple();
+            for( mytuple::const_iterator pi = pts.begin(); pi != pts.end(); ++pi )
+                tmesh->addVertex( tupleToVec( *pi ) );
+        }
 
-        mytuple::const_iterator i = pointids.begin();
-        int a = (int) (*i++)->getScalar();
-        int b = (int) (*i++)->getScalar();
-        while( i != pointids.end() )
+        Obj *faces = getField( child, "faces" );
+        if( const ScalarRows *rows = faces->getRows() )
         {
-            int c = (int) (*i++)->getScalar();
-            if( !tmesh->addFace(a,b,c) )
-                throw ParseError( "Bad face in trimesh." );
-            b = c;
+            size_t triangles = 0;
+            for( size_t r = 0; r < rows->numRows(); ++r )
+                triangles += rows->rowSize( r ) >= 3 ? rows->rowSize( r ) - 2 : 0;
+            tmesh->reserveFaces( triangles );
+
+            for( size_t r = 0; r < rows->numRows(); ++r )
+            {
+                size_t n = rows->rowSize( r );
+                if( n < 3 )
+                    throw ParseError( "Faces must have at least 3 vertices." );
+
+                // same fan triangulation as below
+                const double *ids = rows->row( r );
+                int a = (int) ids[0];
+                int b = (int) ids[1];
+                for( size_t k = 2; k < n; ++k )
+                {
+                    int c = (int) ids[k];
+                    if( !tmesh->addFace(a,b,c) )
+                        throw ParseError( "Bad face in trimesh." );
+                    b = c;
+                }
+            }
+        }
+        else
+        {
+            const mytuple &facelist = faces->getTuple();
+            for( mytuple::const_iterator fi = facelist.begin(); fi != facelist.end(); ++fi )
+            {
+                const mytuple &pointids = (*fi)->getTuple();
+
+                // triangulate here and now.  assume the poly is
+                // concave and we can triangulate using an arbitrary fan
+                if( pointids.size() < 3 )
+                    throw ParseError( "Faces must have at least 3 vertices." );
+
+                mytuple::const_iterator i = pointids.begin();
+                int a = (int) (*i++)->getScalar();
+                int b = (int) (*i++)->getScalar();
+                while( i != pointids.end() )
+                {
+                    int c = (int) (*i++)->getScalar();
+                    if( !tmesh->addFace(a,b,c) )
+                        throw ParseError( "Bad face in trimesh." );
+                    b = c;
+                }
+            }
         }
     }
 
@@ -413,14 +517,29 @@ static void processTrimesh( string name, Obj *child, Scene *scene,
     if( hasField( child, "materials" ) )
     {
         const mytuple &mats = getField( child, "materials" )->getTuple();
+        tmesh->reserveMaterials( mats.size() );
         for( mytuple::const_iterator mi = mats.begin(); mi != mats.end(); ++mi )
             tmesh->addMaterial( getMaterial( *mi, materials ) );
     }
     if( hasField( child, "normals" ) )
     {
-        const mytuple &norms = getField( child, "normals" )->getTuple();
-        for( mytuple::const_iterator ni = norms.begin(); ni != norms.end(); ++ni )
-            tmesh->addNormal( tupleToVec( *ni ) );
+        Obj *normals = getField( child, "normals" );
+        if( const ScalarRows *rows = normals->getRows() )
+        {
+            tmesh->reserveNormals( rows->numRows() );
+            for( size_t r = 0; r < rows->numRows(); ++r )
+            {
+                verifySize( rows->rowSize( r ), 3 );
+                const double *v = rows->row( r );
+                tmesh->addNormal( vec3f( v[0], v[1], v[2] ) );
+            }
+        }
+        else
+        {
+            const mytuple &norms = normals->getTuple();
+            for( mytuple::const_iterator ni = norms.begin(); ni != norms.end(); ++ni )
+                tmesh->addNormal( tupleToVec( *ni ) );
+        }
     }
 
     char *error;
@@ -477,8 +596,64 @@ static void processParticle(string name, Obj* child, Scene *scene, const mmap& m
 	if (maybeExtractField(child, "initialLife", initialLife)) {
 		particleSrc->setInitialLife(initialLife);
 	}
+	//set the emissive colour at birth and at death, to fade between
+	if (hasField(child, "birthColor")) {
+		particleSrc->setBirthColor(tupleToVec(getField(child, "birthColor")));
+	}
+	if (hasField(child, "deathColor")) {
+		particleSrc->setDeathColor(tupleToVec(getField(child, "deathColor")));
+	}
 	particleSrc->render();
+	particleSrc->setDynamic(true);
 	scene->add(particleSrc);
+	scene->addParticleSource(particleSrc);
+}
+
+// prototype { name = "tree"; objects = ( trimesh { ... }, ... ); }
+// Defines geometry to be placed later with instance { name = "tree"; },
+// inside any transforms.  The objects are read in the prototype's own
+// space and kept out of the scene; each instance just refers to them.
+static void processPrototype( Obj *child, Scene *scene, const mmap& materials )
+{
+	if( child == NULL )
+		throw ParseError( "No info for prototype" );
+
+	string name = getField( child, "name" )->getString();
+	if( s_prototypes.count( name ) )
+		throw ParseError( string( "Prototype defined twice: " ) + name );
+
+	Prototype *proto = new Prototype;
+	scene->addPrototype( proto );
+
+	Obj *objects = getField( child, "objects" );
+	scene->beginPrototype();
+	if( objects->getTypeName() == "tuple" ) {
+		const mytuple& tup = objects->getTuple();
+		for( mytuple::const_iterator oi = tup.begin(); oi != tup.end(); ++oi )
+			processGeometry( *oi, scene, materials, proto->getRoot() );
+	} else {
+		processGeometry( objects, scene, materials, proto->getRoot() );
+	}
+	vector<Geometry*> taken;
+	scene->endPrototype( taken );
+
+	proto->setObjects( taken );
+	s_prototypes[ name ] = proto;
+}
+
+static void processInstance( Obj *child, Scene *scene, TransformNode *transform )
+{
+	if( child == NULL )
+		throw ParseError( "No info for instance" );
+
+	string name = getField( child, "name" )->getString();
+	map<string, Prototype*>::const_iterator p = s_prototypes.find( name );
+	if( p == s_prototypes.end() )
+		throw ParseError( string( "Unknown prototype: " ) + name );
+
+	Instance *inst = new Instance( scene, p->second );
+	inst->setTransform( transform );
+	scene->add( inst );
 }
 
 static Material *getMaterial( Obj *child, const mmap& bindings )
@@ -660,11 +835,16 @@ static void processObject( Obj *obj, Scene *scene, mmap& materials )
                 name == "trimesh" ||
                 name == "polymesh" ||
 				name == "particles" ||
+				name == "instance" ||
 				name == "CSG") 
 	{ // polymesh is for backwards compatibility.
 		processGeometry( name, child, scene, materials, &scene->transformRoot);
 		//scene->add( geo );
 	} 
+	else if( name == "prototype" )
+	{
+		processPrototype( child, scene, materials );
+	}
 	else if( name == "material" ) 
 	{
 		processMaterial( child, &materials );
@@ -55,7 +55,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <signal.h>
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
 
 #include <FL/Fl.h>
 #include <FL/Fl_Window.H>
@@ -66,7 +73,12 @@
 #include "ui/TraceUI.h"
 #include "RayTracer.h"
 
-#include "fileio/bitmap.h"
+#include "fileio/imagewriter.h"
+#include "fileio/read.h"
+#include "fileio/parse.h"
+#include "fileio/compiledscene.h"
+#include "scene/bvh.h"
+#include "scene/light.h"
 
 // ***********************************************************
 // from getopt.cpp 
@@ -87,16 +99,39 @@ int recursion_depth = 0;
 int g_height;
 int g_width = 150;
 bool bReport = false;
+bool g_wavefront = false;
+int g_aaDepth = 0;
+int g_progressive = -1;
+bool g_continue = false;
+bool g_incremental = false;
+int g_tilesTraced = 0, g_tilesTotal = 0;
+long long g_shadowRays = 0, g_shadowHits = 0;
+double g_aaThreshold = 0.1;
+int g_firstFrame = -1, g_lastFrame = -1;
 char *progname, *rayName, *imgName;
 
 void usage()
 {
 #ifdef WIN32
-	fl_alert( "usage: %s [-r <#> -w <#> -t] [input.ray output.bmp]\n", progname );
+	fl_alert( "usage: %s [-r <#> -w <#> -f <#>-<#> -a <#>[,<#>] -p <#> -c -i -s -t] [input.ray output.bmp|ppm|pfm]\n"
+		"       %s --compile input.ray output.rayb\n", progname, progname );
 #else
-	fprintf( stderr, "usage: %s [options] [input.ray output.bmp]\n", progname );
+	fprintf( stderr, "usage: %s [options] [input.ray output.bmp|ppm|pfm]\n", progname );
+	fprintf( stderr, "       %s --compile input.ray output.rayb\n", progname );
 	fprintf( stderr, "  -r <#>      set recurssion level (default %d)\n", recursion_depth );
 	fprintf( stderr, "  -w <#>      set output image width (default %d)\n", g_width );
+	fprintf( stderr, "  -f <#>-<#>  render this range of animation frames; the output\n" );
+	fprintf( stderr, "              name must contain %%d for the frame number\n" );
+	fprintf( stderr, "  -a <#>[,<#>] antialias: split pixels up to this many times where\n" );
+	fprintf( stderr, "              samples differ by more than a threshold (default %g)\n", g_aaThreshold );
+	fprintf( stderr, "  -p <#>      render progressively, coarse to fine, then add this\n" );
+	fprintf( stderr, "              many more samples per pixel\n" );
+	fprintf( stderr, "  -c, --resume carry on a render that was stopped, from the rows its\n" );
+	fprintf( stderr, "              output holds and the checkpoint beside it\n" );
+	fprintf( stderr, "  -i          keep the image between frames, re-tracing only the\n" );
+	fprintf( stderr, "              tiles whose rays the frame's changes could reach\n" );
+	fprintf( stderr, "  -s          trace in tiles, one bounce at a time, with the\n" );
+	fprintf( stderr, "              secondary rays sorted into coherent batches\n" );
 	fprintf( stderr, "  -t			report time statistics\n" );
 #endif
 }
@@ -104,13 +139,42 @@ void usage()
 bool processArgs(int argc, char **argv) {
 	int i;
 
-    while ( (i = getopt( argc, argv, "tr:w:h:" )) != EOF )
+	// --resume is the long name for -c
+	for (i = 1; i < argc; ++i)
+		if (strcmp(argv[i], "--resume") == 0)
+			argv[i] = (char*)"-c";
+
+    while ( (i = getopt( argc, argv, "tscir:w:h:f:a:p:" )) != EOF )
 	{
 		switch ( i )
 		{
 			case 't':
 			bReport = true;
 			break;
+
+			case 's':
+			g_wavefront = true;
+			break;
+
+			case 'c':
+			g_continue = true;
+			break;
+
+			case 'i':
+			g_incremental = true;
+			break;
+
+			case 'p':
+			g_progressive = atoi( optarg );
+			break;
+
+			case 'a':
+			if ( sscanf( optarg, "%d,%lf", &g_aaDepth, &g_aaThreshold ) < 1 || g_aaDepth < 0 )
+			{
+				fprintf( stderr, "bad antialiasing setting %s\n", optarg );
+				return false;
+			}
+			break;
 	    
 			case 'r':
 			recursion_depth = atoi( optarg );
@@ -124,6 +188,16 @@ bool processArgs(int argc, char **argv) {
 			g_height = atoi( optarg );
 			break;
 
+			case 'f':
+			if ( sscanf( optarg, "%d-%d", &g_firstFrame, &g_lastFrame ) == 1 )
+				g_lastFrame = g_firstFrame;
+			if ( g_firstFrame < 0 || g_lastFrame < g_firstFrame )
+			{
+				fprintf( stderr, "bad frame range %s\n", optarg );
+				return false;
+			}
+			break;
+
 			default:
 			return false;
 		}
@@ -138,9 +212,339 @@ bool processArgs(int argc, char **argv) {
     rayName = argv[optind];
     imgName = argv[optind+1];
 
+	if ( g_incremental && (g_continue || g_progressive >= 0) )
+	{
+		fprintf( stderr, "-i can't be used with -c or -p.\n" );
+		return false;
+	}
+
+	if ( g_firstFrame >= 0 && !strstr( imgName, "%d" ) )
+	{
+		fprintf( stderr, "the output name needs a %%d for the frame number.\n" );
+		return false;
+	}
+
+	return true;
+}
+
+// imgName with its %d replaced by the frame number
+string frameName( int frame )
+{
+	string name( imgName );
+	char num[16];
+	sprintf( num, "%d", frame );
+	return name.replace( name.find( "%d" ), 2, num );
+}
+
+// rows traced and written at a time, which bounds the memory a render
+// needs however large the image
+static const int s_bandRows = 64;
+
+// A band is traced in steps: a pass each when rendering progressively,
+// otherwise this many rows at a time.
+static const int s_stepRows = 8;
+
+// Seconds between checkpoints of the band being traced.  Finished bands
+// are already safe in the output file.
+static const int s_checkpointInterval = 60;
+
+// set by SIGINT or SIGTERM; the render checkpoints and stops
+static volatile sig_atomic_t g_interrupted = 0;
+
+static void onInterrupt(int)
+{
+	g_interrupted = 1;
+}
+
+// A checkpoint holds the band being traced when it was written: the
+// scene files it came from, which rows, the settings they were traced
+// with, how many steps were done, and then, if any were, the band's
+// framebuffer.  It sits beside the output as <output>.ckpt, and only the
+// render it came from will pick it up.
+struct Checkpoint
+{
+	long long sceneSize;
+	unsigned long long sceneHash;
+	int width, height;
+	int y0, rows;
+	int depth, aaDepth, progressive, wavefront;
+	double aaThreshold;
+	int steps;
+};
+
+static const char s_checkpointMagic[8] = { 'R', 'A', 'Y', 'C', 'K', 'P', 'T', '3' };
+
+// The total size and a 64-bit FNV-1a hash of every file the loaded scene
+// was read from: the .ray file and any meshes it names.  Each file's
+// length goes into the hash after its bytes, so bytes can't move from
+// one to the next unnoticed.  The size stays -1 if one can't be read.
+static long long g_sceneSize = -1;
+static unsigned long long g_sceneHash = 0;
+
+static void hashScene()
+{
+	vector<string> files;
+	theRayTracer->getSourceFiles(files);
+	unsigned long long h = 14695981039346656037ull;
+	long long size = 0;
+	unsigned char block[65536];
+	for (size_t i = 0; i < files.size(); ++i) {
+		FILE *fp = fopen(files[i].c_str(), "rb");
+		if (!fp)
+			return;
+		long long fileSize = 0;
+		size_t n;
+		while ((n = fread(block, 1, sizeof(block), fp)) > 0) {
+			for (size_t k = 0; k < n; ++k)
+				h = (h ^ block[k]) * 1099511628211ull;
+			fileSize += n;
+		}
+		fclose(fp);
+		for (int k = 0; k < 8; ++k)
+			h = (h ^ ((fileSize >> (8 * k)) & 0xff)) * 1099511628211ull;
+		size += fileSize;
+	}
+	g_sceneSize = size;
+	g_sceneHash = h;
+}
+
+static Checkpoint bandCheckpoint(int y0, int rows)
+{
+	Checkpoint c;
+	memset(&c, 0, sizeof(c));
+	c.sceneSize = g_sceneSize;
+	c.sceneHash = g_sceneHash;
+	c.width = g_width;
+	c.height = g_height;
+	c.y0 = y0;
+	c.rows = rows;
+	c.depth = recursion_depth;
+	c.aaDepth = g_aaDepth;
+	c.progressive = g_progressive;
+	c.wavefront = g_wavefront;
+	c.aaThreshold = g_aaThreshold;
+	return c;
+}
+
+// Move from over to in one step, so that one or the other is always there.
+static bool replaceFile(const char *from, const char *to)
+{
+#ifdef WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+// Written beside the old one and then moved over it, so that dying while
+// writing leaves the last checkpoint.
+static void saveCheckpoint(const string& name, const Checkpoint& c)
+{
+	string tmp = name + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if (!fp)
+		return;
+	bool ok = fwrite(s_checkpointMagic, sizeof(s_checkpointMagic), 1, fp) == 1
+		&& fwrite(&c, sizeof(c), 1, fp) == 1
+		&& (c.steps == 0 || theRayTracer->saveBand(fp));
+	ok = (fclose(fp) == 0) && ok;
+	if (ok)
+		ok = replaceFile(tmp.c_str(), name.c_str());
+	if (!ok) {
+		fprintf(stderr, "couldn't write the checkpoint %s\n", name.c_str());
+		remove(tmp.c_str());
+	}
+}
+
+// Read the header of the checkpoint open in fp into c; false if it has none.
+static bool readCheckpoint(FILE *fp, Checkpoint& c)
+{
+	char magic[sizeof(s_checkpointMagic)];
+	return fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, s_checkpointMagic, sizeof(magic)) == 0
+		&& fread(&c, sizeof(c), 1, fp) == 1;
+}
+
+// Whether the checkpoint name was written by a render of the scene that
+// is loaded now, as it is now.
+static bool sameScene(const string& name)
+{
+	FILE *fp = fopen(name.c_str(), "rb");
+	if (!fp)
+		return false;
+	Checkpoint c;
+	bool same = readCheckpoint(fp, c) && g_sceneSize >= 0
+		&& c.sceneSize == g_sceneSize && c.sceneHash == g_sceneHash;
+	fclose(fp);
+	return same;
+}
+
+// The steps done by a checkpoint of this band, loading its framebuffer,
+// or 0 if there is none that fits.
+static int loadCheckpoint(const string& name, const Checkpoint& band)
+{
+	FILE *fp = fopen(name.c_str(), "rb");
+	if (!fp)
+		return 0;
+	Checkpoint c;
+	int steps = 0;
+	if (readCheckpoint(fp, c)) {
+		steps = c.steps;
+		c.steps = 0;
+		if (steps == 0 || memcmp(&c, &band, sizeof(c)) != 0 || !theRayTracer->loadBand(fp))
+			steps = 0;
+	}
+	fclose(fp);
+	if (steps == 0)
+		theRayTracer->setBand(band.y0, band.rows);
+	return steps;
+}
+
+// Write the next rows of out from the framebuffer; false if they can't be.
+static bool writeRows(ImageWriter& out, int rows)
+{
+	vector<float> row(g_width * 3);
+	for (int k = 0; k < rows; ++k) {
+		int y = out.nextRow();
+		for (int x = 0; x < g_width; ++x) {
+			vec3f col = theRayTracer->getPixel(x, y);
+			row[x * 3] = (float)col[0];
+			row[x * 3 + 1] = (float)col[1];
+			row[x * 3 + 2] = (float)col[2];
+		}
+		if (!out.writeRow(&row[0]))
+			return false;
+	}
 	return true;
 }
 
+// Trace the loaded scene into fname, returning the time taken.
+double renderImage( const char *fname )
+{
+	g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
+
+	ImageWriter out;
+	if (!out.open(fname, g_width, g_height, g_continue)) {
+		fprintf(stderr, "couldn't write %s: %s\n", fname, out.error());
+		return 0.0;
+	}
+
+	// Rows left by a render of some other scene, or of this one before it
+	// was edited, are not carried on from.  A part-done image always has
+	// a checkpoint naming its scene.
+	string checkpoint = string(fname) + ".ckpt";
+	if (out.rowsDone() > 0 && !out.finished() && !sameScene(checkpoint)) {
+		fprintf(stderr, "%s wasn't started from this scene as it is now; starting it again\n", fname);
+		if (!out.open(fname, g_width, g_height, false)) {
+			fprintf(stderr, "couldn't write %s: %s\n", fname, out.error());
+			return 0.0;
+		}
+	}
+
+	theRayTracer->setBand(0, s_bandRows);
+	theRayTracer->traceSetup(g_width, g_height);
+
+	clock_t start, end;
+	start=clock();
+
+	// no band data yet, only which scene the rows about to be written
+	// come from
+	if (!out.finished() && !(g_continue && sameScene(checkpoint)))
+		saveCheckpoint(checkpoint, bandCheckpoint(0, 0));
+	time_t lastCheckpoint = time(NULL);
+
+	while (!out.finished()) {
+		// the next band in the file's order
+		int rows = min(s_bandRows, g_height - out.rowsDone());
+		int y0 = out.bottomUp() ? out.nextRow() : out.nextRow() - rows + 1;
+		theRayTracer->setBand(y0, rows);
+
+		Checkpoint band = bandCheckpoint(y0, rows);
+		int steps = (g_progressive >= 0) ? RayTracer::coarsePasses() + g_progressive
+			: (rows + s_stepRows - 1) / s_stepRows;
+		int step = g_continue ? loadCheckpoint(checkpoint, band) : 0;
+
+		for (; step < steps && !g_interrupted; ++step) {
+			if (g_progressive >= 0)
+				theRayTracer->tracePass(step, y0, y0 + rows);
+			else
+				theRayTracer->traceLines(y0 + step * s_stepRows, min(y0 + (step + 1) * s_stepRows, y0 + rows));
+
+			if (g_interrupted || time(NULL) - lastCheckpoint >= s_checkpointInterval) {
+				band.steps = step + 1;
+				saveCheckpoint(checkpoint, band);
+				lastCheckpoint = time(NULL);
+			}
+		}
+		if (g_interrupted)
+			break;
+
+		if (!writeRows(out, rows)) {
+			fprintf(stderr, "couldn't write %s\n", fname);
+			return (double)(clock()-start)/CLOCKS_PER_SEC;
+		}
+	}
+
+	if (out.finished())
+		remove(checkpoint.c_str());
+
+	end=clock();
+
+	return (double)(end-start)/CLOCKS_PER_SEC;
+}
+
+// Add the frame just rendered to the report's shadow ray counts, and
+// start them again for the next.
+void countShadowRays()
+{
+	long long rays, hits;
+	Light::getShadowCacheStats( rays, hits );
+	g_shadowRays += rays;
+	g_shadowHits += hits;
+	Light::resetShadowCaches();
+}
+
+// As renderImage, with the whole image kept from the frame before and
+// only the tiles the frame change reached traced again.
+double renderChangedTiles( const char *fname )
+{
+	clock_t start, end;
+	start=clock();
+
+	g_tilesTraced += theRayTracer->traceChangedTiles();
+	g_tilesTotal += theRayTracer->tileCount();
+
+	end=clock();
+
+	ImageWriter out;
+	if (!out.open(fname, g_width, g_height))
+		fprintf(stderr, "couldn't write %s: %s\n", fname, out.error());
+	else if (!writeRows(out, g_height))
+		fprintf(stderr, "couldn't write %s\n", fname);
+
+	return (double)(end-start)/CLOCKS_PER_SEC;
+}
+
+// Parse a .ray file once and save it in the compiled form, which
+// RayTracer::loadScene recognizes and maps straight in.
+int compileScene( const char *in, const char *out )
+{
+	Scene *scene;
+	try {
+		scene = readScene( in );
+	} catch( ParseError pe ) {
+		fprintf( stderr, "ParseError: %s\n", pe.getMsg().c_str() );
+		return 1;
+	}
+	if( !scene )
+		return 1;
+
+	if( !writeCompiledScene( out, scene ) ) {
+		fprintf( stderr, "couldn't write %s\n", out );
+		return 1;
+	}
+	return 0;
+}
+
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
 // Use "ray --help" to see the detailed usage.
@@ -152,6 +556,9 @@ bool processArgs(int argc, char **argv) {
 int main(int argc, char **argv) {
 	progname=argv[0];
 
+	if (argc==4 && strcmp(argv[1], "--compile")==0)
+		return compileScene(argv[2], argv[3]);
+
 	if (argc!=1) {
 		// text mode
 		if (!processArgs(argc, argv)) {
@@ -159,34 +566,76 @@ int main(int argc, char **argv) {
 			exit(1);
 		}
 		
+		// the tracer takes its settings (depth, soft shadows, Fresnel)
+		// from traceUI, so text mode needs one as well; it's never shown
+		traceUI=new TraceUI();
+		traceUI->setDepth(recursion_depth);
+
 		theRayTracer=new RayTracer();
+		theRayTracer->setWavefront(g_wavefront);
+		theRayTracer->setSupersampling(g_aaDepth, g_aaThreshold);
 		theRayTracer->loadScene(rayName);
+		hashScene();
 	
 		if (theRayTracer->sceneLoaded()) {
-			g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
+			double t=0;
 
-			theRayTracer->traceSetup(g_width, g_height);
-		
-			clock_t start, end;
-			start=clock();
+			// stopping, or being preempted, leaves a checkpoint to resume from
+			signal(SIGINT, onInterrupt);
+			signal(SIGTERM, onInterrupt);
 
-			theRayTracer->traceLines(0, g_height);
-		
-			end=clock();
+			const BVH *bvh = theRayTracer->getScene()->getBVH();
+			if (bReport && bvh) {
+				const BVH::Stats& st = bvh->getStats();
+				char msg[256];
+				sprintf( msg, "bvh: %d objects, %d nodes (%d 4-wide), depth %d, SAH cost %.2f, built in %.3f seconds\n",
+					st.items, st.nodes, st.wideNodes, st.depth, st.sahCost, st.buildTime );
+#ifdef WIN32
+				fl_message( "%s", msg );
+#else
+				fprintf( stderr, "%s", msg );
+#endif
+			}
+
+			double (*render)(const char *) = renderImage;
+			if (g_incremental) {
+				// one framebuffer for the whole image, kept between frames
+				g_height = (int)(g_width / theRayTracer->aspectRatio() + 0.5);
+				theRayTracer->setBand(0, 0);
+				theRayTracer->setTileTracking(true);
+				theRayTracer->traceSetup(g_width, g_height);
+				render = renderChangedTiles;
+			}
 
-			// save image
-			unsigned char* buf;
+			if (g_firstFrame < 0) {
+				t=render(imgName);
+				countShadowRays();
+			} else {
+				// A sequence is rendered from the one loaded scene: only the
+				// particle sources change, and each carries on from the
+				// frame before rather than simulating from the start.
+				for (int frame = g_firstFrame; frame <= g_lastFrame && !g_interrupted; ++frame) {
+					theRayTracer->setFrame(frame);
+					t+=render(frameName(frame).c_str());
+					countShadowRays();
+				}
+			}
 
-			theRayTracer->getBuffer(buf, g_width, g_height);
-			if (buf)
-				writeBMP(imgName, g_width, g_height, buf); 
+			if (g_interrupted)
+				fprintf(stderr, "stopped; run the same command with --resume to carry on\n");
 
 			if (bReport) {
-				double t=(double)(end-start)/CLOCKS_PER_SEC;
+				char msg[256];
+				int n = sprintf( msg, "shadow rays: %lld, %.1f%% settled by the light's last occluder\n",
+					g_shadowRays, g_shadowRays ? 100.0 * g_shadowHits / g_shadowRays : 0.0 );
+				if (g_aaDepth > 0)
+					n += sprintf( msg + n, "antialiasing: %.2f samples per pixel\n", theRayTracer->samplesPerPixel() );
+				if (g_incremental)
+					sprintf( msg + n, "incremental: %d of %d tiles traced\n", g_tilesTraced, g_tilesTotal );
 #ifdef WIN32
-				fl_message( "total time = %.3f seconds\n", t); 
+				fl_message( "total time = %.3f seconds\n%s", t, msg); 
 #else
-				fprintf( stderr, "total time = %.3f seconds\n", t); 
+				fprintf( stderr, "total time = %.3f seconds\n%s", t, msg); 
 #endif
 			}
 		}
@@ -196,6 +645,8 @@ int main(int argc, char **argv) {
 		// graphics mode
 		traceUI=new TraceUI();
 		theRayTracer=new RayTracer();
+		// re-renders after changing only settings skip the first rays
+		theRayTracer->setHitCache(true);
 
 		traceUI->setRayTracer(theRayTracer);
 
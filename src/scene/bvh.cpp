@@ -0,0 +1,648 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <float.h>
+#include <future>
+#include <thread>
+
+#include "bvh.h"
+
+#if defined( _M_X64 ) || (defined( _M_IX86_FP ) && _M_IX86_FP >= 2) || defined( __SSE2__ )
+#define BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+// Ranges with more items than this have their bounds and bins gathered
+// by several threads, and their two halves built as separate tasks.
+static const int s_parallelItems = 1 << 15;
+
+// Split candidates per axis for the surface area heuristic.
+static const int s_bins = 16;
+
+// Below this depth splits fall back to the median, so that even a badly
+// skewed scene can't outgrow the traversal stack.
+static const int s_maxSahDepth = 32;
+
+// The most items a leaf can hold: WideNode counts them in 16 bits.
+static const int s_maxLeafItems = 0xffff;
+
+// Quantization steps across a wide node's box.  Child boxes are padded by
+// a step each way, so 253 steps leave room for that inside 0..255.
+static const int s_quantSteps = 253;
+
+// Relative slack on the t range of a quantized box, covering the rounding
+// in hitChildren's single precision arithmetic.
+static const float s_tSlack = 1.0e-6f;
+
+// asked once: some platforms go to the file system for it
+static const unsigned s_cores = max( thread::hardware_concurrency(), 1u );
+
+static unsigned workerCount( int items )
+{
+	unsigned n = s_cores;
+	unsigned chunks = items / s_parallelItems + 1;
+	return chunks < n ? chunks : n;
+}
+
+static double surfaceArea( const double *lo, const double *hi )
+{
+	double e[3];
+	for( int k = 0; k < 3; ++k )
+		e[k] = max( hi[k] - lo[k], 0.0 );
+	return 2.0 * (e[0] * e[1] + e[1] * e[2] + e[2] * e[0]);
+}
+
+static double surfaceArea( const vec3f& lo, const vec3f& hi )
+{
+	double l[3] = { lo[0], lo[1], lo[2] }, h[3] = { hi[0], hi[1], hi[2] };
+	return surfaceArea( l, h );
+}
+
+// orders item indices by their centroid along one axis
+struct CentroidLess
+{
+	const vector<vec3f>& centroids;
+	int axis;
+
+	CentroidLess( const vector<vec3f>& c, int a ) : centroids( c ), axis( a ) {}
+	bool operator()( int a, int b ) const { return centroids[a][axis] < centroids[b][axis]; }
+};
+
+// Bounds of some items, and of their centroids.  The binning loops run
+// over every item at each level, so these work on plain doubles.
+struct RangeBounds
+{
+	double lo[3], hi[3], clo[3], chi[3];
+
+	RangeBounds()
+	{
+		for( int k = 0; k < 3; ++k ) {
+			lo[k] = clo[k] = 1e308;
+			hi[k] = chi[k] = -1e308;
+		}
+	}
+
+	void merge( const RangeBounds& o )
+	{
+		for( int k = 0; k < 3; ++k ) {
+			lo[k] = min( lo[k], o.lo[k] );
+			hi[k] = max( hi[k], o.hi[k] );
+			clo[k] = min( clo[k], o.clo[k] );
+			chi[k] = max( chi[k], o.chi[k] );
+		}
+	}
+};
+
+static RangeBounds rangeBounds( const int *items, int n, const vector<BoundingBox>& bounds,
+	const vector<vec3f>& centroids )
+{
+	RangeBounds rb;
+	for( int i = 0; i < n; ++i ) {
+		const BoundingBox& b = bounds[ items[i] ];
+		const vec3f& c = centroids[ items[i] ];
+		for( int k = 0; k < 3; ++k ) {
+			rb.lo[k] = min( rb.lo[k], b.min[k] );
+			rb.hi[k] = max( rb.hi[k], b.max[k] );
+			rb.clo[k] = min( rb.clo[k], c[k] );
+			rb.chi[k] = max( rb.chi[k], c[k] );
+		}
+	}
+	return rb;
+}
+
+// which bin a centroid falls in along an axis
+struct BinIndex
+{
+	double origin, scale;
+
+	BinIndex() : origin( 0.0 ), scale( 0.0 ) {}
+	BinIndex( double lo, double extent ) : origin( lo ),
+		scale( extent > 0.0 ? s_bins * (1.0 - 1e-9) / extent : 0.0 ) {}
+	int operator()( double c ) const
+	{
+		int b = (int)((c - origin) * scale);
+		return b < 0 ? 0 : (b >= s_bins ? s_bins - 1 : b);
+	}
+};
+
+// Items dropped into equal slices of the centroid bounds, on all three
+// axes at once: per axis and bin, how many items and the box around them.
+struct Bins
+{
+	double lo[3][ s_bins ][3], hi[3][ s_bins ][3];
+	int count[3][ s_bins ];
+
+	Bins()
+	{
+		for( int a = 0; a < 3; ++a ) {
+			for( int b = 0; b < s_bins; ++b ) {
+				for( int k = 0; k < 3; ++k ) {
+					lo[a][b][k] = 1e308;
+					hi[a][b][k] = -1e308;
+				}
+				count[a][b] = 0;
+			}
+		}
+	}
+
+	void merge( const Bins& o )
+	{
+		for( int a = 0; a < 3; ++a ) {
+			for( int b = 0; b < s_bins; ++b ) {
+				for( int k = 0; k < 3; ++k ) {
+					lo[a][b][k] = min( lo[a][b][k], o.lo[a][b][k] );
+					hi[a][b][k] = max( hi[a][b][k], o.hi[a][b][k] );
+				}
+				count[a][b] += o.count[a][b];
+			}
+		}
+	}
+
+	// widen the box l-h to take in bin b on axis a
+	void grow( int a, int b, double *l, double *h ) const
+	{
+		for( int k = 0; k < 3; ++k ) {
+			l[k] = min( l[k], lo[a][b][k] );
+			h[k] = max( h[k], hi[a][b][k] );
+		}
+	}
+};
+
+static void fillBins( Bins *bins, const int *items, int n, const vector<BoundingBox>& bounds,
+	const vector<vec3f>& centroids, const RangeBounds *rb )
+{
+	BinIndex index[3];
+	for( int a = 0; a < 3; ++a )
+		index[a] = BinIndex( rb->clo[a], rb->chi[a] - rb->clo[a] );
+
+	for( int i = 0; i < n; ++i ) {
+		const BoundingBox& box = bounds[ items[i] ];
+		const vec3f& c = centroids[ items[i] ];
+		double lo[3] = { box.min[0], box.min[1], box.min[2] };
+		double hi[3] = { box.max[0], box.max[1], box.max[2] };
+		for( int a = 0; a < 3; ++a ) {
+			int b = index[a]( c[a] );
+			++bins->count[a][b];
+			for( int k = 0; k < 3; ++k ) {
+				bins->lo[a][b][k] = min( bins->lo[a][b][k], lo[k] );
+				bins->hi[a][b][k] = max( bins->hi[a][b][k], hi[k] );
+			}
+		}
+	}
+}
+
+// true for items left of the chosen split
+struct BinBelow
+{
+	const vector<vec3f>& centroids;
+	int axis;
+	BinIndex index;
+	int split;
+
+	BinBelow( const vector<vec3f>& c, int a, const BinIndex& i, int s )
+		: centroids( c ), axis( a ), index( i ), split( s ) {}
+	bool operator()( int item ) const { return index( centroids[item][axis] ) <= split; }
+};
+
+// Run job over n slices of items [first, last), slice 0 on the calling
+// thread.
+template<class Job>
+static void runSlices( unsigned n, int first, int last, Job job )
+{
+	vector<future<void>> workers;
+	for( unsigned i = 1; i < n; ++i ) {
+		int a = first + (int)((long long)(last - first) * i / n);
+		int b = first + (int)((long long)(last - first) * (i + 1) / n);
+		workers.push_back( async( launch::async, job, i, a, b ) );
+	}
+	job( 0, first, first + (int)((long long)(last - first) / n) );
+	for( size_t i = 0; i < workers.size(); ++i )
+		workers[i].get();
+}
+
+void BVH::build( const vector<BoundingBox>& bounds, int maxLeafSize )
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	clear();
+	m_stats = Stats();
+	int n = (int)bounds.size();
+	if( n == 0 )
+		return;
+
+	vector<vec3f> centroids( n );
+	m_items.resize( n );
+	for( int i = 0; i < n; ++i ) {
+		centroids[i] = (bounds[i].min + bounds[i].max) * 0.5;
+		m_items[i] = i;
+	}
+
+	maxLeafSize = max( 1, min( maxLeafSize, s_maxLeafItems / 4 ) );
+	m_nodes.reserve( 2 * (n / maxLeafSize + 1) );
+	m_stats.depth = buildNode( 0, n, bounds, centroids, maxLeafSize, 0, m_nodes );
+
+	m_parent.assign( m_nodes.size(), -1 );
+	m_leaf.resize( n );
+	for( int i = 0; i < (int)m_nodes.size(); ++i ) {
+		const Node& node = m_nodes[i];
+		if( node.count > 0 ) {
+			++m_stats.leaves;
+			for( int k = node.offset; k < node.offset + node.count; ++k )
+				m_leaf[ m_items[k] ] = i;
+		} else {
+			m_parent[ i + 1 ] = i;
+			m_parent[ node.offset ] = i;
+		}
+	}
+
+	collapse();
+
+	m_stats.items = n;
+	m_stats.nodes = (int)m_nodes.size();
+	m_stats.wideNodes = (int)m_wide.size();
+	m_stats.sahCost = sahCost();
+	m_stats.buildTime = chrono::duration<double>( chrono::steady_clock::now() - start ).count();
+}
+
+// Build a subtree over [first, last) of m_items onto the end of nodes,
+// splitting where the binned surface area heuristic says is cheapest.
+// Big ranges are binned by several threads and have their left half built
+// as a separate task into nodes of its own, spliced in afterwards.
+// Returns the depth of the subtree.
+int BVH::buildNode( int first, int last, const vector<BoundingBox>& bounds,
+	const vector<vec3f>& centroids, int maxLeafSize, int depth, vector<Node>& nodes )
+{
+	int count = last - first;
+	unsigned workers = workerCount( count );
+
+	RangeBounds rb;
+	if( workers > 1 ) {
+		vector<RangeBounds> parts( workers );
+		runSlices( workers, first, last, [&]( unsigned i, int a, int b ) {
+			parts[i] = rangeBounds( &m_items[a], b - a, bounds, centroids );
+		} );
+		for( unsigned i = 0; i < workers; ++i )
+			rb.merge( parts[i] );
+	} else {
+		rb = rangeBounds( &m_items[first], count, bounds, centroids );
+	}
+
+	int index = (int)nodes.size();
+	nodes.push_back( Node() );
+	nodes[index].min = vec3f( rb.lo[0], rb.lo[1], rb.lo[2] );
+	nodes[index].max = vec3f( rb.hi[0], rb.hi[1], rb.hi[2] );
+
+	double extent[3];
+	for( int k = 0; k < 3; ++k )
+		extent[k] = rb.chi[k] - rb.clo[k];
+	int axis = 0;
+	if( extent[1] > extent[axis] )
+		axis = 1;
+	if( extent[2] > extent[axis] )
+		axis = 2;
+
+	// small enough, or all the centroids coincide and can't be split
+	if( count <= maxLeafSize || (extent[axis] <= 0.0 && count <= s_maxLeafItems) ) {
+		nodes[index].offset = first;
+		nodes[index].count = count;
+		nodes[index].axis = 0;
+		return 1;
+	}
+
+	int mid = first;
+	if( depth < s_maxSahDepth ) {
+		Bins bins;
+		if( workers > 1 ) {
+			vector<Bins> parts( workers );
+			runSlices( workers, first, last, [&]( unsigned i, int a, int b ) {
+				fillBins( &parts[i], &m_items[a], b - a, bounds, centroids, &rb );
+			} );
+			for( unsigned i = 0; i < workers; ++i )
+				bins.merge( parts[i] );
+		} else {
+			fillBins( &bins, &m_items[first], count, bounds, centroids, &rb );
+		}
+
+		// sweep each axis for the split with the least area * count
+		double best = 1e308;
+		int bestAxis = -1, bestSplit = 0;
+		for( int a = 0; a < 3; ++a ) {
+			if( extent[a] <= 0.0 )
+				continue;
+			double rightCost[ s_bins ];
+			double lo[3] = { 1e308, 1e308, 1e308 }, hi[3] = { -1e308, -1e308, -1e308 };
+			int n = 0;
+			for( int b = s_bins - 1; b > 0; --b ) {
+				n += bins.count[a][b];
+				bins.grow( a, b, lo, hi );
+				rightCost[b] = n ? surfaceArea( lo, hi ) * n : 0.0;
+			}
+			for( int k = 0; k < 3; ++k ) {
+				lo[k] = 1e308;
+				hi[k] = -1e308;
+			}
+			n = 0;
+			for( int b = 0; b < s_bins - 1; ++b ) {
+				n += bins.count[a][b];
+				bins.grow( a, b, lo, hi );
+				if( n == 0 || n == count )
+					continue;
+				double cost = surfaceArea( lo, hi ) * n + rightCost[ b + 1 ];
+				if( cost < best ) {
+					best = cost;
+					bestAxis = a;
+					bestSplit = b;
+				}
+			}
+		}
+
+		if( bestAxis >= 0 ) {
+			// a leaf is cheaper than one more box test and the two halves
+			double area = surfaceArea( rb.lo, rb.hi );
+			if( count <= 4 * maxLeafSize && area > 0.0 && count <= 1.0 + best / area ) {
+				nodes[index].offset = first;
+				nodes[index].count = count;
+				nodes[index].axis = 0;
+				return 1;
+			}
+
+			axis = bestAxis;
+			BinBelow below( centroids, axis, BinIndex( rb.clo[axis], extent[axis] ), bestSplit );
+			mid = (int)(partition( m_items.begin() + first, m_items.begin() + last, below ) - m_items.begin());
+		}
+	}
+
+	if( mid == first || mid == last ) {
+		mid = (first + last) / 2;
+		nth_element( m_items.begin() + first, m_items.begin() + mid, m_items.begin() + last,
+			CentroidLess( centroids, axis ) );
+	}
+
+	int leftDepth, rightDepth, right;
+	if( workers > 1 ) {
+		// the two halves touch separate parts of m_items, so the left one
+		// can be built alongside; both are appended to nodes afterwards
+		vector<Node> leftNodes, rightNodes;
+		future<int> left = async( launch::async, [&]() {
+			return buildNode( first, mid, bounds, centroids, maxLeafSize, depth + 1, leftNodes );
+		} );
+		rightDepth = buildNode( mid, last, bounds, centroids, maxLeafSize, depth + 1, rightNodes );
+		leftDepth = left.get();
+
+		int base = (int)nodes.size();
+		for( size_t k = 0; k < leftNodes.size(); ++k ) {
+			nodes.push_back( leftNodes[k] );
+			if( leftNodes[k].count == 0 )
+				nodes.back().offset += base;
+		}
+		right = (int)nodes.size();
+		for( size_t k = 0; k < rightNodes.size(); ++k ) {
+			nodes.push_back( rightNodes[k] );
+			if( rightNodes[k].count == 0 )
+				nodes.back().offset += right;
+		}
+	} else {
+		leftDepth = buildNode( first, mid, bounds, centroids, maxLeafSize, depth + 1, nodes );
+		right = (int)nodes.size();
+		rightDepth = buildNode( mid, last, bounds, centroids, maxLeafSize, depth + 1, nodes );
+	}
+
+	nodes[index].offset = right;
+	nodes[index].count = 0;
+	nodes[index].axis = axis;
+	return 1 + max( leftDepth, rightDepth );
+}
+
+void BVH::clear()
+{
+	m_nodes.clear();
+	m_items.clear();
+	m_parent.clear();
+	m_leaf.clear();
+	m_wide.clear();
+	m_wideRoot.clear();
+	m_wideSlot.clear();
+	m_wideOf.clear();
+}
+
+void BVH::collapse()
+{
+	m_wide.clear();
+	m_wideRoot.clear();
+	m_wideSlot.clear();
+	m_wideOf.assign( m_nodes.size(), -1 );
+	if( !m_nodes.empty() )
+		collapseNode( 0 );
+}
+
+// Make a wide node standing for binary node n: starting from n's two
+// children, keep opening the interior slot with the largest surface area
+// until there are four.  A leaf n becomes a wide node with one slot.
+// Returns the new node's index.
+int BVH::collapseNode( int n )
+{
+	int w = (int)m_wide.size();
+	m_wide.push_back( WideNode() );
+	m_wideRoot.push_back( n );
+	m_wideOf[n] = w;
+
+	int slot[4] = { -1, -1, -1, -1 };
+	int m = 0;
+	if( m_nodes[n].count > 0 ) {
+		slot[ m++ ] = n;
+	} else {
+		slot[ m++ ] = n + 1;
+		slot[ m++ ] = m_nodes[n].offset;
+		while( m < 4 ) {
+			int open = -1;
+			double largest = -1.0;
+			for( int j = 0; j < m; ++j ) {
+				const Node& node = m_nodes[ slot[j] ];
+				double area = surfaceArea( node.min, node.max );
+				if( node.count == 0 && area > largest ) {
+					largest = area;
+					open = j;
+				}
+			}
+			if( open < 0 )
+				break;
+			int opened = slot[ open ];
+			slot[ open ] = opened + 1;
+			slot[ m++ ] = m_nodes[ opened ].offset;
+		}
+	}
+	m_wideSlot.insert( m_wideSlot.end(), slot, slot + 4 );
+
+	// m_wide grows underneath, so fill the slots in by index
+	for( int j = 0; j < 4; ++j ) {
+		int child = -1, count = 0;
+		if( slot[j] >= 0 ) {
+			const Node& node = m_nodes[ slot[j] ];
+			if( node.count > 0 ) {
+				child = node.offset;
+				count = node.count;
+			} else {
+				child = collapseNode( slot[j] );
+			}
+		}
+		m_wide[w].child[j] = child;
+		m_wide[w].count[j] = (unsigned short)count;
+	}
+	quantize( w );
+	return w;
+}
+
+// Store w's child boxes as steps across w's own box, rounding outwards so
+// that each stored box contains the real one.
+void BVH::quantize( int w )
+{
+	WideNode& wide = m_wide[w];
+	const Node& root = m_nodes[ m_wideRoot[w] ];
+	const int *slot = &m_wideSlot[ 4 * w ];
+
+	for( int k = 0; k < 3; ++k ) {
+		double lo = root.min[k];
+		float origin = (float)lo;
+		if( origin > lo )
+			origin = nextafter( origin, -FLT_MAX );
+		float scale = (float)((root.max[k] - origin) / s_quantSteps);
+		if( (double)scale * s_quantSteps < root.max[k] - origin )
+			scale = nextafter( scale, FLT_MAX );
+		if( scale < FLT_MIN )
+			scale = FLT_MIN;
+		wide.origin[k] = origin;
+		wide.scale[k] = scale;
+
+		for( int j = 0; j < 4; ++j ) {
+			if( slot[j] < 0 ) {
+				wide.lo[k][j] = 255;
+				wide.hi[k][j] = 0;
+				continue;
+			}
+			const Node& node = m_nodes[ slot[j] ];
+			double qlo = floor( (node.min[k] - origin) / scale ) - 1.0;
+			double qhi = ceil( (node.max[k] - origin) / scale ) + 1.0;
+			wide.lo[k][j] = (unsigned char)max( 0.0, min( qlo, 255.0 ) );
+			wide.hi[k][j] = (unsigned char)max( 0.0, min( qhi, 255.0 ) );
+		}
+	}
+}
+
+// The slab test against all four child boxes at once.  The node's origin
+// is taken relative to the ray's in double precision, so the single
+// precision part only ever sees distances across the node.
+int BVH::hitChildren( const WideNode& w, const double *p, const float *inv,
+	double tMax, float *tNear )
+{
+	float tFar = (float)min( tMax, 3.0e38 );
+
+#ifdef BVH_SSE2
+	__m128 tmin = _mm_setzero_ps();
+	__m128 tmax = _mm_set1_ps( tFar );
+	__m128i zero = _mm_setzero_si128();
+	for( int k = 0; k < 3; ++k ) {
+		int lo, hi;
+		memcpy( &lo, w.lo[k], 4 );
+		memcpy( &hi, w.hi[k], 4 );
+		__m128 qlo = _mm_cvtepi32_ps( _mm_unpacklo_epi16(
+			_mm_unpacklo_epi8( _mm_cvtsi32_si128( lo ), zero ), zero ) );
+		__m128 qhi = _mm_cvtepi32_ps( _mm_unpacklo_epi16(
+			_mm_unpacklo_epi8( _mm_cvtsi32_si128( hi ), zero ), zero ) );
+
+		__m128 offset = _mm_set1_ps( (float)(w.origin[k] - p[k]) );
+		__m128 scale = _mm_set1_ps( w.scale[k] );
+		__m128 i = _mm_set1_ps( inv[k] );
+		__m128 t0 = _mm_mul_ps( _mm_add_ps( offset, _mm_mul_ps( qlo, scale ) ), i );
+		__m128 t1 = _mm_mul_ps( _mm_add_ps( offset, _mm_mul_ps( qhi, scale ) ), i );
+		tmin = _mm_max_ps( tmin, _mm_min_ps( t0, t1 ) );
+		tmax = _mm_min_ps( tmax, _mm_max_ps( t0, t1 ) );
+	}
+	_mm_storeu_ps( tNear, tmin );
+	tmin = _mm_mul_ps( tmin, _mm_set1_ps( 1.0f - s_tSlack ) );
+	tmax = _mm_mul_ps( tmax, _mm_set1_ps( 1.0f + s_tSlack ) );
+	return _mm_movemask_ps( _mm_cmple_ps( tmin, tmax ) );
+#else
+	int mask = 0;
+	for( int j = 0; j < 4; ++j ) {
+		float tmin = 0.0f, tmax = tFar;
+		for( int k = 0; k < 3; ++k ) {
+			float offset = (float)(w.origin[k] - p[k]);
+			float t0 = (offset + w.lo[k][j] * w.scale[k]) * inv[k];
+			float t1 = (offset + w.hi[k][j] * w.scale[k]) * inv[k];
+			tmin = max( tmin, min( t0, t1 ) );
+			tmax = min( tmax, max( t0, t1 ) );
+		}
+		tNear[j] = tmin;
+		if( tmin * (1.0f - s_tSlack) <= tmax * (1.0f + s_tSlack) )
+			mask |= 1 << j;
+	}
+	return mask;
+#endif
+}
+
+// Children always come after their parent, so going through the touched
+// nodes from the highest index down refits each one after its children.
+void BVH::refit( const vector<BoundingBox>& bounds, const vector<int>& changed )
+{
+	vector<char> dirty( m_nodes.size(), 0 );
+	vector<int> touched;
+	for( size_t c = 0; c < changed.size(); ++c ) {
+		for( int i = m_leaf[ changed[c] ]; i >= 0 && !dirty[i]; i = m_parent[i] ) {
+			dirty[i] = 1;
+			touched.push_back( i );
+		}
+	}
+	sort( touched.begin(), touched.end() );
+
+	for( int t = (int)touched.size() - 1; t >= 0; --t ) {
+		Node& node = m_nodes[ touched[t] ];
+		if( node.count > 0 ) {
+			node.min = bounds[ m_items[ node.offset ] ].min;
+			node.max = bounds[ m_items[ node.offset ] ].max;
+			for( int k = node.offset + 1; k < node.offset + node.count; ++k ) {
+				node.min = minimum( node.min, bounds[ m_items[k] ].min );
+				node.max = maximum( node.max, bounds[ m_items[k] ].max );
+			}
+		} else {
+			const Node& left = m_nodes[ touched[t] + 1 ];
+			const Node& right = m_nodes[ node.offset ];
+			node.min = minimum( left.min, right.min );
+			node.max = maximum( left.max, right.max );
+		}
+	}
+
+	// a wide node's boxes all lie under its binary node, which is touched
+	// if any of them moved
+	for( size_t t = 0; t < touched.size(); ++t ) {
+		if( m_wideOf[ touched[t] ] >= 0 )
+			quantize( m_wideOf[ touched[t] ] );
+	}
+}
+
+double BVH::sahCost() const
+{
+	if( m_nodes.empty() )
+		return 0.0;
+	double root = surfaceArea( m_nodes[0].min, m_nodes[0].max );
+	if( root <= 0.0 )
+		return (double)m_items.size();
+
+	double cost = 0.0;
+	for( size_t i = 0; i < m_nodes.size(); ++i ) {
+		const Node& node = m_nodes[i];
+		double area = surfaceArea( node.min, node.max ) / root;
+		cost += area * (node.count > 0 ? node.count : 1);
+	}
+	return cost;
+}
+
+BoundingBox BVH::getBounds() const
+{
+	BoundingBox b;
+	if( !m_nodes.empty() ) {
+		b.min = m_nodes[0].min;
+		b.max = m_nodes[0].max;
+	}
+	return b;
+}
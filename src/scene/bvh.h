@@ -0,0 +1,202 @@
+//
+// bvh.h
+//
+// A bounding volume hierarchy over items that the owner knows how to
+// intersect.  The tree only holds boxes and item indices; the owner hands
+// in one box per item to build it, and a hit test per item to trace it.
+//
+// It is built and refit as a binary tree, which is then collapsed into a
+// compact 4-wide tree for tracing.
+//
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+
+#include "scene.h"
+
+class BVH
+{
+public:
+	// Nodes are stored depth first: an interior node's left child comes
+	// right after it, and its right child is at offset.
+	struct Node
+	{
+		vec3f min, max;
+		int offset;		// leaf: first entry in items(); interior: right child
+		int count;		// number of items in a leaf, 0 for an interior node
+		int axis;		// interior: the axis the children were split along
+	};
+
+	// The tree intersect() walks: up to four children per node, their
+	// boxes stored axis by axis as 8-bit steps across the node's own box,
+	// so one node is a single SIMD box test and fits in 72 bytes.  A leaf
+	// is a range of items() held in its parent's slot.
+	struct WideNode
+	{
+		float origin[3];			// the node's box is origin + q * scale
+		float scale[3];
+		unsigned char lo[3][4];		// per axis, per child
+		unsigned char hi[3][4];
+		int child[4];				// wide node, or first entry in items(); -1 if unused
+		unsigned short count[4];	// items in a leaf, 0 for a wide node
+	};
+
+	struct Stats
+	{
+		int items, nodes, leaves, depth;
+		int wideNodes;
+		double buildTime;	// seconds, wall clock
+		double sahCost;		// sahCost() straight after the build
+
+		Stats() : items( 0 ), nodes( 0 ), leaves( 0 ), depth( 0 ), wideNodes( 0 ),
+			buildTime( 0.0 ), sahCost( 0.0 ) {}
+	};
+
+	// Build over bounds[0..n-1] with the binned surface area heuristic.
+	// Leaves hold more than maxLeafSize items only where that is cheaper
+	// than splitting them.  Large builds run on all cores.
+	void build( const vector<BoundingBox>& bounds, int maxLeafSize = 4 );
+	void clear();
+
+	// The items listed in changed have moved to their new boxes in bounds.
+	// Grow and shrink the nodes above them to fit, keeping the tree's
+	// shape; nodes above only unchanged items are left alone.
+	void refit( const vector<BoundingBox>& bounds, const vector<int>& changed );
+
+	// Expected cost of tracing a ray that hits the root, by the surface
+	// area heuristic: each node costs one box test and each item one hit
+	// test, weighted by the chance of reaching them.  A refit tree whose
+	// cost has grown well past its build cost is worth rebuilding.
+	double sahCost() const;
+
+	bool empty() const { return m_nodes.empty(); }
+	BoundingBox getBounds() const;
+	const vector<Node>& nodes() const { return m_nodes; }
+	const vector<WideNode>& wideNodes() const { return m_wide; }
+	const vector<int>& items() const { return m_items; }
+	// from the last build
+	const Stats& getStats() const { return m_stats; }
+
+	// Visit the leaves the ray passes through, nearest first, calling
+	// hit( item, tMax ) for each of their items.  hit returns true if it
+	// found an intersection before tMax, and lowers tMax to it; subtrees
+	// that start beyond tMax are skipped.  On return tMax is the closest
+	// hit, which was also the last one hit accepted.
+	template< class HitFn >
+	bool intersect( const ray& r, double& tMax, HitFn& hit ) const;
+
+private:
+	int buildNode( int first, int last, const vector<BoundingBox>& bounds,
+		const vector<vec3f>& centroids, int maxLeafSize, int depth, vector<Node>& nodes );
+
+	void collapse();
+	int collapseNode( int n );
+	void quantize( int w );
+
+	// Which of w's children the ray meets within [0, tMax], as a bit mask,
+	// with where it enters each.  p is the ray's origin; inv holds the
+	// reciprocals of its direction, kept finite.
+	static int hitChildren( const WideNode& w, const double *p, const float *inv,
+		double tMax, float *tNear );
+
+	vector<Node> m_nodes;
+	vector<int> m_items;
+	vector<int> m_parent;	// per node, -1 for the root
+	vector<int> m_leaf;		// per item, the leaf holding it
+
+	vector<WideNode> m_wide;
+	vector<int> m_wideRoot;		// per wide node, the binary node it stands for
+	vector<int> m_wideSlot;		// per wide node, four binary nodes for its slots
+	vector<int> m_wideOf;		// per binary node, its wide node or -1
+	Stats m_stats;
+};
+
+template< class HitFn >
+bool BVH::intersect( const ray& r, double& tMax, HitFn& hit ) const
+{
+	if( m_wide.empty() )
+		return false;
+
+	const vec3f& d = r.getDirection();
+	double p[3];
+	float inv[3];
+	for( int k = 0; k < 3; ++k ) {
+		p[k] = r.getPosition()[k];
+		// clamped so that 0 * inv can't make a NaN
+		double i = (d[k] != 0.0) ? 1.0 / d[k] : 1.0e30;
+		inv[k] = (float)max( -1.0e30, min( i, 1.0e30 ) );
+	}
+
+	// each node popped pushes at most four
+	int stack[ 256 ];
+	int top = 0;
+	stack[ top++ ] = 0;
+	bool found = false;
+
+	while( top > 0 ) {
+		const WideNode& n = m_wide[ stack[ --top ] ];
+		float tNear[4];
+		int mask = hitChildren( n, p, inv, tMax, tNear );
+		if( !mask )
+			continue;
+
+		// the children that were hit, nearest first
+		int order[4];
+		int m = 0;
+		for( int c = 0; c < 4; ++c ) {
+			if( !(mask & (1 << c)) || n.child[c] < 0 )
+				continue;
+			int j = m++;
+			for( ; j > 0 && tNear[ order[ j - 1 ] ] > tNear[c]; --j )
+				order[j] = order[ j - 1 ];
+			order[j] = c;
+		}
+
+		// push subtrees far to near, then test the leaves near to far
+		for( int j = m - 1; j >= 0; --j ) {
+			if( n.count[ order[j] ] == 0 )
+				stack[ top++ ] = n.child[ order[j] ];
+		}
+		for( int j = 0; j < m; ++j ) {
+			int c = order[j];
+			for( int k = n.child[c]; k < n.child[c] + n.count[c]; ++k ) {
+				if( hit( m_items[k], tMax ) )
+					found = true;
+			}
+		}
+	}
+	return found;
+}
+
+// A hit test for a BVH over Geometry: keeps the closest hit in best.
+// have_one says whether best already holds a hit from outside the tree.
+struct GeometryHit
+{
+	const vector<Geometry*>& objects;
+	const ray& r;
+	isect& best;
+	int bestIndex;	// -1 while the best hit came from outside the tree
+	bool have_one;
+
+	GeometryHit( const vector<Geometry*>& o, const ray& ray, isect& i, bool have )
+		: objects( o ), r( ray ), best( i ), bestIndex( -1 ), have_one( have ) {}
+
+	bool operator()( int k, double& tMax )
+	{
+		isect cur;
+		if( !objects[k]->intersect( r, cur ) )
+			return false;
+		// on a tie, the object listed first wins, as in a linear search
+		if( have_one && (cur.t > tMax || (cur.t == tMax && (bestIndex < 0 || k > bestIndex))) )
+			return false;
+		best = cur;
+		bestIndex = k;
+		have_one = true;
+		tMax = cur.t;
+		return true;
+	}
+};
+
+#endif // __BVH_H__
@@ -83,6 +83,22 @@ Camera::setAspectRatio( double ar )
     update();
 }
 
+void
+Camera::setRotation( const mat3f& rot )
+// rot - look matrix as built by setLook
+{
+    m = rot;
+    update();
+}
+
+void
+Camera::setNormalizedHeight( double h )
+// h - image plane height at unit distance, i.e. 2*tan(fov/2)
+{
+    normalizedHeight = h;
+    update();
+}
+
 void
 Camera::update()
 {
@@ -13,11 +13,16 @@ public:
     void setLook( const vec3f &viewDir, const vec3f &upDir );
     void setFOV( double );
     void setAspectRatio( double );
+    void setRotation( const mat3f& );
+    void setNormalizedHeight( double );
 	vec3f getU() { return u; }
 	vec3f getV() { return v; }
 	vec3f getLook() { return look; }
 
     double getAspectRatio() { return aspectRatio; }
+	vec3f getEye() { return eye; }
+	mat3f getRotation() { return m; }
+	double getNormalizedHeight() { return normalizedHeight; }
 private:
     mat3f m;                     // rotation matrix
     double normalizedHeight;    // dimensions of image place at unit dist from eye
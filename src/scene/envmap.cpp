@@ -0,0 +1,149 @@
+#include <cmath>
+
+#include "envmap.h"
+
+#define PI 3.14159265359
+
+EnvironmentMap::EnvironmentMap()
+	: m_mapping( PLANAR ), m_u( 1, 0, 0 ), m_v( 0, 1, 0 ), m_look( 0, 0, -1 ),
+	m_right( 1, 0, 0 ), m_up( 0, 1, 0 ), m_uLength( 1.0 ), m_vLength( 1.0 )
+{}
+
+void EnvironmentMap::clear()
+{
+	m_levels.clear();
+}
+
+void EnvironmentMap::load( const MappedBitmap& bmp )
+{
+	clear();
+	if( !bmp.isOpen() )
+		return;
+
+	m_levels.push_back( Level() );
+	Level& base = m_levels.back();
+	base.width = bmp.width();
+	base.height = bmp.height();
+	base.texels.resize( (size_t)base.width * base.height * 3 );
+	for( int y = 0; y < base.height; ++y ) {
+		float *out = &base.texels[ (size_t)y * base.width * 3 ];
+		for( int x = 0; x < base.width; ++x )
+			for( int c = 0; c < 3; ++c )
+				*out++ = bmp.channel( x, y, c ) / 255.0f;
+	}
+
+	// each level averages 2x2 texels of the one before; an odd last row
+	// or column is left out
+	while( m_levels.back().width > 1 || m_levels.back().height > 1 ) {
+		m_levels.push_back( Level() );
+		const Level& src = m_levels[ m_levels.size() - 2 ];
+		Level& dst = m_levels.back();
+		dst.width = max( 1, src.width / 2 );
+		dst.height = max( 1, src.height / 2 );
+		dst.texels.resize( dst.width * dst.height * 3 );
+		for( int y = 0; y < dst.height; ++y ) {
+			int y0 = 2 * y, y1 = min( 2 * y + 1, src.height - 1 );
+			for( int x = 0; x < dst.width; ++x ) {
+				int x0 = 2 * x, x1 = min( 2 * x + 1, src.width - 1 );
+				for( int c = 0; c < 3; ++c ) {
+					dst.texels[ (y * dst.width + x) * 3 + c ] = 0.25f * (
+						src.texels[ (y0 * src.width + x0) * 3 + c ] +
+						src.texels[ (y0 * src.width + x1) * 3 + c ] +
+						src.texels[ (y1 * src.width + x0) * 3 + c ] +
+						src.texels[ (y1 * src.width + x1) * 3 + c ] );
+				}
+			}
+		}
+	}
+}
+
+void EnvironmentMap::setFrame( const vec3f& u, const vec3f& v, const vec3f& look )
+{
+	m_u = u;
+	m_v = v;
+	m_look = look;
+	m_uLength = u.length();
+	m_vLength = v.length();
+	m_right = u.normalize();
+	m_up = v.normalize();
+}
+
+vec3f EnvironmentMap::bilinear( int l, double s, double t, bool wrap ) const
+{
+	const Level& lv = m_levels[l];
+
+	// texel centres sit at half steps
+	double x = s * lv.width - 0.5;
+	double y = t * lv.height - 0.5;
+	int x0 = (int)floor( x ), y0 = (int)floor( y );
+	double fx = x - x0, fy = y - y0;
+	int x1 = x0 + 1, y1 = y0 + 1;
+
+	if( wrap ) {
+		x0 = ((x0 % lv.width) + lv.width) % lv.width;
+		x1 = ((x1 % lv.width) + lv.width) % lv.width;
+	} else {
+		x0 = max( 0, min( x0, lv.width - 1 ) );
+		x1 = max( 0, min( x1, lv.width - 1 ) );
+	}
+	y0 = max( 0, min( y0, lv.height - 1 ) );
+	y1 = max( 0, min( y1, lv.height - 1 ) );
+
+	const float *a = &lv.texels[ (y0 * lv.width + x0) * 3 ];
+	const float *b = &lv.texels[ (y0 * lv.width + x1) * 3 ];
+	const float *c = &lv.texels[ (y1 * lv.width + x0) * 3 ];
+	const float *d = &lv.texels[ (y1 * lv.width + x1) * 3 ];
+	vec3f col;
+	for( int k = 0; k < 3; ++k ) {
+		double lo = a[k] + (b[k] - a[k]) * fx;
+		double hi = c[k] + (d[k] - c[k]) * fx;
+		col[k] = lo + (hi - lo) * fy;
+	}
+	return col;
+}
+
+vec3f EnvironmentMap::filtered( double s, double t, double size, bool wrap ) const
+{
+	int last = (int)m_levels.size() - 1;
+	// the ray's filter reaches halfway to each neighbour, so is twice as
+	// wide as their spacing
+	size *= 2.0;
+	double lod = (size > 1.0) ? log( size ) / log( 2.0 ) : 0.0;
+	if( lod >= last )
+		return bilinear( last, s, t, wrap );
+
+	int l = (int)lod;
+	double f = lod - l;
+	vec3f col = bilinear( l, s, t, wrap );
+	if( f > 0.0 )
+		col = col * (1.0 - f) + bilinear( l + 1, s, t, wrap ) * f;
+	return col;
+}
+
+vec3f EnvironmentMap::lookup( const vec3f& d, double spread ) const
+{
+	if( empty() )
+		return vec3f( 0, 0, 0 );
+	const Level& base = m_levels[0];
+
+	if( m_mapping == LATLONG ) {
+		double y = max( -1.0, min( d * m_up, 1.0 ) );
+		double theta = acos( y );
+		double phi = atan2( d * m_right, d * m_look );
+		double s = 0.5 + phi / (2.0 * PI);
+		double t = 1.0 - theta / PI;
+		// a row's texels narrow towards the poles
+		double ring = 2.0 * PI * max( sin( theta ), 1.0e-3 );
+		double size = spread * max( base.width / ring, base.height / PI );
+		return filtered( s, t, size, true );
+	}
+
+	// x / z across the plane changes by length / z^2 per radian turned
+	double z = d * m_look;
+	double s = (d * m_u) / z + 0.5;
+	double t = (d * m_v) / z + 0.5;
+	if( !(s >= 0.0 && s < 1.0 && t >= 0.0 && t < 1.0) )
+		return vec3f( 0, 0, 0 );
+	double size = spread / (z * z) * max( m_uLength * base.width, m_vLength * base.height );
+	return filtered( s, t, size, false );
+}
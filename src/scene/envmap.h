@@ -0,0 +1,69 @@
+//
+// envmap.h
+//
+// The picture seen where rays leave the scene.  The image is kept as
+// linear float colour with a chain of mip levels, each half the size of
+// the one before, made when it is loaded.  A lookup is given the angle its
+// ray's neighbours spread over and blends the two levels whose texels are
+// nearest that size, so a miss costs the same however large the image is,
+// and a detailed image does not alias.
+//
+
+#ifndef __ENVMAP_H__
+#define __ENVMAP_H__
+
+#include <vector>
+
+#include "../vecmath/vecmath.h"
+#include "../fileio/mappedbitmap.h"
+
+class EnvironmentMap
+{
+public:
+	enum Mapping
+	{
+		PLANAR,		// on a plane in front of the camera, black elsewhere
+		LATLONG		// all round: columns are longitude, rows latitude
+	};
+
+	EnvironmentMap();
+
+	// convert an open bitmap's pixels; it can be closed after
+	void load( const MappedBitmap& bmp );
+	void clear();
+	bool empty() const { return m_levels.empty(); }
+
+	void setMapping( Mapping m ) { m_mapping = m; }
+	Mapping getMapping() const { return m_mapping; }
+
+	// Lay the map out around a camera: the planar map is where the image
+	// plane spanned by u and v would be, one unit along look; the lat-long
+	// map has its poles along v and its middle column along look.
+	void setFrame( const vec3f& u, const vec3f& v, const vec3f& look );
+
+	// The colour seen in unit direction d by a ray whose neighbours are
+	// spread radians away from it.
+	vec3f lookup( const vec3f& d, double spread ) const;
+
+private:
+	struct Level
+	{
+		int width, height;
+		std::vector<float> texels;	// RGB, bottom row first
+	};
+
+	// level l filtered at (s, t), in [0,1] across the image; wrap repeats
+	// it sideways rather than stretching its edge
+	vec3f bilinear( int l, double s, double t, bool wrap ) const;
+	// blend the levels around the one whose texels span a filter for rays
+	// size apart, in texels of the full image
+	vec3f filtered( double s, double t, double size, bool wrap ) const;
+
+	std::vector<Level> m_levels;
+	Mapping m_mapping;
+	vec3f m_u, m_v, m_look;		// as given to setFrame
+	vec3f m_right, m_up;		// unit length
+	double m_uLength, m_vLength;
+};
+
+#endif // __ENVMAP_H__
@@ -0,0 +1,123 @@
+#include <cmath>
+#include <string.h>
+
+#include "footprint.h"
+
+static THREAD_LOCAL Footprint *t_current = NULL;
+
+Footprint *Footprint::current()
+{
+	return t_current;
+}
+
+void Footprint::setCurrent( Footprint *fp )
+{
+	t_current = fp;
+}
+
+void Footprint::clear()
+{
+	memset( m_bits, 0, sizeof( m_bits ) );
+}
+
+void Footprint::reset( const BoundingBox *grid )
+{
+	m_grid = grid;
+	for( int k = 0; k < 3; ++k ) {
+		m_cell[k] = (grid->max[k] - grid->min[k]) / RES;
+		m_scale[k] = (m_cell[k] > 0.0) ? 1.0 / m_cell[k] : 0.0;
+	}
+	clear();
+}
+
+// Clip the ray to the grid, then walk the cells from there one cell
+// boundary at a time.
+void Footprint::addRay( const ray& r, double t )
+{
+	const vec3f& p = r.getPosition();
+	const vec3f& d = r.getDirection();
+	const vec3f& lo = m_grid->min;
+	const vec3f& hi = m_grid->max;
+
+	double inv[3];
+	double t0 = 0.0, t1 = t;
+	for( int k = 0; k < 3; ++k ) {
+		if( d[k] == 0.0 ) {
+			if( p[k] < lo[k] || p[k] > hi[k] )
+				return;
+			inv[k] = 0.0;
+			continue;
+		}
+		inv[k] = 1.0 / d[k];
+		double a = (lo[k] - p[k]) * inv[k];
+		double b = (hi[k] - p[k]) * inv[k];
+		if( a > b )
+			swap( a, b );
+		t0 = max( t0, a );
+		t1 = min( t1, b );
+	}
+	if( t0 > t1 )
+		return;
+
+	int cell[3], step[3];
+	double tNext[3], tDelta[3];
+	for( int k = 0; k < 3; ++k ) {
+		double q = p[k] + d[k] * t0;
+		cell[k] = max( 0, min( (int)floor( (q - lo[k]) * m_scale[k] ), RES - 1 ) );
+		if( d[k] > 0.0 ) {
+			step[k] = 1;
+			tNext[k] = (lo[k] + (cell[k] + 1) * m_cell[k] - p[k]) * inv[k];
+			tDelta[k] = m_cell[k] * inv[k];
+		} else if( d[k] < 0.0 ) {
+			step[k] = -1;
+			tNext[k] = (lo[k] + cell[k] * m_cell[k] - p[k]) * inv[k];
+			tDelta[k] = -m_cell[k] * inv[k];
+		} else {
+			step[k] = 0;
+			tNext[k] = 1.0e308;
+			tDelta[k] = 0.0;
+		}
+	}
+
+	for( ;; ) {
+		set( cell[0], cell[1], cell[2] );
+		int k = (tNext[0] < tNext[1]) ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		if( tNext[k] > t1 )
+			break;
+		cell[k] += step[k];
+		if( cell[k] < 0 || cell[k] >= RES )
+			break;
+		tNext[k] += tDelta[k];
+	}
+}
+
+bool Footprint::addBox( const BoundingBox& b )
+{
+	int from[3], to[3];
+	for( int k = 0; k < 3; ++k ) {
+		double lo = m_grid->min[k], hi = m_grid->max[k];
+		if( b.min[k] < lo || b.max[k] > hi )
+			return false;
+		// widened a little, for rays that only graze a cell boundary
+		double pad = 1.0e-3 * m_cell[k];
+		from[k] = (int)floor( (b.min[k] - pad - lo) * m_scale[k] );
+		to[k] = (int)floor( (b.max[k] + pad - lo) * m_scale[k] );
+		from[k] = max( 0, from[k] );
+		to[k] = min( to[k], RES - 1 );
+	}
+
+	for( int z = from[2]; z <= to[2]; ++z )
+		for( int y = from[1]; y <= to[1]; ++y )
+			for( int x = from[0]; x <= to[0]; ++x )
+				set( x, y, z );
+	return true;
+}
+
+bool Footprint::overlaps( const Footprint& other ) const
+{
+	for( int k = 0; k < RES * RES * RES / 32; ++k ) {
+		if( m_bits[k] & other.m_bits[k] )
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,47 @@
+//
+// footprint.h
+//
+// Where in the scene a group of rays went: one bit per cell of a coarse
+// grid over a box, set for each cell a ray passed through on its way to
+// what it hit.  A change confined to some box can only alter the rays
+// whose footprint reaches the box's cells.
+//
+
+#ifndef __FOOTPRINT_H__
+#define __FOOTPRINT_H__
+
+#include "scene.h"
+
+class Footprint
+{
+public:
+	enum { RES = 16 };	// cells along each side of the grid
+
+	Footprint() : m_grid( NULL ) { m_cell[0] = m_cell[1] = m_cell[2] = 0.0; m_scale[0] = m_scale[1] = m_scale[2] = 0.0; clear(); }
+
+	// Empty the footprint, laying its grid over *grid, which must outlive it.
+	void reset( const BoundingBox *grid );
+
+	// r from its origin out to t; the parts outside the grid are left out
+	void addRay( const ray& r, double t );
+	// the cells b covers; false, adding nothing, if it reaches outside
+	// the grid
+	bool addBox( const BoundingBox& b );
+
+	bool overlaps( const Footprint& other ) const;
+
+	// The footprint Scene::intersect adds rays to on this thread, or NULL.
+	static Footprint *current();
+	static void setCurrent( Footprint *fp );
+
+private:
+	void clear();
+	void set( int x, int y, int z ) { int c = (z * RES + y) * RES + x; m_bits[ c >> 5 ] |= 1u << (c & 31); }
+
+	const BoundingBox *m_grid;
+	double m_cell[3];		// a cell's size along each axis
+	double m_scale[3];		// cells per unit
+	unsigned int m_bits[ RES * RES * RES / 32 ];
+};
+
+#endif // __FOOTPRINT_H__
@@ -1,10 +1,106 @@
 #include <cmath>
+#include <atomic>
+#include <mutex>
 #include <set>
 #include "light.h"
+#include "footprint.h"
 #include "../ui/TraceUI.h"
 
 extern TraceUI* traceUI;
 
+// One thread's last occluder per light, by Light::id, and its counts.
+struct ShadowCache
+{
+	vector<const Geometry*> occluder;
+	long long rays, hits;
+
+	ShadowCache() : rays( 0 ), hits( 0 ) {}
+};
+
+// A thread keeps the cache it is handed until resetShadowCaches, and
+// takes another on its next shadow ray after that.  The caches in use
+// are listed for getShadowCacheStats; the rest wait to be handed out
+// again, so those of workers that have finished are reused rather than
+// piling up over renders.
+static THREAD_LOCAL ShadowCache *t_shadowCache = NULL;
+static THREAD_LOCAL int t_shadowGeneration = -1;
+static vector<ShadowCache*> s_shadowCaches;
+static vector<ShadowCache*> s_freeShadowCaches;
+static atomic<int> s_shadowGeneration( 0 );
+static mutex s_shadowCachesLock;
+
+static ShadowCache& shadowCache()
+{
+	if( !t_shadowCache || t_shadowGeneration != s_shadowGeneration.load( memory_order_relaxed ) ) {
+		lock_guard<mutex> lock( s_shadowCachesLock );
+		if( s_freeShadowCaches.empty() ) {
+			t_shadowCache = new ShadowCache;
+		} else {
+			t_shadowCache = s_freeShadowCaches.back();
+			s_freeShadowCaches.pop_back();
+		}
+		s_shadowCaches.push_back( t_shadowCache );
+		t_shadowGeneration = s_shadowGeneration.load( memory_order_relaxed );
+	}
+	return *t_shadowCache;
+}
+
+int Light::nextId()
+{
+	static int next = 0;
+	return next++;
+}
+
+void Light::resetShadowCaches()
+{
+	lock_guard<mutex> lock( s_shadowCachesLock );
+	for( size_t k = 0; k < s_shadowCaches.size(); ++k ) {
+		ShadowCache *cache = s_shadowCaches[k];
+		cache->occluder.clear();
+		cache->rays = cache->hits = 0;
+		s_freeShadowCaches.push_back( cache );
+	}
+	s_shadowCaches.clear();
+	++s_shadowGeneration;
+}
+
+void Light::getShadowCacheStats( long long& rays, long long& hits )
+{
+	lock_guard<mutex> lock( s_shadowCachesLock );
+	rays = hits = 0;
+	for( size_t k = 0; k < s_shadowCaches.size(); ++k ) {
+		rays += s_shadowCaches[k]->rays;
+		hits += s_shadowCaches[k]->hits;
+	}
+}
+
+bool Light::blockedByLastOccluder( const ray& r, double distance ) const
+{
+	ShadowCache& cache = shadowCache();
+	++cache.rays;
+	if( id >= (int)cache.occluder.size() || !cache.occluder[id] )
+		return false;
+
+	// blocked in the same way the search through the scene would find
+	isect i;
+	if( !cache.occluder[id]->intersect( r, i ) || distance - i.t < RAY_EPSILON ||
+		!i.getMaterial().kt.iszero() )
+		return false;
+	++cache.hits;
+	// the ray stopped here as surely as if the scene had been searched
+	if( Footprint *fp = Footprint::current() )
+		fp->addRay( r, i.t );
+	return true;
+}
+
+void Light::setLastOccluder( const Geometry *obj ) const
+{
+	ShadowCache& cache = shadowCache();
+	if( id >= (int)cache.occluder.size() )
+		cache.occluder.resize( id + 1, NULL );
+	cache.occluder[id] = obj;
+}
+
 double DirectionalLight::distanceAttenuation( const vec3f& P ) const
 {
 	// distance to light is infinite, so f(di) goes to 0.  Return 1.
@@ -21,15 +117,22 @@ vec3f DirectionalLight::shadowAttenuation( const vec3f& P ) const
 	isect isecP;
 	vec3f ret = getColor(P);
 	ray r = ray(curP, d);
-	while (scene->intersect(r, isecP))
+	if (blockedByLastOccluder(r, 1.0e308)) return vec3f(0, 0, 0);
+	const Geometry *hitObject;
+	while (scene->intersect(r, isecP, hitObject))
 	{
 		//if not transparent return black
-		if (isecP.getMaterial().kt.iszero()) return vec3f(0, 0, 0);
+		if (isecP.getMaterial().kt.iszero())
+		{
+			setLastOccluder(hitObject);
+			return vec3f(0, 0, 0);
+		}
 		//use current intersection point as new light source
 		curP = r.at(isecP.t);
 		r = ray(curP, d);
 		ret = prod(ret, isecP.getMaterial().kt);
 	}
+	setLastOccluder(NULL);
 	return ret;
 }
 
@@ -113,17 +216,28 @@ vec3f PointLight::_shadowAttenuation(const vec3f& P, const ray& r) const
 	vec3f curP = r.getPosition();
 	isect isecP;
 	ray newr(curP, d);
-	while (scene->intersect(newr, isecP))
+	if (blockedByLastOccluder(newr, distance)) return vec3f(0, 0, 0);
+	const Geometry *hitObject;
+	while (scene->intersect(newr, isecP, hitObject))
 	{
 		//prevent going beyond this light
-		if ((distance -= isecP.t) < RAY_EPSILON) return result;
+		if ((distance -= isecP.t) < RAY_EPSILON)
+		{
+			setLastOccluder(NULL);
+			return result;
+		}
 		//if not transparent return black
-		if (isecP.getMaterial().kt.iszero()) return vec3f(0, 0, 0);
+		if (isecP.getMaterial().kt.iszero())
+		{
+			setLastOccluder(hitObject);
+			return vec3f(0, 0, 0);
+		}
 		//use current intersection point as new light source
-		curP = r.at(isecP.t);
+		curP = newr.at(isecP.t);
 		newr = ray(curP, d);
 		result = prod(result, isecP.getMaterial().kt);
 	}
+	setLastOccluder(NULL);
 	return result;
 }
 
@@ -14,11 +14,31 @@ public:
 	virtual vec3f getDirection( const vec3f& P ) const = 0;
 	virtual double getCumulativeIndex() const { return 1.0; } //return the refractive index of this light source's environment
 
+	// Shadow rays traced since the last reset, on every thread, and how
+	// many of them were settled by the cache of each light's last
+	// occluder.
+	static void getShadowCacheStats( long long& rays, long long& hits );
+	// Forget every thread's occluders and counts, for a new render.  No
+	// thread may be tracing.
+	static void resetShadowCaches();
+
 protected:
 	Light( Scene *scene, const vec3f& col )
-		: SceneElement( scene ), color( col ) {}
+		: SceneElement( scene ), color( col ), id( nextId() ) {}
+
+	// Each thread remembers, per light, the opaque object that last
+	// blocked it.  Neighbouring points are usually blocked by the same
+	// one, so a shadow ray tries it before searching the whole scene:
+	// true if it still blocks r within distance.
+	bool blockedByLastOccluder( const ray& r, double distance ) const;
+	// what blocked this light's last shadow ray on this thread, or NULL
+	void setLastOccluder( const Geometry *obj ) const;
 
 	vec3f 		color;
+
+private:
+	static int nextId();
+	int			id;		// this light's slot in the occluder caches
 };
 
 class DirectionalLight
@@ -31,6 +51,7 @@ public:
 	virtual double distanceAttenuation( const vec3f& P ) const;
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
+	const vec3f& getOrientation() const { return orientation; }
 	//TODO: add getPhoton for directional light
 
 protected:
@@ -47,6 +68,13 @@ public:
 	virtual vec3f getColor( const vec3f& P ) const;
 	virtual vec3f getDirection( const vec3f& P ) const;
 	void setDistanceAttenuation(const double constant, const double linear, const double quadratic);
+	void getDistanceAttenuation(double& constant, double& linear, double& quadratic) const
+	{
+		constant = m_const_atten_coeff;
+		linear = m_linear_atten_coeff;
+		quadratic = m_quadratic_atten_coeff;
+	}
+	const vec3f& getPosition() const { return position; }
 	/**
 	 * \brief Helper function, for easy implemente soft shadow
 	 * \param P the point which intersect
@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+#include "lighttree.h"
+#include "light.h"
+
+static double brightness( const vec3f& c )
+{
+	return c[0] + c[1] + c[2];
+}
+
+LightTree::LightTree( const vector<Light*>& lights )
+	: m_lights( lights )
+{
+	vector<BoundingBox> boxes;
+	for( int k = 0; k < (int)m_lights.size(); ++k ) {
+		const PointLight *point = dynamic_cast<const PointLight*>( m_lights[k] );
+		if( !point ) {
+			m_always.push_back( k );
+			continue;
+		}
+		BoundingBox b;
+		b.min = b.max = point->getPosition();
+		boxes.push_back( b );
+		m_points.push_back( k );
+	}
+	m_bvh.build( boxes );
+
+	// children come after their parents, so fill in from the end
+	const vector<BVH::Node>& nodes = m_bvh.nodes();
+	const vector<int>& items = m_bvh.items();
+	m_clusters.resize( nodes.size() );
+	for( int n = (int)nodes.size() - 1; n >= 0; --n ) {
+		Cluster& c = m_clusters[n];
+		if( nodes[n].count == 0 ) {
+			const Cluster& left = m_clusters[ n + 1 ];
+			const Cluster& right = m_clusters[ nodes[n].offset ];
+			const PointLight *l = (const PointLight*)m_lights[ left.representative ];
+			const PointLight *r = (const PointLight*)m_lights[ right.representative ];
+			c.representative = brightness( l->getColor( l->getPosition() ) ) >= brightness( r->getColor( r->getPosition() ) )
+				? left.representative : right.representative;
+			c.total = left.total + right.total;
+			c.brightest = maximum( left.brightest, right.brightest );
+			c.constant = min( left.constant, right.constant );
+			c.linear = min( left.linear, right.linear );
+			c.quadratic = min( left.quadratic, right.quadratic );
+			c.count = left.count + right.count;
+			continue;
+		}
+
+		c.representative = -1;
+		c.total = c.brightest = vec3f( 0, 0, 0 );
+		c.constant = c.linear = c.quadratic = 1e308;
+		c.count = nodes[n].count;
+		double best = -1.0;
+		for( int k = nodes[n].offset; k < nodes[n].offset + nodes[n].count; ++k ) {
+			int index = m_points[ items[k] ];
+			const PointLight *point = (const PointLight*)m_lights[ index ];
+			vec3f color = point->getColor( point->getPosition() );
+			double a, b, q;
+			point->getDistanceAttenuation( a, b, q );
+			// the bounds below need terms that only grow with distance
+			if( a < 0.0 || b < 0.0 || q < 0.0 )
+				a = b = q = 0.0;
+			if( brightness( color ) > best ) {
+				best = brightness( color );
+				c.representative = index;
+			}
+			c.total += color;
+			c.brightest = maximum( c.brightest, color );
+			c.constant = min( c.constant, a );
+			c.linear = min( c.linear, b );
+			c.quadratic = min( c.quadratic, q );
+		}
+	}
+}
+
+static double distanceTo( const vec3f& P, const BVH::Node& node )
+{
+	double d2 = 0.0;
+	for( int k = 0; k < 3; ++k ) {
+		double d = max( max( node.min[k] - P[k], P[k] - node.max[k] ), 0.0 );
+		d2 += d * d;
+	}
+	return sqrt( d2 );
+}
+
+// What light k brings to P, unshadowed and head on, in its brightest channel.
+double LightTree::estimate( int k, const vec3f& P, const vec3f& weight ) const
+{
+	vec3f e = prod( m_lights[k]->getColor( P ), weight ) * m_lights[k]->distanceAttenuation( P );
+	return max( e[0], max( e[1], e[2] ) );
+}
+
+// Queue node's group in the cut, or if it is a single light, just shade
+// with that light.
+void LightTree::addToCut( int node, const vec3f& P, const vec3f& weight, vector<CutEntry>& cut,
+	double& total, vector<int>& exact ) const
+{
+	const BVH::Node& n = m_bvh.nodes()[ node ];
+	const Cluster& c = m_clusters[ node ];
+	if( c.count == 1 ) {
+		total += estimate( c.representative, P, weight );
+		exact.push_back( c.representative );
+		return;
+	}
+
+	// as PointLight::distanceAttenuation, at the nearest the lights can be
+	double d = distanceTo( P, n );
+	double atten = 1.0 / max( c.constant + c.linear * d + c.quadratic * d * d, 1.0 );
+	vec3f most = prod( c.brightest, weight ) * (atten * c.count);
+	vec3f guess = prod( c.total, weight ) * m_lights[ c.representative ]->distanceAttenuation( P );
+
+	CutEntry e;
+	e.bound = max( most[0], max( most[1], most[2] ) );
+	e.estimate = max( guess[0], max( guess[1], guess[2] ) );
+	e.node = node;
+	total += e.estimate;
+	cut.push_back( e );
+	push_heap( cut.begin(), cut.end() );
+}
+
+// Starting from the root, keep splitting the group with the largest error
+// bound until every bound is acceptable.  The estimate of the total light
+// ignores shadows and the angle to the light, so it only ever errs high.
+void LightTree::select( const vec3f& P, const vec3f& weight, double error, double absError,
+	Scratch& scratch, vector<Pick>& out ) const
+{
+	out.clear();
+	if( m_lights.empty() )
+		return;
+
+	vector<int>& exact = scratch.exact;
+	vector<CutEntry>& cut = scratch.cut;
+	exact.assign( m_always.begin(), m_always.end() );
+	cut.clear();
+	double total = 0.0;
+	const vector<BVH::Node>& nodes = m_bvh.nodes();
+	const vector<int>& items = m_bvh.items();
+	if( !nodes.empty() )
+		addToCut( 0, P, weight, cut, total, exact );
+
+	while( !cut.empty() ) {
+		CutEntry worst = cut.front();
+		if( worst.bound <= absError || worst.bound <= error * total )
+			break;
+		pop_heap( cut.begin(), cut.end() );
+		cut.pop_back();
+		total -= worst.estimate;
+
+		const BVH::Node& n = nodes[ worst.node ];
+		if( n.count > 0 ) {
+			for( int k = n.offset; k < n.offset + n.count; ++k ) {
+				total += estimate( m_points[ items[k] ], P, weight );
+				exact.push_back( m_points[ items[k] ] );
+			}
+		} else {
+			addToCut( worst.node + 1, P, weight, cut, total, exact );
+			addToCut( n.offset, P, weight, cut, total, exact );
+		}
+	}
+
+	// in the scene's order, for lights on their own at least
+	sort( exact.begin(), exact.end() );
+	for( size_t k = 0; k < exact.size(); ++k ) {
+		Pick p = { m_lights[ exact[k] ], vec3f( 1, 1, 1 ) };
+		out.push_back( p );
+	}
+	for( size_t k = 0; k < cut.size(); ++k ) {
+		const Cluster& c = m_clusters[ cut[k].node ];
+		const Light *rep = m_lights[ c.representative ];
+		vec3f color = rep->getColor( P );
+		Pick p = { rep, vec3f( 0, 0, 0 ) };
+		for( int i = 0; i < 3; ++i ) {
+			if( color[i] > 0.0 )
+				p.scale[i] = c.total[i] / color[i];
+		}
+		out.push_back( p );
+	}
+}
@@ -0,0 +1,88 @@
+//
+// lighttree.h
+//
+// Picks out the lights worth shading a point with.  Point lights fade
+// with distance, so in a rig of hundreds most of them add little at any
+// one point, yet each would still cost a shadow ray.  The tree groups the
+// point lights in a BVH; at a given point, faint groups are shaded as a
+// single representative light standing in for the whole group, and only
+// groups that could visibly matter are broken down further.
+//
+
+#ifndef __LIGHT_TREE_H__
+#define __LIGHT_TREE_H__
+
+#include <vector>
+
+#include "scene.h"
+#include "bvh.h"
+
+class Light;
+
+class LightTree
+{
+public:
+	// A light to shade with, and what to scale its contribution by so it
+	// stands for its whole group: (1,1,1) for a light on its own.
+	struct Pick
+	{
+		const Light *light;
+		vec3f scale;
+	};
+
+	// Room for select() to work in.  Kept by the caller and passed to
+	// every call, so picking allocates nothing once it has grown.
+	struct Scratch;
+
+	// lights, in the scene's order
+	LightTree( const vector<Light*>& lights );
+
+	// The lights to shade P with, in the scene's order.  weight bounds
+	// what the material makes of a light's colour, per channel (kd + ks
+	// for the Phong model).  A group is shaded through one light only if
+	// the most it could be off by is within error times the estimate of
+	// all the light at P, or within absError in any case.
+	void select( const vec3f& P, const vec3f& weight, double error, double absError,
+		Scratch& scratch, vector<Pick>& out ) const;
+
+	int size() const { return (int)m_lights.size(); }
+
+private:
+	// a subtree's point lights
+	struct Cluster
+	{
+		int representative;		// the brightest, as an index into m_lights
+		vec3f total;			// their colours summed
+		vec3f brightest;		// the brightest of each channel
+		double constant, linear, quadratic;		// weakest attenuation terms
+		int count;
+	};
+
+	// a group in the cut being refined, with the most its representative
+	// can be off by
+	struct CutEntry
+	{
+		double bound;
+		double estimate;
+		int node;
+		bool operator<( const CutEntry& other ) const { return bound < other.bound; }
+	};
+
+	double estimate( int k, const vec3f& P, const vec3f& weight ) const;
+	void addToCut( int node, const vec3f& P, const vec3f& weight, vector<CutEntry>& cut,
+		double& total, vector<int>& exact ) const;
+
+	vector<Light*> m_lights;
+	vector<int> m_always;		// lights that aren't point lights
+	vector<int> m_points;		// index into m_lights per BVH item
+	BVH m_bvh;
+	vector<Cluster> m_clusters;	// per BVH node
+};
+
+struct LightTree::Scratch
+{
+	vector<int> exact;
+	vector<CutEntry> cut;
+};
+
+#endif // __LIGHT_TREE_H__
@@ -1,8 +1,49 @@
 #include "ray.h"
 #include "material.h"
 #include "light.h"
+#include "lighttree.h"
 #include <algorithm>
 
+// How far the light tree may let a group of lights, shaded as one, be
+// off: a small fraction of all the light at the point, which goes
+// unnoticed, or under half a step of an 8-bit image.
+static const double s_lightError = 0.02;
+static const double s_lightAbsError = 0.5 / 255.0;
+
+// The lights the tree picked and the room it picked them in, one set per
+// thread reused for every hit so shading doesn't allocate.
+struct LightPicks
+{
+	vector<LightTree::Pick> picks;
+	LightTree::Scratch scratch;
+};
+
+static THREAD_LOCAL LightPicks *t_picks = NULL;
+
+static LightPicks& lightPicks()
+{
+	if( !t_picks )
+		t_picks = new LightPicks;
+	return *t_picks;
+}
+
+
+// What one light adds to the phong model at P.
+vec3f Material::shadeLight( const Light *light, const ray& r, const vec3f& P, const vec3f& out_P,
+	const vec3f& normal, const vec3f& transparency ) const
+{
+	// shadow and distance attenuation, the color part is handled in light
+	// Note use out_P is important, to see the effect, select recur_depth and look at the red one
+	vec3f atten = light->distanceAttenuation(P)*light->shadowAttenuation(out_P);
+
+	vec3f dir = (light->getDirection(P)).normalize();
+	double angle = maximum(normal.dot(dir), 0.0);
+	vec3f diffuse = prod(kd * angle, transparency);
+
+	vec3f R = ((2 * (normal.dot(dir)) * normal) - dir).normalize();
+	vec3f specular = ks*(pow(maximum(R*(-r.getDirection()), 0), shininess*128.0));
+	return prod(atten, diffuse + specular);
+}
 
 // Apply the phong model to this point on the surface of the object, returning
 // the color of that point.
@@ -23,18 +64,25 @@ vec3f Material::shade( Scene *scene, const ray& r, const isect& i ) const
 	result += prod(transparency, ambient);
 	
 	// iterate over ray
-	for (Scene::cliter j = scene->beginLights(); j != scene->endLights(); j++){
-		// shadow and distance attenuation, the color part is handled in light
-		// Note use out_P is important, to see the effect, select recur_depth and look at the red one
-		vec3f atten = (*j)->distanceAttenuation(P)*(*j)->shadowAttenuation(out_P);
-
-		vec3f light = ((*j)->getDirection(P)).normalize();
-		double angle = maximum(normal.dot(light), 0.0);
-		vec3f diffuse = prod(kd * angle, transparency);
-
-		vec3f R = ((2 * (normal.dot(light)) * normal) - light).normalize();
-		vec3f specular = ks*(pow(maximum(R*(-r.getDirection()), 0), shininess*128.0));
-		result += prod(atten, diffuse + specular);
+	const LightTree *tree = scene->getLightTree();
+	if (tree)
+	{
+		// nearby lights one by one, faint groups of them as one
+		// shadeLight only traces shadow rays, so nothing below reuses it
+		LightPicks& picks = lightPicks();
+		vector<LightTree::Pick>& lights = picks.picks;
+		tree->select(P, prod(kd, transparency) + ks, s_lightError, s_lightAbsError, picks.scratch, lights);
+		for (size_t j = 0; j < lights.size(); j++)
+		{
+			result += prod(lights[j].scale, shadeLight(lights[j].light, r, P, out_P, normal, transparency));
+		}
+	}
+	else
+	{
+		for (Scene::cliter j = scene->beginLights(); j != scene->endLights(); j++)
+		{
+			result += shadeLight(*j, r, P, out_P, normal, transparency);
+		}
 	}
 	result = result.clamp();
 	return result;
@@ -12,6 +12,7 @@
 class Scene;
 class ray;
 class isect;
+class Light;
 
 class Material
 {
@@ -32,6 +33,12 @@ public:
 
 	virtual vec3f shade( Scene *scene, const ray& r, const isect& i ) const;
 
+protected:
+	vec3f shadeLight( const Light *light, const ray& r, const vec3f& P, const vec3f& out_P,
+		const vec3f& normal, const vec3f& transparency ) const;
+
+public:
+
     vec3f ke;                    // emissive
     vec3f ka;                    // ambient
     vec3f ks;                    // specular
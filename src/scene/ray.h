@@ -93,4 +93,14 @@ public:
 const double RAY_EPSILON = 0.00001;
 const double NORMAL_EPSILON = 0.00001;
 
+// Per-thread storage for the renderer's workers.  Only plain data can be
+// thread local with the compilers this builds with, so anything larger is
+// held through a pointer, made on the thread's first use and kept for the
+// life of the program.
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec( thread )
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #endif // __RAY_H__
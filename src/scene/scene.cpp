@@ -2,6 +2,11 @@
 
 #include "scene.h"
 #include "light.h"
+#include "bvh.h"
+#include "lighttree.h"
+#include "footprint.h"
+#include "../SceneObjects/ParticleSys.h"
+#include "../SceneObjects/Instance.h"
 #include "../ui/TraceUI.h"
 extern TraceUI* traceUI;
 
@@ -110,6 +115,40 @@ bool Geometry::intersectLocal( const ray& r, isect& i ) const
 	return false;
 }
 
+bool Geometry::intersectSpan( const ray& r, Span& s ) const
+{
+	vec3f pos = transform->globalToLocalCoords(r.getPosition());
+	vec3f dir = transform->globalToLocalCoords(r.getPosition() + r.getDirection()) - pos;
+	double length = dir.length();
+	dir /= length;
+
+	s = Span();
+	if( !intersectLocalSpan( ray( pos, dir ), s ) )
+		return false;
+
+	s.nIn = transform->localToGlobalCoordsNormal(s.nIn);
+	s.nOut = transform->localToGlobalCoordsNormal(s.nOut);
+	s.tIn /= length;
+	s.tOut /= length;
+	return true;
+}
+
+// Start far behind the ray to find the entry, then search again from
+// just past it for the exit.
+bool Geometry::intersectLocalSpan( const ray& r, Span& s ) const
+{
+	const double backup = 10000.0;
+	isect i;
+	if( !intersectLocal( ray( r.at( -backup ), r.getDirection() ), i ) )
+		return false;
+	s.include( i.t - backup, i.N );
+
+	double from = s.tIn + RAY_EPSILON * 10;
+	if( intersectLocal( ray( r.at( from ), r.getDirection() ), i ) )
+		s.include( from + i.t, i.N );
+	return true;
+}
+
 bool Geometry::hasBoundingBoxCapability() const
 {
 	// by default, primitives do not have to specify a bounding box.
@@ -152,17 +191,42 @@ Scene::~Scene()
 	for (g = CSGObjectArray.begin(); g != CSGObjectArray.end(); ++g) {
 		delete (*g);
 	}
+
+	for (list<Prototype*>::iterator p = prototypes.begin(); p != prototypes.end(); ++p) {
+		delete (*p);
+	}
+
+	delete bvh;
+	delete lightTree;
 }
 
 // Get any intersection with an object.  Return information about the 
 // intersection through the reference parameter.
 bool Scene::intersect( const ray& r, isect& i ) const
+{
+	const Geometry *hitObject;
+	return intersect( r, i, hitObject );
+}
+
+// As above, also saying which of the scene's objects was hit: i.obj may
+// be a part of it, such as a face of a mesh or an object in a prototype.
+bool Scene::intersect( const ray& r, isect& i, const Geometry*& hitObject ) const
+{
+	bool hit = findHit( r, i, hitObject );
+	// an incremental render is noting where its rays go
+	if( Footprint *fp = Footprint::current() )
+		fp->addRay( r, hit ? i.t : 1.0e308 );
+	return hit;
+}
+
+bool Scene::findHit( const ray& r, isect& i, const Geometry*& hitObject ) const
 {
 	typedef list<Geometry*>::const_iterator iter;
 	iter j;
 
 	isect cur;
 	bool have_one = false;
+	hitObject = NULL;
 
 	// try the non-bounded objects
 	for( j = nonboundedobjects.begin(); j != nonboundedobjects.end(); ++j ) {
@@ -170,16 +234,27 @@ bool Scene::intersect( const ray& r, isect& i ) const
 			if( !have_one || (cur.t < i.t) ) {
 				i = cur;
 				have_one = true;
+				hitObject = *j;
 			}
 		}
 	}
 
 	// try the bounded objects
+	if( bvh ) {
+		GeometryHit hit( bvhObjects, r, i, have_one );
+		double tMax = have_one ? i.t : 1.0e308;
+		bvh->intersect( r, tMax, hit );
+		if( hit.bestIndex >= 0 )
+			hitObject = bvhObjects[ hit.bestIndex ];
+		return hit.have_one;
+	}
+
 	for( j = boundedobjects.begin(); j != boundedobjects.end(); ++j ) {
 		if( (*j)->intersect( r, cur ) ) {
 			if( !have_one || (cur.t < i.t) ) {
 				i = cur;
 				have_one = true;
+				hitObject = *j;
 			}
 		}
 	}
@@ -188,6 +263,9 @@ bool Scene::intersect( const ray& r, isect& i ) const
 	return have_one;
 }
 
+// Scenes with fewer lights than this shade with every one of them.
+static const size_t s_minTreeLights = 16;
+
 void Scene::initScene()
 {
 	bool first_boundedobject = true;
@@ -215,4 +293,64 @@ void Scene::initScene()
 		else
 			nonboundedobjects.push_back(*j);
 	}
+
+	// and put a hierarchy over the bounded ones
+	bvhObjects.assign( boundedobjects.begin(), boundedobjects.end() );
+	bvhBounds.resize( bvhObjects.size() );
+	dynamicObjects.clear();
+	for( int k = 0; k < (int)bvhObjects.size(); ++k ) {
+		bvhBounds[k] = bvhObjects[k]->getBoundingBox();
+		if( bvhObjects[k]->isDynamic() )
+			dynamicObjects.push_back( k );
+	}
+	delete bvh;
+	bvh = new BVH;
+	bvh->build( bvhBounds );
+	bvhCost = bvh->sahCost();
+
+	// a handful of lights are quicker to just go through
+	delete lightTree;
+	lightTree = NULL;
+	if( lights.size() >= s_minTreeLights )
+		lightTree = new LightTree( vector<Light*>( lights.begin(), lights.end() ) );
+}
+
+void Scene::endPrototype(vector<Geometry*>& taken)
+{
+	giter first = objects.begin();
+	advance(first, prototypeMark);
+	taken.assign(first, objects.end());
+	objects.erase(first, objects.end());
+}
+
+void Scene::setFrame(int frame)
+{
+	for (list<ParticleSource*>::iterator p = particleSources.begin(); p != particleSources.end(); ++p) {
+		(*p)->setFrame(frame);
+	}
+	updateDynamic();
+}
+
+// Refit the hierarchy to the dynamic objects' new boxes, and rebuild it
+// once refitting has let it get half as slow again as a fresh build.
+void Scene::updateDynamic()
+{
+	if( !bvh || dynamicObjects.empty() )
+		return;
+
+	changedBounds.clear();
+	for( size_t d = 0; d < dynamicObjects.size(); ++d ) {
+		int k = dynamicObjects[d];
+		changedBounds.push_back( bvhBounds[k] );
+		bvhObjects[k]->ComputeBoundingBox();
+		bvhBounds[k] = bvhObjects[k]->getBoundingBox();
+		changedBounds.push_back( bvhBounds[k] );
+	}
+	bvh->refit( bvhBounds, dynamicObjects );
+
+	if( bvh->sahCost() > 1.5 * bvhCost ) {
+		bvh->build( bvhBounds );
+		bvhCost = bvh->sahCost();
+	}
+	sceneBounds = bvh->getBounds();
 }
@@ -9,6 +9,7 @@
 
 #include <list>
 #include <algorithm>
+#include <string>
 
 using namespace std;
 
@@ -20,7 +21,11 @@ using namespace std;
 
 class Light;
 class Scene;
+class BVH;
+class LightTree;
 extern class CSGNode;
+class ParticleSource;
+class Prototype;
 
 class SceneElement
 {
@@ -86,6 +91,26 @@ public:
         children.push_back(child);
         return child;
     }
+
+    // A child whose global matrix, inverse and normal matrix were already
+    // computed (e.g. loaded from a compiled scene), so nothing is inverted.
+    TransformNode *createBakedChild(const mat4f& xform, const mat4f& inverse, const mat3f& normi)
+    {
+        TransformNode *child = new TransformNode(this, xform, inverse, normi);
+        children.push_back(child);
+        return child;
+    }
+
+    // Detach and delete a child made by createChild, with its subtree.
+    void removeChild(TransformNode *child)
+    {
+        children.remove(child);
+        delete child;
+    }
+
+    const mat4f& getXform() const { return xform; }
+    const mat4f& getInverse() const { return inverse; }
+    const mat3f& getNormi() const { return normi; }
     
     // Coordinate-Space transformation
     vec3f globalToLocalCoords(const vec3f &v)
@@ -124,6 +149,10 @@ protected:
         inverse = this->xform.inverse();
         normi = this->xform.upper33().inverse().transpose();
     }
+
+    TransformNode(TransformNode *parent, const mat4f& xform, const mat4f& inverse, const mat3f& normi)
+        : xform(xform), inverse(inverse), normi(normi), parent(parent), children()
+    {}
 };
 
 class TransformRoot : public TransformNode
@@ -133,6 +162,23 @@ public:
         : TransformNode(NULL, mat4f()) {}
 };
 
+// Where a line enters and leaves a solid; see Geometry::intersectSpan.
+struct Span
+{
+	double tIn, tOut;
+	vec3f nIn, nOut;
+
+	Span() : tIn( 1.0e308 ), tOut( -1.0e308 ) {}
+	bool isEmpty() const { return tIn > tOut; }
+
+	// widen the span to take in a surface crossing at t
+	void include( double t, const vec3f& n )
+	{
+		if( t < tIn ) { tIn = t; nIn = n; }
+		if( t > tOut ) { tOut = t; nOut = n; }
+	}
+};
+
 // A Geometry object is anything that has extent in three dimensions.
 // It may not be an actual visible scene object.  For example, hierarchical
 // spatial subdivision could be expressed in terms of Geometry instances.
@@ -147,9 +193,16 @@ public:
     // do not call directly - this should only be called by intersect()
 	virtual bool intersectLocal( const ray& r, isect& i ) const;
 
+	// For CSG: the first and last points where the whole line through r
+	// (negative t included) crosses the object.  Works in global space
+	// like intersect(); primitives override intersectLocalSpan, and the
+	// default falls back on two intersectLocal calls.
+	bool intersectSpan( const ray& r, Span& s ) const;
+	virtual bool intersectLocalSpan( const ray& r, Span& s ) const;
 
 	virtual bool hasBoundingBoxCapability() const;
 	const BoundingBox& getBoundingBox() const { return bounds; }
+	void setBoundingBox( const BoundingBox& b ) { bounds = b; }
 	virtual void ComputeBoundingBox()
     {
         // take the object's local bounding box, transform all 8 points on it,
@@ -196,13 +249,21 @@ public:
     virtual BoundingBox ComputeLocalBoundingBox() { return BoundingBox(); }
 
     void setTransform(TransformNode *transform) { this->transform = transform; };
+    TransformNode *getTransform() const { return transform; }
+
+	// Dynamic objects may change shape between frames.  Scene::setFrame
+	// recomputes their bounding boxes and refits the scene's hierarchy
+	// around them; everything else is assumed to stay put.
+	void setDynamic( bool d ) { dynamic = d; }
+	bool isDynamic() const { return dynamic; }
     
 	Geometry( Scene *scene ) 
-		: SceneElement( scene ) {}
+		: SceneElement( scene ), dynamic( false ) {}
 
 protected:
 	BoundingBox bounds;
     TransformNode *transform;
+	bool dynamic;
 };
 
 // A SceneObject is a real actual thing that we want to model in the 
@@ -261,7 +322,8 @@ public:
 
 public:
 	Scene() 
-		: transformRoot(), objects(), lights(), currentOrder(0) {}
+		: transformRoot(), objects(), lights(), currentOrder(0), bvh(NULL), bvhCost(0.0),
+		lightTree(NULL) {}
 	virtual ~Scene();
 
 	void add( Geometry* obj )
@@ -269,10 +331,17 @@ public:
 		obj->ComputeBoundingBox();
 		objects.push_back( obj );
 	}
+	// for objects whose bounds are already known (compiled scenes)
+	void add( Geometry* obj, const BoundingBox& bounds )
+	{
+		obj->setBoundingBox( bounds );
+		objects.push_back( obj );
+	}
 	void add( Light* light )
 	{ lights.push_back( light ); }
 
 	bool intersect( const ray& r, isect& i ) const;
+	bool intersect( const ray& r, isect& i, const Geometry*& hitObject ) const;
 	void initScene();
 
 	vec3f getAmbient() const {
@@ -294,11 +363,42 @@ public:
 	void addCSGNode(CSGNode* node) {
 		CSGNodeArray.push_back(node);
 	}
+	void addParticleSource(ParticleSource* source) {
+		particleSources.push_back(source);
+	}
+
+	// Objects added between these two calls are handed back rather than
+	// kept, for building a Prototype; the scene then owns the prototype.
+	void beginPrototype() { prototypeMark = objects.size(); }
+	void endPrototype(vector<Geometry*>& taken);
+	void addPrototype(Prototype* proto) { prototypes.push_back(proto); }
+
+	// The files the scene was read from: its own, and any it names, such
+	// as meshes.
+	void addSourceFile(const string& name) { sourceFiles.push_back(name); }
+	const vector<string>& getSourceFiles() const { return sourceFiles; }
+
+	// Advance every particle source to the given frame, for rendering a
+	// sequence from one loaded scene, then update the hierarchy around
+	// the dynamic objects.
+	void setFrame(int frame);
 
 	list<Light*>::const_iterator beginLights() const { return lights.begin(); }
 	list<Light*>::const_iterator endLights() const { return lights.end(); }
+
+	list<Geometry*>::const_iterator beginObjects() const { return objects.begin(); }
+	list<Geometry*>::const_iterator endObjects() const { return objects.end(); }
         
 	Camera *getCamera() { return &camera; }
+	const BoundingBox& getSceneBounds() const { return sceneBounds; }
+	// the hierarchy over the bounded objects, once initScene has run
+	const BVH *getBVH() const { return bvh; }
+	// for picking out the lights that matter at a point, once initScene
+	// has run; NULL when there are too few lights to need it
+	const LightTree *getLightTree() const { return lightTree; }
+	// The boxes the last setFrame may have changed anything inside: each
+	// dynamic object's box from before and after.
+	const vector<BoundingBox>& getChangedBounds() const { return changedBounds; }
 
 
 private:
@@ -315,6 +415,23 @@ private:
 	BoundingBox sceneBounds;
 	list<CSGNode*> CSGNodeArray;
 	list<Geometry*> CSGObjectArray;
+	list<ParticleSource*> particleSources;
+	list<Prototype*> prototypes;
+	size_t prototypeMark;
+	vector<string> sourceFiles;
+
+	// The bounded objects, in the order the hierarchy indexes them, with
+	// their boxes as it last saw them.
+	vector<Geometry*> bvhObjects;
+	vector<BoundingBox> bvhBounds;
+	vector<int> dynamicObjects;
+	BVH *bvh;
+	double bvhCost;		// sahCost() when the hierarchy was last built
+	vector<BoundingBox> changedBounds;
+	void updateDynamic();
+	bool findHit( const ray& r, isect& i, const Geometry*& hitObject ) const;
+
+	LightTree *lightTree;
 };
 
 #endif // __SCENE_H__
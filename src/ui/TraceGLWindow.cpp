@@ -7,11 +7,39 @@
 
 #include "../fileio/bitmap.h"
 
+// how often the image is redrawn while it changes
+static const double s_framesPerSecond = 30.0;
+
 TraceGLWindow::TraceGLWindow(int x, int y, int w, int h, const char *l)
 			: Fl_Gl_Window(x,y,w,h,l)
 {
 	m_nWindowWidth = w;
 	m_nWindowHeight = h;
+	raytracer = NULL;
+
+	m_texture = 0;
+	m_nTextureWidth = m_nTextureHeight = 0;
+	m_nImageWidth = m_nImageHeight = 0;
+
+	Fl::add_timeout(frameInterval(), cb_frame, this);
+}
+
+TraceGLWindow::~TraceGLWindow()
+{
+	Fl::remove_timeout(cb_frame, this);
+}
+
+double TraceGLWindow::frameInterval()
+{
+	return 1.0 / s_framesPerSecond;
+}
+
+void TraceGLWindow::cb_frame(void* v)
+{
+	TraceGLWindow* win = (TraceGLWindow*)v;
+	if (win->raytracer && win->shown() && win->raytracer->displayDirty())
+		win->redraw();
+	Fl::repeat_timeout(frameInterval(), cb_frame, v);
 }
 
 int TraceGLWindow::handle(int event)
@@ -24,6 +52,10 @@ void TraceGLWindow::draw()
 {
 	if(!valid())
 	{
+		// a new context has none of the old one's textures
+		if ( m_texture && !glIsTexture( m_texture ) )
+			m_texture = 0;
+
 		glClearColor(0.7f, 0.7f, 0.7f, 1.0);
 
 		// We're only using 2-D, so turn off depth 
@@ -37,11 +69,32 @@ void TraceGLWindow::draw()
 
 	glClear( GL_COLOR_BUFFER_BIT );
 
-	unsigned char* buf;
-	raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
+	if ( !raytracer ) {
+		glFlush();
+		return;
+	}
+
+	if ( upload() ) {
+		double s = (double)m_nImageWidth / m_nTextureWidth;
+		double t = (double)m_nImageHeight / m_nTextureHeight;
+
+		glEnable( GL_TEXTURE_2D );
+		glBindTexture( GL_TEXTURE_2D, m_texture );
+		glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+		glBegin( GL_QUADS );
+		glTexCoord2d( 0, 0 );	glVertex2i( 0, 0 );
+		glTexCoord2d( s, 0 );	glVertex2i( m_nImageWidth, 0 );
+		glTexCoord2d( s, t );	glVertex2i( m_nImageWidth, m_nImageHeight );
+		glTexCoord2d( 0, t );	glVertex2i( 0, m_nImageHeight );
+		glEnd();
+		glDisable( GL_TEXTURE_2D );
+	} else {
+		// too big for a texture here: copy the whole image every time
+		raytracer->takeDirtyRegions( m_regions );
+
+		unsigned char* buf;
+		raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
 
-	if ( buf ) {
-		// just copy image to GLwindow conceptually
 		glRasterPos2i( 0, 0 );
 		glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
 		glPixelStorei( GL_UNPACK_ROW_LENGTH, m_nDrawWidth );
@@ -52,6 +105,63 @@ void TraceGLWindow::draw()
 	glFlush();
 }
 
+bool TraceGLWindow::upload()
+{
+	int width, height;
+	raytracer->getBufferSize( width, height );
+
+	if ( m_texture == 0 || width != m_nImageWidth || height != m_nImageHeight ) {
+		int texWidth = 1, texHeight = 1;
+		while ( texWidth < width )
+			texWidth *= 2;
+		while ( texHeight < height )
+			texHeight *= 2;
+
+		GLint maxSize = 0;
+		glGetIntegerv( GL_MAX_TEXTURE_SIZE, &maxSize );
+		if ( texWidth > maxSize || texHeight > maxSize ) {
+			if ( m_texture )
+				glDeleteTextures( 1, &m_texture );
+			m_texture = 0;
+			m_nImageWidth = m_nImageHeight = 0;
+			return false;
+		}
+
+		if ( m_texture == 0 )
+			glGenTextures( 1, &m_texture );
+		glBindTexture( GL_TEXTURE_2D, m_texture );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, texWidth, texHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+		m_nTextureWidth = texWidth;
+		m_nTextureHeight = texHeight;
+		m_nImageWidth = width;
+		m_nImageHeight = height;
+
+		// the texture needs all of the image: drop the marks before
+		// reading it, so later changes are still caught
+		raytracer->takeDirtyRegions( m_regions );
+		m_regions.clear();
+		if ( width > 0 && height > 0 ) {
+			RayTracer::Region all = { 0, 0, width, height };
+			m_regions.push_back( all );
+		}
+	} else {
+		raytracer->takeDirtyRegions( m_regions );
+	}
+
+	glBindTexture( GL_TEXTURE_2D, m_texture );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+	for ( size_t k = 0; k < m_regions.size(); ++k ) {
+		const RayTracer::Region& r = m_regions[k];
+		m_pixels.resize( r.w * r.h * 3 );
+		raytracer->getRegion( r, &m_pixels[0] );
+		glTexSubImage2D( GL_TEXTURE_2D, 0, r.x, r.y, r.w, r.h, GL_RGB, GL_UNSIGNED_BYTE, &m_pixels[0] );
+	}
+	return true;
+}
+
 void TraceGLWindow::refresh()
 {
 	redraw();
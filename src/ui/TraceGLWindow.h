@@ -14,12 +14,15 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 
+#include <vector>
+
 #include "../RayTracer.h"
 
 class TraceGLWindow : public Fl_Gl_Window
 {
 public:
 	TraceGLWindow(int x, int y, int w, int h, const char *l);
+	~TraceGLWindow();
 	void draw();
 	int handle(int event);
 
@@ -33,9 +36,26 @@ public:
 
 	void setRayTracer(RayTracer *tracer);
 
+	// Renders never draw the window themselves: a timer redraws it this
+	// often while the tracer has new pixels.  A render running on the UI
+	// thread should let events through about as often.
+	static double frameInterval();
+
 private:
+	static void cb_frame(void* v);
+	// bring the texture up to date with the tracer's new pixels
+	bool upload();
+
 	int m_nWindowWidth, m_nWindowHeight;
 	int m_nDrawWidth, m_nDrawHeight;
+
+	// The image is kept in a texture, a power of two on each side so that
+	// any OpenGL has it, and only the tiles that changed are sent to it.
+	GLuint m_texture;
+	int m_nTextureWidth, m_nTextureHeight;
+	int m_nImageWidth, m_nImageHeight;		// what the texture holds
+	std::vector<RayTracer::Region> m_regions;
+	std::vector<unsigned char> m_pixels;
 };
 
 #endif // __TRACE_GL_WINDOW_H__
\ No newline at end of file
@@ -17,6 +17,9 @@
 
 static bool done;
 
+// samples per pixel a progressive render adds after the coarse passes
+static const int s_progressiveSamples = 15;
+
 //------------------------------------- Help Functions --------------------------------------------
 TraceUI* TraceUI::whoami(Fl_Menu_* o)	// from menu item back to UI itself
 {
@@ -92,6 +95,13 @@ void TraceUI::cb_clear_background_image(Fl_Menu_* o, void* v)
 	pUI->raytracer->clearBackground();
 }
 
+void TraceUI::cb_latlong_background(Fl_Menu_* o, void* v)
+{
+	TraceUI* pUI = whoami(o);
+	const Fl_Menu_Item* item = o->mvalue();
+	pUI->raytracer->setBackgroundMapping(item->value() ? EnvironmentMap::LATLONG : EnvironmentMap::PLANAR);
+}
+
 void TraceUI::cb_exit(Fl_Menu_* o, void* v)
 {
 	TraceUI* pUI=whoami(o);
@@ -129,6 +139,12 @@ void TraceUI::cb_fresnelSwitch(Fl_Widget *o, void*)
 	((TraceUI*)(o->user_data()))->m_is_enable_fresnel ^= true;
 }
 
+void TraceUI::cb_progressiveToggle(Fl_Widget* o, void* v)
+{
+	TraceUI* pUI = (TraceUI*)(o->user_data());
+	pUI->m_bProgressive = bool(((Fl_Light_Button*)o)->value());
+}
+
 void TraceUI::cb_sizeSlides(Fl_Widget* o, void* v)
 {
 	TraceUI* pUI=(TraceUI*)(o->user_data());
@@ -228,6 +244,38 @@ void TraceUI::cb_render(Fl_Widget* o, void* v)
 		Fl::check();
 		Fl::flush();
 
+		if (pUI->m_bProgressive) {
+			// coarse to fine, showing each pass as it fills in, then keep
+			// adding samples until the last pass or until stopped
+			int passes = RayTracer::coarsePasses() + s_progressiveSamples;
+			for (int pass = 0; pass < passes && !done; pass++) {
+				for (int y = 0; y < height && !done; ) {
+					// a band of rows at a time, so events, and with them
+					// the display's timer, get through about once a frame
+					// however long a row takes
+					int rows = 1;
+					prev = clock();
+					do {
+						pUI->raytracer->tracePass(pass, y, y + rows);
+						y += rows;
+						now = clock();
+						rows *= 2;
+					} while (y < height && (double)(now - prev) / CLOCKS_PER_SEC < TraceGLWindow::frameInterval());
+
+					Fl::check();
+
+					// update the window label
+					sprintf(buffer, "(pass %d/%d, %d%%) %s", pass + 1, passes,
+						(int)((double)y / (double)height * 100.0), old_label);
+					pUI->m_traceGlWindow->label(buffer);
+				}
+			}
+			done = true;
+			pUI->m_traceGlWindow->refresh();
+			pUI->m_traceGlWindow->label(old_label);
+			return;
+		}
+
 		for (int y = 0; y<height; y++) {
 			for (int x = 0; x<width; x++) {
 				if (done) break;
@@ -235,20 +283,11 @@ void TraceUI::cb_render(Fl_Widget* o, void* v)
 				// current time
 				now = clock();
 
-				// check event every 1/2 second
-				if (((double)(now - prev) / CLOCKS_PER_SEC)>0.5) {
+				// check events about once a frame; the display's timer
+				// redraws the new pixels
+				if (((double)(now - prev) / CLOCKS_PER_SEC) > TraceGLWindow::frameInterval()) {
 					prev = now;
-
-					if (Fl::ready()) {
-						// refresh
-						pUI->m_traceGlWindow->refresh();
-						// check event
-						Fl::check();
-
-						if (Fl::damage()) {
-							Fl::flush();
-						}
-					}
+					Fl::check();
 				}
 
 				pUI->raytracer->tracePixel(x, y);
@@ -256,15 +295,6 @@ void TraceUI::cb_render(Fl_Widget* o, void* v)
 			}
 			if (done) break;
 
-			// flush when finish a row
-			if (Fl::ready()) {
-				// refresh
-				pUI->m_traceGlWindow->refresh();
-
-				if (Fl::damage()) {
-					Fl::flush();
-				}
-			}
 			// update the window label
 			sprintf(buffer, "(%d%%) %s", (int)((double)y / (double)height * 100.0), old_label);
 			pUI->m_traceGlWindow->label(buffer);
@@ -301,9 +331,6 @@ void TraceUI::cb_threadrender(Fl_Widget* o, void* v)
 		// start to render here	
 		done=false;
 
-		clock_t prev, now;
-		prev = clock();
-
 		pUI->m_traceGlWindow->refresh();
 		Fl::check();
 		Fl::flush();
@@ -316,33 +343,17 @@ void TraceUI::cb_threadrender(Fl_Widget* o, void* v)
 		}
 		workers.push_back(async(launch::async, RenderWorker, pUI, partition * (pUI->getThread() - 1), height, width));
 
+		// the workers never touch the window: this thread handles events,
+		// the display's timer among them, until they are all done
 		bool is_all_joined = false;
 		do
 		{
-			// current time
-			now = clock();
-
-			// check event every 1/2 second
-			if (((double)(now - prev) / CLOCKS_PER_SEC)>0.5)
-			{
-				prev = now;
-
-				if (Fl::ready()) {
-					// refresh
-					pUI->m_traceGlWindow->refresh();
-					// check event
-					Fl::check();
-
-					if (Fl::damage()) {
-						Fl::flush();
-					}
-				}
-			}
+			Fl::wait(TraceGLWindow::frameInterval());
 
 			is_all_joined = true;
 			for (const auto &w : workers)
 			{
-				if (w.wait_for(chrono::milliseconds(100))
+				if (w.wait_for(chrono::seconds(0))
 					!= future_status::ready)
 				{
 					is_all_joined = false;
@@ -384,6 +395,12 @@ int TraceUI::getDepth()
 	return m_nDepth;
 }
 
+void TraceUI::setDepth(int depth)
+{
+	m_nDepth = depth;
+	m_depthSlider->value(m_nDepth);
+}
+
 // menu definition
 Fl_Menu_Item TraceUI::menuitems[] = {
 	{ "&File",		0, 0, 0, FL_SUBMENU },
@@ -392,6 +409,7 @@ Fl_Menu_Item TraceUI::menuitems[] = {
 		{ "&Load Height Map...", FL_ALT + 's', (Fl_Callback *)TraceUI::cb_load_height_map },
 		{ "&Load Background...", FL_ALT + 'b', (Fl_Callback *)TraceUI::cb_load_background_image },
 		{ "&Clear Background...", FL_ALT + 'c', (Fl_Callback *)TraceUI::cb_clear_background_image },
+		{ "Lat-Long &Background", 0, (Fl_Callback *)TraceUI::cb_latlong_background, 0, FL_MENU_TOGGLE },
 		{ "&Exit",			FL_ALT + 'e', (Fl_Callback *)TraceUI::cb_exit },
 		{ 0 },
 
@@ -414,6 +432,7 @@ TraceUI::TraceUI() {
 	m_dCausticAmplify = 1.0;
 	m_is_enable_soft_shadow = false;
 	m_is_enable_fresnel = false;
+	m_bProgressive = false;
 	m_thread = 1;
 	m_mainWindow = new Fl_Window(100, 40, 320, 280, "Ray <Not Loaded>");
 		m_mainWindow->user_data((void*)(this));	// record self to be used by static callback functions
@@ -535,6 +554,11 @@ TraceUI::TraceUI() {
 		m_fresnelSwitch->value(0);
 		m_fresnelSwitch->callback(cb_fresnelSwitch);
 
+		m_progressiveButton = new Fl_Light_Button(245, 205, 70, 20, "Progressive");
+		m_progressiveButton->user_data((void*)(this));
+		m_progressiveButton->value(m_bProgressive);
+		m_progressiveButton->callback(cb_progressiveToggle);
+
 		m_renderButton = new Fl_Button(240, 27, 70, 25, "&Render");
 		m_renderButton->user_data((void*)(this));
 		m_renderButton->callback(cb_render);
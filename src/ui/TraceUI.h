@@ -41,6 +41,7 @@ public:
 	Fl_Button*			m_stopButton;
 	Fl_Light_Button*	m_softShadowButton;
 	Fl_Light_Button*	m_fresnelSwitch;
+	Fl_Light_Button*	m_progressiveButton;
 	TraceGLWindow*		m_traceGlWindow;
 	Fl_Button*		m_threadButton;
 
@@ -59,6 +60,7 @@ public:
 
 	int			getSize();
 	int			getDepth();
+	void		setDepth(int depth);
 	int	getThread() const
 	{
 		return m_thread;
@@ -79,6 +81,7 @@ private:
 	double		m_dCausticAmplify;
 	bool		m_is_enable_soft_shadow;
 	bool		m_is_enable_fresnel;
+	bool		m_bProgressive;
 // static class members
 	static Fl_Menu_Item menuitems[];
 
@@ -89,9 +92,11 @@ private:
 	static void cb_load_height_map(Fl_Menu_* o, void* v);
 	static void cb_load_background_image(Fl_Menu_* o, void* v);
 	static void cb_clear_background_image(Fl_Menu_* o, void* v);
+	static void cb_latlong_background(Fl_Menu_* o, void* v);
 	static void cb_exit(Fl_Menu_* o, void* v);
 	static void cb_about(Fl_Menu_* o, void* v);
 	static void cb_fresnelSwitch(Fl_Widget* o, void* v);
+	static void cb_progressiveToggle(Fl_Widget* o, void* v);
 	static void cb_exit2(Fl_Widget* o, void* v);
 
 	static void cb_sizeSlides(Fl_Widget* o, void* v);